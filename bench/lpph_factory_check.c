@@ -0,0 +1,175 @@
+/**
+ * @file lpph_factory_check.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the check of the factory configuration session, against a simulated ASCII configuration channel
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * Build and run on the host:
+ *     gcc -O2 -o lpph_factory_check bench/lpph_factory_check.c lpph.c -lm && ./lpph_factory_check
+ * Exits with 1 if factory init does not keep the command depth and pacing set by the application.
+ */
+
+#include "../lpph.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#define DEPTH                       4
+#define QUEUE_LEN                   128
+
+/**
+ * @brief Simulated configuration channel of a probe, commands are answered at once
+ * 
+ */
+typedef struct{
+    char line[PHOTOMETRIC_PROBE_COMMAND_LEN + 1]; // command being received
+    uint8_t line_len;
+    char queue[QUEUE_LEN]; // responses not yet read
+    uint16_t head;
+    uint16_t tail;
+    int settings[3]; // address, baudrate and mode
+    uint8_t in_flight; // commands sent and whose response line is not yet read
+    uint8_t in_flight_max;
+}check_channel_t;
+
+static uint32_t now_us;
+static check_channel_t channel;
+static uint8_t saves;
+
+/**
+ * @brief Answers a complete command
+ * 
+ * @param cmd: command, without terminator
+ */
+static void check_answer(const char* cmd);
+
+/**
+ * @brief Receives command bytes
+ * 
+ */
+static void check_write(const uint8_t* buf, uint8_t len);
+
+/**
+ * @brief Reads queued response bytes, the virtual time runs to the timeout when fewer are queued
+ * 
+ */
+static uint8_t check_read_timeout(uint8_t* buf, uint8_t len, uint32_t timeout_us);
+
+static void check_read(uint8_t* buf, uint8_t len);
+static void check_transmission(void);
+static uint32_t check_time_us(void);
+static void check_delay_us(uint32_t us);
+static void check_save(void* ctx, const probe_pacing_t* pacing);
+
+
+
+int main(void){
+    photometric_probe_obj probe;
+    probe_pacing_t pacing;
+    config_t cfg = {.address = 12, .baudrate = BAUDRATE_19200, .mode = MODE_8E1};
+    probe.uart_write = &check_write;
+    probe.uart_read = &check_read;
+    probe.enable_transmission = &check_transmission;
+    probe.disable_transmission = &check_transmission;
+    photometric_probe_init(&probe, cfg);
+    probe.uart_read_timeout = &check_read_timeout;
+    probe.get_time_us = &check_time_us;
+    probe.command_depth = DEPTH;
+    photometric_probe_pacing_init(&pacing, &check_delay_us);
+    pacing.save = &check_save;
+    uint32_t safe_us = pacing.safe_us;
+    probe.pacing = &pacing;
+
+    probe_status_e status = photometric_probe_factory_init(&probe, cfg);
+    uint8_t ok = (status == STATUS_OK) && (channel.in_flight_max > 1) && (saves > 0) && (pacing.safe_us < safe_us);
+    printf("status %d, commands in flight %u (depth %u), pacing %u us -> %u us, saved %u times: %s\n", status,
+           channel.in_flight_max, DEPTH, safe_us, pacing.safe_us, saves, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+
+static void check_answer(const char* cmd){
+    char rsp[16] = "&";
+    // power up wake up, never answered
+    if(strcmp(cmd, "@") == 0){
+        return;
+    }
+    if(strncmp(cmd, "CM", 2) == 0){
+        const char* which = strchr("ABP", cmd[2]);
+        if(which != NULL){
+            channel.settings[which - "ABP"] = atoi(&cmd[3]);
+        }
+    }
+    else if(strncmp(cmd, "RM", 2) == 0){
+        const char* which = strchr("ABP", cmd[2]);
+        snprintf(rsp, sizeof(rsp), "%d", (which != NULL) ? channel.settings[which - "ABP"] : -1);
+    }
+    for(const char* c = rsp; *c != '\0'; c++){
+        channel.queue[channel.tail++ % QUEUE_LEN] = *c;
+    }
+    channel.queue[channel.tail++ % QUEUE_LEN] = '\r';
+    channel.queue[channel.tail++ % QUEUE_LEN] = '\n';
+    channel.in_flight++;
+    if(channel.in_flight > channel.in_flight_max){
+        channel.in_flight_max = channel.in_flight;
+    }
+}
+
+
+static void check_write(const uint8_t* buf, uint8_t len){
+    for(uint8_t i = 0; i < len; i++){
+        if(buf[i] == '\r'){
+            channel.line[channel.line_len] = '\0';
+            channel.line_len = 0;
+            check_answer(channel.line);
+        }
+        else if(channel.line_len < PHOTOMETRIC_PROBE_COMMAND_LEN){
+            channel.line[channel.line_len++] = buf[i];
+        }
+    }
+}
+
+
+static uint8_t check_read_timeout(uint8_t* buf, uint8_t len, uint32_t timeout_us){
+    uint8_t got = 0;
+    while((got < len) && (channel.head != channel.tail)){
+        buf[got] = channel.queue[channel.head++ % QUEUE_LEN];
+        if(buf[got] == '\r'){
+            channel.in_flight--;
+        }
+        got++;
+    }
+    if(got < len){
+        now_us += timeout_us;
+    }
+    return got;
+}
+
+
+static void check_read(uint8_t* buf, uint8_t len){
+    check_read_timeout(buf, len, 0);
+}
+
+
+static void check_transmission(void){
+}
+
+
+static uint32_t check_time_us(void){
+    return now_us;
+}
+
+
+static void check_delay_us(uint32_t us){
+    now_us += us;
+}
+
+
+static void check_save(void* ctx, const probe_pacing_t* pacing){
+    (void) ctx;
+    (void) pacing;
+    saves++;
+}
@@ -0,0 +1,230 @@
+/**
+ * @file lpph_mbtcp_check.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the staleness check of the Modbus TCP gateway, a bus engine driven on a virtual clock and a loopback client
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * Build and run on a Linux host:
+ *     gcc -O2 -o lpph_mbtcp_check bench/lpph_mbtcp_check.c lpph_mbtcp.c lpph_linux.c lpph_engine.c lpph_wheel.c lpph.c -lm && ./lpph_mbtcp_check
+ * Exits with 1 if a probe whose bus is down or whose last update failed is still served.
+ */
+
+#include "../lpph_mbtcp.h"
+#include "stdio.h"
+#include "string.h"
+#include "unistd.h"
+#include "poll.h"
+#include "arpa/inet.h"
+#include "sys/socket.h"
+
+#define ADDRESS                     1
+#define PERIOD_MS                   1000
+#define CLIENTS                     2
+
+/**
+ * @brief Simulated bus, answers the request sent by the engine unless muted
+ * 
+ */
+typedef struct{
+    uint8_t request[PHOTOMETRIC_PROBE_REQUEST_LEN];
+    uint8_t pending; // 1 if a request waits for its response
+    uint8_t muted; // 1 to leave requests unanswered
+}check_bus_t;
+
+static uint32_t now_us;
+static check_bus_t line;
+
+/**
+ * @brief Virtual clock of the probe
+ * 
+ * @return uint32_t: time in microseconds
+ */
+static uint32_t check_time_us(void);
+
+/**
+ * @brief Engine transport, keeps the request for check_run to answer
+ * 
+ */
+static int check_send(void* ctx, const uint8_t* buf, uint8_t len);
+
+/**
+ * @brief Modbus RTU CRC of a frame
+ * 
+ */
+static uint16_t check_crc(const uint8_t* buf, uint8_t len);
+
+/**
+ * @brief Lets the virtual time pass, answering the requests of the engine on the way
+ * 
+ * @param engine: pointer to bus engine object
+ * @param bus: pointer to the bus of the probe
+ * @param until_ms: virtual time to advance to
+ */
+static void check_run(probe_engine_obj* engine, probe_bus_obj* bus, uint32_t until_ms);
+
+/**
+ * @brief Reads the registers of the probe through the gateway
+ * 
+ * @param gw: pointer to gateway object
+ * @param fd: connected client socket
+ * @param exception: exception code of the response, 0 if none
+ * @return uint8_t: function code of the response, 0x84 for an exception, 0 if no response
+ */
+static uint8_t check_request(probe_mbtcp_obj* gw, int fd, uint8_t* exception);
+
+/**
+ * @brief Prints a check outcome
+ * 
+ * @return uint8_t: 1 if failed, 0 otherwise
+ */
+static uint8_t check_expect(const char* name, uint8_t function, uint8_t exception, uint8_t expected);
+
+
+
+int main(void){
+    static probe_mbtcp_obj gw;
+    static probe_mbtcp_client_t clients[CLIENTS];
+    probe_engine_obj engine;
+    probe_bus_obj bus;
+    probe_node_obj node;
+    photometric_probe_obj probe;
+    config_t cfg = {.address = ADDRESS, .baudrate = BAUDRATE_115200};
+    uint8_t failed = 0;
+    uint8_t exception = 0;
+    uint8_t function;
+
+    probe_engine_init(&engine, 0);
+    probe_engine_add_bus(&engine, &bus, (probe_transport_t) {.send = &check_send, .ctx = &line});
+    photometric_probe_init(&probe, cfg);
+    probe.get_time_us = &check_time_us;
+    probe_engine_add_probe(&node, &bus, &probe, PERIOD_MS);
+    // no age limit, only a failure makes a value stale
+    probe_mbtcp_init(&gw, &engine, clients, CLIENTS, 0);
+    if(probe_mbtcp_listen(&gw, "127.0.0.1", 0) != STATUS_OK){
+        perror("listen");
+        return 1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(gw.port)};
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    if(connect(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0){
+        perror("connect");
+        return 1;
+    }
+
+    check_run(&engine, &bus, 100);
+    function = check_request(&gw, fd, &exception);
+    failed |= check_expect("polled", function, exception, 0);
+
+    probe_engine_bus_down(&bus);
+    function = check_request(&gw, fd, &exception);
+    failed |= check_expect("bus down", function, exception, MBTCP_EXC_TARGET_FAILED);
+
+    probe_engine_bus_up(&bus);
+    check_run(&engine, &bus, 200);
+    function = check_request(&gw, fd, &exception);
+    failed |= check_expect("bus up", function, exception, 0);
+
+    // every retry of the next poll goes unanswered
+    line.muted = 1;
+    check_run(&engine, &bus, 1200 + PERIOD_MS);
+    function = check_request(&gw, fd, &exception);
+    failed |= check_expect("update failed", function, exception, MBTCP_EXC_TARGET_FAILED);
+
+    close(fd);
+    probe_mbtcp_close(&gw);
+    return failed;
+}
+
+
+static uint32_t check_time_us(void){
+    return now_us;
+}
+
+
+static int check_send(void* ctx, const uint8_t* buf, uint8_t len){
+    check_bus_t* b = (check_bus_t*) ctx;
+    memcpy(b->request, buf, len);
+    b->pending = 1;
+    return 0;
+}
+
+
+static uint16_t check_crc(const uint8_t* buf, uint8_t len){
+    uint16_t crc = 0xFFFF;
+    for(uint8_t i = 0; i < len; i++){
+        crc ^= buf[i];
+        for(uint8_t bit = 0; bit < 8; bit++){
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+
+static void check_run(probe_engine_obj* engine, probe_bus_obj* bus, uint32_t until_ms){
+    for(uint32_t ms = engine->now_ms; (int32_t) (until_ms - ms) >= 0; ms++){
+        now_us = ms * 1000;
+        probe_engine_process(engine, ms);
+        if(line.pending && line.muted){
+            // the engine times the request out
+            line.pending = 0;
+        }
+        if(line.pending){
+            uint8_t rsp[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN];
+            uint8_t reg = line.request[3];
+            uint8_t count = line.request[5];
+            rsp[0] = line.request[0];
+            rsp[1] = 0x04;
+            rsp[2] = count * 2;
+            for(uint8_t i = 0; i < count; i++){
+                rsp[3 + (2 * i)] = 0;
+                rsp[4 + (2 * i)] = 100 + reg + i;
+            }
+            uint16_t crc = check_crc(rsp, 3 + (2 * count));
+            rsp[3 + (2 * count)] = crc & 0xFF;
+            rsp[4 + (2 * count)] = crc >> 8;
+            line.pending = 0;
+            probe_engine_bus_receive_at(bus, rsp, PHOTOMETRIC_PROBE_RESPONSE_LEN(count), now_us);
+        }
+    }
+}
+
+
+static uint8_t check_request(probe_mbtcp_obj* gw, int fd, uint8_t* exception){
+    static uint16_t transaction;
+    const uint8_t req[12] = {transaction >> 8, transaction & 0xFF, 0, 0, 0, 6, ADDRESS, 0x04, 0, 0, 0, 3};
+    uint8_t rsp[PROBE_MBTCP_ADU_LEN];
+    ssize_t len = 0;
+    transaction++;
+    if(send(fd, req, sizeof(req), 0) != (ssize_t) sizeof(req)){
+        return 0;
+    }
+    // accepts the connection first, then serves the request
+    for(uint8_t i = 0; (i < 100) && (len < 9); i++){
+        probe_mbtcp_process(gw);
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if(poll(&pfd, 1, 10) == 1){
+            ssize_t n = recv(fd, &rsp[len], sizeof(rsp) - len, 0);
+            if(n <= 0){
+                return 0;
+            }
+            len += n;
+        }
+    }
+    if(len < 9){
+        return 0;
+    }
+    *exception = (rsp[7] & 0x80) ? rsp[8] : 0;
+    return rsp[7];
+}
+
+
+static uint8_t check_expect(const char* name, uint8_t function, uint8_t exception, uint8_t expected){
+    uint8_t ok = (function != 0) && (exception == expected);
+    printf("%-16s function 0x%02X exception 0x%02X %s\n", name, function, exception, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+/**
+ * @file lpph_micro.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the micro-benchmarks of the hot functions of the driver, with hardware performance counters
+ * @version 0.1
+ * @date 2024-09-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Build and run on the host:
+ *     gcc -O2 -o lpph_micro bench/lpph_micro.c lpph_crc_sw.c -lm && ./lpph_micro [iterations]
+ * The driver is compiled into the benchmark, so its static functions (ModRTU_CRC, crc_check, store_value) are measured
+ * in isolation. Each function is listed with the alternative implementations it is compared to.
+ * Cycles, instructions and branch misses are read through perf_event_open on Linux, user space only. Counters the
+ * kernel refuses (perf_event_paranoid above 2, containers, virtual machines) are reported as "-".
+ */
+
+#include "../lpph.c"
+#include "../lpph_crc_sw.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+#ifdef __linux__
+#include "linux/perf_event.h"
+#include "sys/ioctl.h"
+#include "sys/syscall.h"
+#include "unistd.h"
+#endif
+
+#define COUNTERS                    3 // cycles, instructions, branch misses
+#define FRAME_LEN                   PHOTOMETRIC_PROBE_RESPONSE_LEN(3)
+
+/**
+ * @brief Hardware counter, -1 if unavailable
+ *
+ */
+typedef struct{
+    int fd;
+    uint64_t value;
+}counter_t;
+
+/**
+ * @brief Benchmarked implementation, run iterations times on a fresh input per iteration
+ *
+ */
+typedef struct{
+    const char* function; // function measured, implementations of the same function are printed together
+    const char* variant;
+    uint32_t(*run)(uint32_t i);
+}bench_t;
+
+static counter_t counters[COUNTERS];
+static photometric_probe_obj probe;
+static photometric_probe_obj probe_offload; // same probe with the software CRC provider
+static probe_crc_sw_t crc_sw;
+static uint8_t frame[FRAME_LEN];
+static uint16_t crc_table[256];
+static uint16_t crc_nibbles[16];
+static volatile uint32_t sink; // keeps the results alive
+
+/**
+ * @brief Reads the host monotonic clock
+ *
+ * @return uint64_t: time in nanoseconds
+ */
+static uint64_t host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+#ifdef __linux__
+/**
+ * @brief Opens a hardware counter of the calling thread, user space only, disabled
+ *
+ * @param config: PERF_COUNT_HW_ event
+ * @return int: file descriptor, -1 if the kernel refuses it
+ */
+static int counter_open(uint64_t config){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/**
+ * @brief Opens the counters available on the host
+ *
+ */
+static void counters_open(void){
+#ifdef __linux__
+    const uint64_t events[COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+    for(uint8_t c = 0; c < COUNTERS; c++){
+        counters[c].fd = counter_open(events[c]);
+    }
+#else
+    for(uint8_t c = 0; c < COUNTERS; c++){
+        counters[c].fd = -1;
+    }
+#endif
+}
+
+/**
+ * @brief Resets and starts the counters
+ *
+ */
+static void counters_start(void){
+#ifdef __linux__
+    for(uint8_t c = 0; c < COUNTERS; c++){
+        if(counters[c].fd >= 0){
+            ioctl(counters[c].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[c].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Stops the counters and reads them, scaled up if the kernel multiplexed them
+ *
+ */
+static void counters_stop(void){
+#ifdef __linux__
+    for(uint8_t c = 0; c < COUNTERS; c++){
+        if(counters[c].fd < 0){
+            continue;
+        }
+        ioctl(counters[c].fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t data[3]; // value, time enabled, time running
+        if((read(counters[c].fd, data, sizeof(data)) != sizeof(data)) || (data[2] == 0)){
+            counters[c].value = 0;
+            continue;
+        }
+        counters[c].value = (data[2] < data[1]) ? (uint64_t) ((double) data[0] * ((double) data[1] / (double) data[2])) : data[0];
+    }
+#endif
+}
+
+/**
+ * @brief Formats a counter per operation
+ *
+ * @param c: counter
+ * @param iterations: number of operations
+ * @param buf: output, 16 bytes
+ * @return const char*: buf
+ */
+static const char* per_op(uint8_t c, uint32_t iterations, char* buf){
+    if(counters[c].fd < 0){
+        return "-";
+    }
+    snprintf(buf, 16, "%.2f", (double) counters[c].value / iterations);
+    return buf;
+}
+
+/**
+ * @brief Table driven CRC, one 256 entry table lookup per byte
+ *
+ */
+static uint16_t crc_bytewise(const uint8_t* buf, int len){
+    uint16_t crc = 0xFFFF;
+    for(int pos = 0; pos < len; pos++){
+        crc = (crc >> 8) ^ crc_table[(crc ^ buf[pos]) & 0xFF];
+    }
+    return crc;
+}
+
+/**
+ * @brief Table driven CRC, two 16 entry table lookups per byte, for flash constrained targets
+ *
+ */
+static uint16_t crc_nibblewise(const uint8_t* buf, int len){
+    uint16_t crc = 0xFFFF;
+    for(int pos = 0; pos < len; pos++){
+        crc ^= buf[pos];
+        crc = (crc >> 4) ^ crc_nibbles[crc & 0x0F];
+        crc = (crc >> 4) ^ crc_nibbles[crc & 0x0F];
+    }
+    return crc;
+}
+
+/**
+ * @brief Branch free bitwise CRC, the conditional XOR replaced by a mask
+ *
+ */
+static uint16_t crc_branchless(const uint8_t* buf, int len){
+    uint16_t crc = 0xFFFF;
+    for(int pos = 0; pos < len; pos++){
+        crc ^= buf[pos];
+        for(uint8_t i = 0; i < 8; i++){
+            crc = (crc >> 1) ^ (0xA001 & -(crc & 1));
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Fills the CRC tables from the bitwise CRC
+ *
+ */
+static void crc_tables_init(void){
+    for(uint16_t b = 0; b < 256; b++){
+        uint16_t crc = b;
+        for(uint8_t i = 0; i < 8; i++){
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+        crc_table[b] = crc;
+        if(b < 16){
+            crc = b;
+            for(uint8_t i = 0; i < 4; i++){
+                crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+            }
+            crc_nibbles[b] = crc;
+        }
+    }
+}
+
+/**
+ * @brief Sets the payload of the response frame and its CRC
+ *
+ * @param i: iteration
+ */
+static void frame_vary(uint32_t i){
+    frame[3] = i >> 8;
+    frame[4] = i & 0xFF;
+    uint16_t crc = crc_bytewise(frame, FRAME_LEN - 2);
+    frame[FRAME_LEN - 2] = crc & 0xFF;
+    frame[FRAME_LEN - 1] = crc >> 8;
+}
+
+static uint32_t run_encode(uint32_t i){
+    uint8_t request[PHOTOMETRIC_PROBE_REQUEST_LEN];
+    photometric_probe_encode_read_request(&probe, i & 0x03, 1 + (i & 1), request);
+    return request[6] | (request[7] << 8);
+}
+
+static uint32_t run_encode_offload(uint32_t i){
+    uint8_t request[PHOTOMETRIC_PROBE_REQUEST_LEN];
+    photometric_probe_encode_read_request(&probe_offload, i & 0x03, 1 + (i & 1), request);
+    return request[6] | (request[7] << 8);
+}
+
+static uint32_t run_crc_driver(uint32_t i){
+    frame[3] = i;
+    return ModRTU_CRC(frame, FRAME_LEN - 2);
+}
+
+static uint32_t run_crc_branchless(uint32_t i){
+    frame[3] = i;
+    return crc_branchless(frame, FRAME_LEN - 2);
+}
+
+static uint32_t run_crc_bytewise(uint32_t i){
+    frame[3] = i;
+    return crc_bytewise(frame, FRAME_LEN - 2);
+}
+
+static uint32_t run_crc_nibblewise(uint32_t i){
+    frame[3] = i;
+    return crc_nibblewise(frame, FRAME_LEN - 2);
+}
+
+static uint32_t run_crc_check(uint32_t i){
+    frame[3] = i;
+    return crc_check(&probe, frame, FRAME_LEN);
+}
+
+static uint32_t run_crc_check_offload(uint32_t i){
+    frame[3] = i;
+    return crc_check(&probe_offload, frame, FRAME_LEN);
+}
+
+static uint32_t run_decode_celsius(uint32_t i){
+    uint8_t data[4] = {(uint8_t) (i >> 8), (uint8_t) i, 0, 0};
+    const probe_frame_view_t view = {{data, NULL}, {sizeof(data), 0}};
+    store_value(&probe, PROBE_VALUE_CELSIUS, &view, 0);
+    return (uint32_t) probe.internal_temp_celsius;
+}
+
+static uint32_t run_decode_illuminance(uint32_t i){
+    uint8_t data[4] = {(uint8_t) (i >> 8), (uint8_t) i, 0, 0};
+    const probe_frame_view_t view = {{data, NULL}, {sizeof(data), 0}};
+    store_value(&probe, PROBE_VALUE_ILLUMINANCE, &view, 0);
+    return probe.illuminance;
+}
+
+static uint32_t run_decode_span(uint32_t i){
+    uint8_t data[6] = {0, (uint8_t) i, 0, (uint8_t) (i >> 1), (uint8_t) (i >> 8), (uint8_t) i};
+    store_span(&probe, 0, 3, data);
+    return probe.illuminance;
+}
+
+static uint32_t run_decode_response(uint32_t i){
+    (void) i;
+    // a valid frame, from the CRC to the stored values
+    return photometric_probe_decode_read_response(&probe, 0, 3, frame, FRAME_LEN);
+}
+
+static uint32_t run_scale_float(uint32_t i){
+    // tenths of a register as scaled by store_value: float multiply, rounded
+    return (uint32_t) (((float) (i & 0xFFFF) * 0.1f) + 0.5f);
+}
+
+static uint32_t run_scale_fixed(uint32_t i){
+    // the same tenths in 16.16 fixed point, for targets without FPU
+    return (((i & 0xFFFF) * 6554) + 32768) >> 16;
+}
+
+static const bench_t benches[] = {
+    {"encode_read_request", "built-in CRC", &run_encode},
+    {"encode_read_request", "CRC provider", &run_encode_offload},
+    {"ModRTU_CRC (9 bytes)", "bitwise (driver)", &run_crc_driver},
+    {"ModRTU_CRC (9 bytes)", "bitwise branchless", &run_crc_branchless},
+    {"ModRTU_CRC (9 bytes)", "table 256 x 16 bit", &run_crc_bytewise},
+    {"ModRTU_CRC (9 bytes)", "table 16 x 16 bit", &run_crc_nibblewise},
+    {"crc_check", "built-in CRC", &run_crc_check},
+    {"crc_check", "CRC provider", &run_crc_check_offload},
+    {"register decode", "celsius (scaled)", &run_decode_celsius},
+    {"register decode", "illuminance", &run_decode_illuminance},
+    {"register decode", "span of 3 values", &run_decode_span},
+    {"register decode", "response frame", &run_decode_response},
+    {"range scaling", "float", &run_scale_float},
+    {"range scaling", "fixed point", &run_scale_fixed},
+};
+
+int main(int argc, char** argv){
+    uint32_t iterations = (argc > 1) ? (uint32_t) atoi(argv[1]) : 2000000;
+    config_t cfg = {.address = 1, .baudrate = BAUDRATE_19200, .mode = MODE_8N1, .range = HIGH_RANGE};
+    photometric_probe_init(&probe, cfg);
+    photometric_probe_init(&probe_offload, cfg);
+    probe_crc_sw_init(&crc_sw);
+    probe_offload.crc = &crc_sw.provider;
+    crc_tables_init();
+    frame[0] = cfg.address;
+    frame[1] = 0x04;
+    frame[2] = 6;
+    frame_vary(0);
+    // the alternatives must agree with the driver
+    for(uint32_t i = 0; i < 256; i++){
+        if((run_crc_driver(i) != run_crc_bytewise(i)) || (run_crc_driver(i) != run_crc_nibblewise(i)) || (run_crc_driver(i) != run_crc_branchless(i))){
+            printf("CRC implementations disagree\n");
+            return 1;
+        }
+    }
+    counters_open();
+    if(counters[0].fd < 0){
+        perror("perf_event_open");
+        printf("hardware counters unavailable, timing only\n");
+    }
+    printf("%-22s %-20s %10s %10s %10s %12s\n", "function", "variant", "ns/op", "cycles/op", "instr/op", "br-miss/op");
+    const char* function = NULL;
+    for(uint8_t b = 0; b < (sizeof(benches) / sizeof(benches[0])); b++){
+        const bench_t* bench = &benches[b];
+        frame_vary(b);
+        // warm up caches and branch predictors
+        for(uint32_t i = 0; i < (iterations / 10); i++){
+            sink = bench->run(i);
+        }
+        counters_start();
+        uint64_t start_ns = host_ns();
+        for(uint32_t i = 0; i < iterations; i++){
+            sink = bench->run(i);
+        }
+        uint64_t elapsed_ns = host_ns() - start_ns;
+        counters_stop();
+        char cycles[16];
+        char instructions[16];
+        char misses[16];
+        if((function != NULL) && strcmp(function, bench->function)){
+            printf("\n");
+        }
+        function = bench->function;
+        printf("%-22s %-20s %10.2f %10s %10s %12s\n", bench->function, bench->variant, (double) elapsed_ns / iterations,
+               per_op(0, iterations, cycles), per_op(1, iterations, instructions), per_op(2, iterations, misses));
+    }
+    return 0;
+}
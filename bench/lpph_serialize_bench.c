@@ -0,0 +1,106 @@
+/**
+ * @file lpph_serialize_bench.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the throughput benchmark of the sample serializers, against snprintf
+ * @version 0.1
+ * @date 2024-09-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Build and run on the host:
+ *     gcc -O2 -o lpph_serialize_bench bench/lpph_serialize_bench.c lpph_serialize.c && ./lpph_serialize_bench [batches]
+ */
+
+#include "../lpph_serialize.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+#define BATCH                       32 // samples per uplink message
+#define BUF_LEN                     (BATCH * PROBE_JSON_SAMPLE_MAX_LEN + 2)
+
+static probe_sample_t samples[BATCH];
+static uint8_t buf[BUF_LEN];
+static volatile size_t sink; // keeps the output alive
+
+/**
+ * @brief Reads the host monotonic clock
+ *
+ * @return uint64_t: time in nanoseconds
+ */
+static uint64_t host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * @brief Baseline, one snprintf per sample
+ *
+ * @return size_t: length of the message
+ */
+static size_t encode_snprintf(void){
+    size_t len = 0;
+    buf[len++] = '[';
+    for(uint16_t i = 0; i < BATCH; i++){
+        const probe_sample_t* s = &samples[i];
+        len += snprintf((char*) &buf[len], BUF_LEN - len, "%s{\"addr\":%u,\"ts\":%u,\"lux\":%u,\"temp\":%.1f,\"ok\":%s}",
+                        i ? "," : "", s->address, (unsigned) s->timestamp_us, (unsigned) s->illuminance,
+                        s->internal_temp_celsius, (s->status == STATUS_OK) ? "true" : "false");
+    }
+    buf[len++] = ']';
+    buf[len] = '\0';
+    return len;
+}
+
+static size_t encode_json(void){
+    probe_serializer_t ser;
+    probe_json_begin(&ser, buf, BUF_LEN);
+    probe_json_add(&ser, samples, BATCH);
+    return probe_json_end(&ser);
+}
+
+static size_t encode_cbor(void){
+    probe_serializer_t ser;
+    probe_cbor_begin(&ser, buf, BUF_LEN);
+    probe_cbor_add(&ser, samples, BATCH);
+    return probe_cbor_end(&ser);
+}
+
+/**
+ * @brief Runs an encoder and prints its throughput
+ *
+ * @param name: encoder name
+ * @param encode: encoder
+ * @param batches: number of messages to encode
+ */
+static void run(const char* name, size_t (*encode)(void), uint32_t batches){
+    size_t len = encode();
+    uint64_t start_ns = host_ns();
+    for(uint32_t i = 0; i < batches; i++){
+        // vary the data, so the output is not constant
+        samples[i % BATCH].timestamp_us += 1000;
+        sink = encode();
+    }
+    uint64_t elapsed_ns = host_ns() - start_ns;
+    double rate = ((double) batches * BATCH * 1e9) / (double) (elapsed_ns ? elapsed_ns : 1);
+    printf("%-10s %12.0f samples/s %8.1f ns/sample %6.1f bytes/sample\n", name, rate,
+           (double) elapsed_ns / ((double) batches * BATCH), (double) len / BATCH);
+}
+
+int main(int argc, char** argv){
+    uint32_t batches = (argc > 1) ? (uint32_t) atoi(argv[1]) : 200000;
+    srand(1);
+    for(uint16_t i = 0; i < BATCH; i++){
+        samples[i].address = 1 + (i % 247);
+        samples[i].status = (rand() % 20) ? STATUS_OK : STATUS_ERR;
+        samples[i].timestamp_us = (uint32_t) rand();
+        samples[i].illuminance = (uint32_t) (rand() % 200000);
+        samples[i].internal_temp_celsius = ((float) (rand() % 1000) / 10.0f) - 40.0f;
+    }
+    run("snprintf", &encode_snprintf, batches);
+    run("json", &encode_json, batches);
+    run("cbor", &encode_cbor, batches);
+    return 0;
+}
@@ -0,0 +1,237 @@
+/**
+ * @file lpph_sim.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the LPPHOT03 probe simulator
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_sim.h"
+#include "string.h"
+
+#ifndef PHOTOMETRIC_PROBE_MAX_TURNAROUND_US
+#define PHOTOMETRIC_PROBE_MAX_TURNAROUND_US 50000 // must match the driver
+#endif
+
+/**
+ * @brief Draws a pseudo random number
+ * 
+ * @return uint32_t
+ */
+static uint32_t sim_rand(void);
+
+/**
+ * @brief Calculates CRC of Modbus frame, independently of the driver
+ * 
+ * @param buf: buffer array
+ * @param len: length of buffer
+ * @return uint16_t
+ */
+static uint16_t sim_crc(const uint8_t* buf, uint8_t len);
+
+/**
+ * @brief Handles a frame written by the driver, queuing the response of the addressed probe
+ * 
+ * @param bus: index of the bus
+ * @param buf: frame
+ * @param len: frame length
+ */
+static void sim_write(uint8_t bus, const uint8_t* buf, uint8_t len);
+
+/**
+ * @brief Reads queued bytes until len bytes are read or the deadline is reached, advancing the virtual clock
+ * 
+ * @param bus: index of the bus
+ * @param buf: buffer receiving the bytes
+ * @param len: number of bytes to read
+ * @param timeout_us: longest wait
+ * @return uint8_t: number of bytes read
+ */
+static uint8_t sim_read(uint8_t bus, uint8_t* buf, uint8_t len, uint32_t timeout_us);
+
+static probe_sim_bus_t buses[PROBE_SIM_MAX_BUSES];
+static uint64_t now_us;
+static uint32_t rand_state;
+
+// the driver hooks carry no context, one set of hooks per bus
+#define SIM_BUS_HOOKS(n) \
+    static void uart_write_##n(const uint8_t* buf, uint8_t len){ sim_write(n, buf, len); } \
+    static void uart_read_##n(uint8_t* buf, uint8_t len){ sim_read(n, buf, len, UINT32_MAX); } \
+    static uint8_t uart_read_timeout_##n(uint8_t* buf, uint8_t len, uint32_t timeout_us){ return sim_read(n, buf, len, timeout_us); }
+
+SIM_BUS_HOOKS(0)
+SIM_BUS_HOOKS(1)
+SIM_BUS_HOOKS(2)
+SIM_BUS_HOOKS(3)
+
+static void(*const uart_write_hooks[PROBE_SIM_MAX_BUSES])(const uint8_t*, uint8_t) = {uart_write_0, uart_write_1, uart_write_2, uart_write_3};
+static void(*const uart_read_hooks[PROBE_SIM_MAX_BUSES])(uint8_t*, uint8_t) = {uart_read_0, uart_read_1, uart_read_2, uart_read_3};
+static uint8_t(*const uart_read_timeout_hooks[PROBE_SIM_MAX_BUSES])(uint8_t*, uint8_t, uint32_t) = {uart_read_timeout_0, uart_read_timeout_1, uart_read_timeout_2, uart_read_timeout_3};
+
+static void direction(void){
+}
+
+static uint32_t time_us(void){
+    return (uint32_t) now_us;
+}
+
+
+
+void probe_sim_init(uint32_t seed){
+    memset(buses, 0, sizeof(buses));
+    now_us = 0;
+    rand_state = (seed != 0) ? seed : 1;
+}
+
+probe_sim_bus_t* probe_sim_bus(uint8_t bus){
+    return &buses[bus];
+}
+
+probe_sim_probe_t* probe_sim_attach(photometric_probe_obj* obj, uint8_t bus){
+    probe_sim_bus_t* sim = &buses[bus];
+    probe_sim_probe_t* probe = &sim->probes[sim->n++];
+    probe->address = obj->cfg.address;
+    memset(probe->regs, 0, sizeof(probe->regs));
+    sim->cfg = obj->cfg;
+    obj->uart_write = uart_write_hooks[bus];
+    obj->uart_read = uart_read_hooks[bus];
+    obj->uart_read_timeout = uart_read_timeout_hooks[bus];
+    obj->enable_transmission = &direction;
+    obj->disable_transmission = &direction;
+    obj->get_time_us = &time_us;
+    return probe;
+}
+
+uint64_t probe_sim_now_us(void){
+    return now_us;
+}
+
+void probe_sim_advance_to_us(uint64_t time_us){
+    if(time_us > now_us){
+        now_us = time_us;
+    }
+}
+
+
+static uint32_t sim_rand(void){
+    // xorshift32
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+
+static uint16_t sim_crc(const uint8_t* buf, uint8_t len){
+    uint16_t crc = 0xFFFF;
+    for(uint8_t i = 0; i < len; i++){
+        crc ^= buf[i];
+        for(uint8_t bit = 0; bit < 8; bit++){
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+
+static void sim_write(uint8_t bus, const uint8_t* buf, uint8_t len){
+    probe_sim_bus_t* sim = &buses[bus];
+    uint32_t char_us = photometric_probe_char_time_us(sim->cfg);
+    // uart_write returns once the frame is on the wire
+    now_us += (uint64_t) len * char_us;
+    if((len != PHOTOMETRIC_PROBE_REQUEST_LEN) || (buf[1] != 0x04) || (sim_crc(buf, 6) != (buf[6] | (buf[7] << 8)))){
+        return;
+    }
+    probe_sim_probe_t* probe = NULL;
+    for(uint8_t i = 0; i < sim->n; i++){
+        if(sim->probes[i].address == buf[0]){
+            probe = &sim->probes[i];
+        }
+    }
+    if(probe == NULL){
+        return;
+    }
+    sim->requests++;
+    uint16_t start = (buf[2] << 8) | buf[3];
+    uint16_t count = (buf[4] << 8) | buf[5];
+    probe_sim_fault_e fault = SIM_FAULT_NONE;
+    if((sim_rand() % 100) < sim->fault_percent){
+        fault = (probe_sim_fault_e) (1 + (sim_rand() % (SIM_FAULT_COUNT - 1)));
+    }
+    sim->faults[fault]++;
+    if(fault == SIM_FAULT_SILENT){
+        return;
+    }
+    uint8_t rsp[PROBE_SIM_QUEUE_LEN];
+    uint8_t rsp_len;
+    rsp[0] = probe->address;
+    if((fault == SIM_FAULT_EXCEPTION) || (start + count > 3)){
+        rsp[1] = 0x84;
+        rsp[2] = 0x02; // illegal data address
+        rsp_len = 3;
+    }
+    else{
+        rsp[1] = 0x04;
+        rsp[2] = count * 2;
+        for(uint16_t i = 0; i < count; i++){
+            rsp[3 + (i * 2)] = probe->regs[start + i] >> 8;
+            rsp[4 + (i * 2)] = probe->regs[start + i] & 0xFF;
+        }
+        rsp_len = 3 + (count * 2);
+    }
+    uint16_t crc = sim_crc(rsp, rsp_len);
+    rsp[rsp_len++] = crc & 0xFF;
+    rsp[rsp_len++] = crc >> 8;
+    if(fault == SIM_FAULT_CRC){
+        rsp[sim_rand() % rsp_len] ^= 1 << (sim_rand() % 8);
+    }
+    if(fault == SIM_FAULT_TRUNCATED){
+        rsp_len = 1 + (sim_rand() % (rsp_len - 1));
+    }
+    uint32_t turnaround_us;
+    if(fault == SIM_FAULT_LATE){
+        turnaround_us = PHOTOMETRIC_PROBE_MAX_TURNAROUND_US + 1 + (sim_rand() % PHOTOMETRIC_PROBE_MAX_TURNAROUND_US);
+    }
+    else if(sim->extreme_turnaround){
+        turnaround_us = (sim_rand() & 1) ? PHOTOMETRIC_PROBE_MAX_TURNAROUND_US : 0;
+    }
+    else{
+        turnaround_us = sim_rand() % (PHOTOMETRIC_PROBE_MAX_TURNAROUND_US + 1);
+    }
+    uint32_t byte_us = (fault == SIM_FAULT_SLOW) ? (char_us + ((char_us * 3) / 2)) : char_us;
+    // bytes still queued from an earlier late response come first, as on a real line
+    if(sim->head == sim->tail){
+        sim->head = 0;
+        sim->tail = 0;
+    }
+    uint64_t at_us = now_us + turnaround_us;
+    if((sim->tail > sim->head) && (sim->arrival_us[sim->tail - 1] > at_us)){
+        at_us = sim->arrival_us[sim->tail - 1];
+    }
+    for(uint8_t i = 0; (i < rsp_len) && (sim->tail < PROBE_SIM_QUEUE_LEN); i++){
+        at_us += byte_us;
+        sim->queue[sim->tail] = rsp[i];
+        sim->arrival_us[sim->tail] = at_us;
+        sim->tail++;
+    }
+}
+
+
+static uint8_t sim_read(uint8_t bus, uint8_t* buf, uint8_t len, uint32_t timeout_us){
+    probe_sim_bus_t* sim = &buses[bus];
+    uint64_t deadline_us = now_us + timeout_us;
+    uint8_t got = 0;
+    while((got < len) && (sim->head < sim->tail) && (sim->arrival_us[sim->head] <= deadline_us)){
+        if(sim->arrival_us[sim->head] > now_us){
+            now_us = sim->arrival_us[sim->head];
+        }
+        buf[got++] = sim->queue[sim->head++];
+    }
+    if((got < len) && (timeout_us != UINT32_MAX)){
+        now_us = deadline_us;
+    }
+    return got;
+}
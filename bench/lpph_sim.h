@@ -0,0 +1,103 @@
+/**
+ * @file lpph_sim.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains a simulator of LPPHOT03 probes on RS485 buses, running on a virtual clock
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_SIM_H
+#define LPPH_SIM_H
+
+#include "../lpph.h"
+
+#define PROBE_SIM_MAX_BUSES         4
+#define PROBE_SIM_MAX_PROBES        8 // probes per bus
+#define PROBE_SIM_QUEUE_LEN         64 // bytes in flight towards the driver, per bus
+
+/**
+ * @brief Faults injected into responses
+ * 
+ */
+typedef enum{
+    SIM_FAULT_NONE,
+    SIM_FAULT_SILENT, // no response
+    SIM_FAULT_LATE, // response starts after the longest turnaround
+    SIM_FAULT_TRUNCATED, // response cut short
+    SIM_FAULT_CRC, // one bit flipped
+    SIM_FAULT_EXCEPTION, // Modbus exception response
+    SIM_FAULT_SLOW, // 1.5 character silences between bytes, the longest allowed within a frame
+    SIM_FAULT_COUNT
+}probe_sim_fault_e;
+
+/**
+ * @brief Simulated probe
+ * 
+ */
+typedef struct{
+    uint8_t address;
+    uint16_t regs[3]; // input registers: Celsius, Fahrenheit, illuminance
+}probe_sim_probe_t;
+
+/**
+ * @brief Simulated bus, bytes sent by the probes are queued with their arrival time
+ * 
+ */
+typedef struct{
+    config_t cfg; // line settings, for the timing of the frames
+    probe_sim_probe_t probes[PROBE_SIM_MAX_PROBES];
+    uint8_t n;
+    uint8_t queue[PROBE_SIM_QUEUE_LEN];
+    uint64_t arrival_us[PROBE_SIM_QUEUE_LEN];
+    uint8_t head; // next byte to be read
+    uint8_t tail; // end of the queued bytes
+    uint8_t fault_percent; // share of the responses carrying a fault
+    uint8_t extreme_turnaround; // 1 to answer at exactly 0 or the longest turnaround, instead of anywhere in between
+    uint32_t requests; // number of requests received
+    uint32_t faults[SIM_FAULT_COUNT]; // number of responses per fault
+}probe_sim_bus_t;
+
+/**
+ * @brief Resets the simulator and its virtual clock
+ * 
+ * @param seed: seed of the fault and timing patterns
+ */
+void probe_sim_init(uint32_t seed);
+
+/**
+ * @brief Gives a simulated bus
+ * 
+ * @param bus: index of the bus, below PROBE_SIM_MAX_BUSES
+ * @return probe_sim_bus_t*: pointer to the bus, to set its faults
+ */
+probe_sim_bus_t* probe_sim_bus(uint8_t bus);
+
+/**
+ * @brief Adds a simulated probe to a bus and binds a driver probe object to it
+ * @note The UART, RS485 direction and time hooks of obj are set, as well as uart_read_timeout, so the driver runs in deterministic mode
+ * 
+ * @param obj: A pointer to an initialized photometric probe object
+ * @param bus: index of the bus
+ * @return probe_sim_probe_t*: pointer to the simulated probe, to set its registers
+ */
+probe_sim_probe_t* probe_sim_attach(photometric_probe_obj* obj, uint8_t bus);
+
+/**
+ * @brief Gives the virtual time
+ * 
+ * @return uint64_t: time in microseconds
+ */
+uint64_t probe_sim_now_us(void);
+
+/**
+ * @brief Lets the virtual time pass, e.g. while the application sleeps between polls
+ * @note Bytes still queued on a bus keep their arrival time
+ * 
+ * @param time_us: virtual time to advance to, ignored if already past
+ */
+void probe_sim_advance_to_us(uint64_t time_us);
+
+#endif
@@ -0,0 +1,425 @@
+/**
+ * @file lpph_soak.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the long running soak harness of the duty cycled sampler, run against the probe simulator
+ * @version 0.1
+ * @date 2024-09-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Build and run on the host:
+ *     gcc -O2 -o lpph_soak bench/lpph_soak.c bench/lpph_sim.c lpph.c -lm && ./lpph_soak -H 72 -o soak.csv
+ * Options:
+ *     -H hours      simulated duration (default 24)
+ *     -b buses      number of buses, up to PROBE_SIM_MAX_BUSES (default 2)
+ *     -p probes     probes per bus, up to PROBE_SIM_MAX_PROBES (default 4)
+ *     -P period_ms  sample period of the fastest probes (default 1000)
+ *     -r rates      probe i samples every (1 + (i % rates)) periods (default 1)
+ *     -w window_ms  duty window, samples due within it are taken early (default 0)
+ *     -f percent    share of the responses carrying a fault (default 2)
+ *     -i seconds    interval of the time series (default 3600)
+ *     -o file       time series as CSV, one row per interval (default none)
+ *     -j us         fails if the 99th percentile of the interval jitter exceeds it (default off)
+ *     -m kB         fails if the resident memory grows by more than this after the first interval (default 64)
+ *     -s seed       seed of the fault and timing patterns (default 1)
+ * The virtual clock runs as fast as the host allows, a day of an 8 probe fleet sampled every second takes about a second.
+ * Exits with 1 if the jitter or memory limit is exceeded.
+ */
+
+#include "lpph_sim.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "unistd.h"
+
+#define PROBES                      (PROBE_SIM_MAX_BUSES * PROBE_SIM_MAX_PROBES)
+#define HIST_BUCKETS                16384 // linear buckets, the last one holds the overflow
+#define MAX_RETRIES                 1
+
+/**
+ * @brief Phases of a wake window
+ *
+ */
+typedef enum{
+    PHASE_WAKE, // from the earliest deadline due to the window start, virtual time
+    PHASE_RESPONSE, // from the window start to the first byte of a probe response, virtual time
+    PHASE_WINDOW, // from the window start to its end, virtual time
+    PHASE_CPU, // host time spent in photometric_probe_duty_run, simulator included
+    PHASE_COUNT
+}phase_e;
+
+/**
+ * @brief Distribution of a measure, in linear buckets
+ *
+ */
+typedef struct{
+    const char* name;
+    uint32_t width; // bucket width
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+    double sum;
+}hist_t;
+
+/**
+ * @brief Measures of a time series interval, reset at every row
+ *
+ */
+typedef struct{
+    uint32_t samples;
+    uint32_t failures;
+    uint32_t empty_windows; // wakeups with no probe due
+    uint64_t jitter_max_us; // largest absolute deviation of a sampling interval from its period
+    double jitter_sum_us;
+    uint32_t intervals;
+    int64_t drift_min_us; // offset of the samples from their grid
+    int64_t drift_max_us;
+    double drift_sum_us;
+    uint64_t phase_max[PHASE_COUNT];
+}series_t;
+
+/**
+ * @brief Sampling history of a probe
+ *
+ */
+typedef struct{
+    uint64_t first_us; // time of the first sample, origin of the grid
+    uint64_t last_us; // time of the last sample
+    uint8_t sampled; // 1 once first_us is set
+}probe_track_t;
+
+static photometric_probe_obj probes[PROBES];
+static uint32_t period_ms[PROBES];
+static uint32_t next_ms[PROBES];
+static probe_status_e results[PROBES];
+static probe_track_t tracks[PROBES];
+static hist_t jitter = {"interval jitter us", 100, {0}, 0, 0, 0};
+static hist_t drift = {"grid drift us", 100, {0}, 0, 0, 0};
+static hist_t phases[PHASE_COUNT] = {
+    {"wake us", 100, {0}, 0, 0, 0},
+    {"response us", 100, {0}, 0, 0, 0},
+    {"window us", 1000, {0}, 0, 0, 0},
+    {"cpu ns", 100, {0}, 0, 0, 0},
+};
+static series_t series;
+
+/**
+ * @brief Reads the host monotonic clock
+ *
+ * @return uint64_t: time in nanoseconds
+ */
+static uint64_t host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * @brief Reads the resident memory of the process
+ *
+ * @return uint64_t: resident memory in kB, 0 if unavailable
+ */
+static uint64_t rss_kb(void){
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if(f == NULL){
+        return 0;
+    }
+    if(fscanf(f, "%lu %lu", &size, &resident) != 2){
+        resident = 0;
+    }
+    fclose(f);
+    return ((uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+/**
+ * @brief Adds a value to a distribution
+ *
+ * @param h: A pointer to a distribution
+ * @param value: value
+ */
+static void hist_add(hist_t* h, uint64_t value){
+    uint64_t bucket = value / h->width;
+    h->buckets[(bucket < HIST_BUCKETS) ? bucket : (HIST_BUCKETS - 1)]++;
+    h->count++;
+    h->sum += (double) value;
+    if(value > h->max){
+        h->max = value;
+    }
+}
+
+/**
+ * @brief Gives a percentile of a distribution
+ *
+ * @param h: A pointer to a distribution
+ * @param percent: percentile
+ * @return uint64_t: upper edge of the bucket holding the percentile, at most the maximum
+ */
+static uint64_t hist_percentile(const hist_t* h, double percent){
+    uint64_t rank = (uint64_t) ((percent / 100.0) * (double) h->count);
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < (HIST_BUCKETS - 1); i++){
+        seen += h->buckets[i];
+        if(seen > rank){
+            uint64_t edge = (uint64_t) (i + 1) * h->width;
+            return (edge < h->max) ? edge : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Prints a distribution as one summary row
+ *
+ * @param h: A pointer to a distribution
+ */
+static void hist_print(const hist_t* h){
+    printf("%-20s %12llu %10.1f %10llu %10llu %10llu %10llu\n", h->name, (unsigned long long) h->count,
+           h->count ? (h->sum / (double) h->count) : 0.0, (unsigned long long) hist_percentile(h, 50),
+           (unsigned long long) hist_percentile(h, 99), (unsigned long long) hist_percentile(h, 99.9), (unsigned long long) h->max);
+}
+
+/**
+ * @brief Records the phases of a window and the samples it took
+ *
+ * @param n: number of probes
+ * @param due_ms: deadline of each probe before the window, to find the probes sampled
+ * @param start_us: window start, virtual time
+ * @param cpu_ns: host time of the window
+ */
+static void record_window(uint16_t n, const uint32_t* due_ms, uint64_t start_us, uint64_t cpu_ns){
+    uint64_t end_us = probe_sim_now_us();
+    uint64_t phase[PHASE_COUNT] = {0, 0, end_us - start_us, cpu_ns};
+    uint16_t due = 0;
+    for(uint16_t i = 0; i < n; i++){
+        if(next_ms[i] == due_ms[i]){
+            // not due in this window
+            continue;
+        }
+        // lateness of the earliest deadline, samples taken early count as on time
+        uint64_t deadline_us = (uint64_t) due_ms[i] * 1000;
+        uint64_t late_us = (start_us > deadline_us) ? (start_us - deadline_us) : 0;
+        if(late_us > phase[PHASE_WAKE]){
+            phase[PHASE_WAKE] = late_us;
+        }
+        due++;
+        series.samples++;
+        if(results[i] != STATUS_OK){
+            series.failures++;
+            continue;
+        }
+        // the receive time wraps every 71 minutes, it is unwrapped against the virtual clock
+        uint64_t at_us = end_us - (uint32_t) ((uint32_t) end_us - probes[i].value_time[PROBE_VALUE_ILLUMINANCE].first_us);
+        uint64_t response_us = at_us - start_us;
+        hist_add(&phases[PHASE_RESPONSE], response_us);
+        if(response_us > series.phase_max[PHASE_RESPONSE]){
+            series.phase_max[PHASE_RESPONSE] = response_us;
+        }
+        probe_track_t* track = &tracks[i];
+        uint64_t period_us = (uint64_t) period_ms[i] * 1000;
+        if(!track->sampled){
+            track->first_us = at_us;
+            track->last_us = at_us;
+            track->sampled = 1;
+            continue;
+        }
+        // intervals spanning missed samples count as a whole number of periods
+        uint64_t interval_us = at_us - track->last_us;
+        uint64_t periods = (interval_us + (period_us / 2)) / period_us;
+        int64_t deviation_us = (int64_t) interval_us - (int64_t) (periods * period_us);
+        uint64_t abs_us = (deviation_us < 0) ? -deviation_us : deviation_us;
+        hist_add(&jitter, abs_us);
+        series.intervals++;
+        series.jitter_sum_us += (double) abs_us;
+        if(abs_us > series.jitter_max_us){
+            series.jitter_max_us = abs_us;
+        }
+        // offset from the grid set by the first sample, grows if the cadence drifts
+        uint64_t elapsed_us = at_us - track->first_us;
+        int64_t offset_us = (int64_t) elapsed_us - (int64_t) (((elapsed_us + (period_us / 2)) / period_us) * period_us);
+        hist_add(&drift, (offset_us < 0) ? -offset_us : offset_us);
+        if((series.intervals == 1) || (offset_us < series.drift_min_us)){
+            series.drift_min_us = offset_us;
+        }
+        if((series.intervals == 1) || (offset_us > series.drift_max_us)){
+            series.drift_max_us = offset_us;
+        }
+        series.drift_sum_us += (double) offset_us;
+        track->last_us = at_us;
+    }
+    if(!due){
+        // a wakeup with nothing due is itself a cadence defect, it shows as a window of no samples
+        series.empty_windows++;
+    }
+    for(uint8_t p = 0; p < PHASE_COUNT; p++){
+        if(p != PHASE_RESPONSE){
+            hist_add(&phases[p], phase[p]);
+        }
+        if(phase[p] > series.phase_max[p]){
+            series.phase_max[p] = phase[p];
+        }
+    }
+}
+
+/**
+ * @brief Writes the row of the time series interval ending now, and starts the next one
+ *
+ * @param out: CSV output, NULL for none
+ * @param hours: virtual time of the row
+ * @param rss: resident memory in kB
+ */
+static void series_row(FILE* out, double hours, uint64_t rss){
+    if(out != NULL){
+        fprintf(out, "%.3f,%u,%u,%u,%.1f,%llu,%lld,%.1f,%lld,%llu,%llu,%llu,%llu,%llu\n", hours, series.samples, series.failures, series.empty_windows,
+                series.intervals ? (series.jitter_sum_us / series.intervals) : 0.0, (unsigned long long) series.jitter_max_us,
+                (long long) series.drift_min_us, series.intervals ? (series.drift_sum_us / series.intervals) : 0.0,
+                (long long) series.drift_max_us, (unsigned long long) series.phase_max[PHASE_WAKE],
+                (unsigned long long) series.phase_max[PHASE_RESPONSE], (unsigned long long) series.phase_max[PHASE_WINDOW],
+                (unsigned long long) series.phase_max[PHASE_CPU], (unsigned long long) rss);
+        fflush(out);
+    }
+    memset(&series, 0, sizeof(series));
+}
+
+int main(int argc, char** argv){
+    double hours = 24;
+    uint8_t bus_count = 2;
+    uint8_t per_bus = 4;
+    uint32_t base_ms = 1000;
+    uint32_t rates = 1;
+    uint32_t window_ms = 0;
+    uint8_t fault_percent = 2;
+    uint32_t series_s = 3600;
+    const char* path = NULL;
+    uint64_t jitter_limit_us = 0;
+    uint64_t rss_limit_kb = 64;
+    uint32_t seed = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "H:b:p:P:r:w:f:i:o:j:m:s:")) != -1){
+        switch(opt){
+            case 'H': hours = atof(optarg); break;
+            case 'b': bus_count = (uint8_t) atoi(optarg); break;
+            case 'p': per_bus = (uint8_t) atoi(optarg); break;
+            case 'P': base_ms = (uint32_t) atoi(optarg); break;
+            case 'r': rates = (uint32_t) atoi(optarg); break;
+            case 'w': window_ms = (uint32_t) atoi(optarg); break;
+            case 'f': fault_percent = (uint8_t) atoi(optarg); break;
+            case 'i': series_s = (uint32_t) atoi(optarg); break;
+            case 'o': path = optarg; break;
+            case 'j': jitter_limit_us = (uint64_t) atoll(optarg); break;
+            case 'm': rss_limit_kb = (uint64_t) atoll(optarg); break;
+            case 's': seed = (uint32_t) atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-H hours] [-b buses] [-p probes] [-P period_ms] [-r rates] [-w window_ms] [-f percent] [-i seconds] [-o file] [-j us] [-m kB] [-s seed]\n", argv[0]);
+                return 2;
+        }
+    }
+    if((bus_count == 0) || (bus_count > PROBE_SIM_MAX_BUSES) || (per_bus == 0) || (per_bus > PROBE_SIM_MAX_PROBES) || (base_ms == 0) || (rates == 0) || (series_s == 0)){
+        fprintf(stderr, "invalid fleet\n");
+        return 2;
+    }
+    FILE* out = NULL;
+    if(path != NULL){
+        out = fopen(path, "w");
+        if(out == NULL){
+            perror(path);
+            return 2;
+        }
+        fprintf(out, "hours,samples,failures,empty_windows,jitter_mean_us,jitter_max_us,drift_min_us,drift_mean_us,drift_max_us,wake_max_us,response_max_us,window_max_us,cpu_max_ns,rss_kb\n");
+    }
+    const baudrate_e baudrates[PROBE_SIM_MAX_BUSES] = {BAUDRATE_19200, BAUDRATE_115200, BAUDRATE_9600, BAUDRATE_38400};
+    uint16_t n = bus_count * per_bus;
+    probe_sim_init(seed);
+    for(uint8_t b = 0; b < bus_count; b++){
+        for(uint8_t p = 0; p < per_bus; p++){
+            uint16_t i = (b * per_bus) + p;
+            config_t cfg = {.address = 1 + p, .baudrate = baudrates[b], .mode = MODE_8N1, .range = LOW_RANGE};
+            photometric_probe_init(&probes[i], cfg);
+            probe_sim_probe_t* sim = probe_sim_attach(&probes[i], b);
+            sim->regs[0] = 215; // 21.5 C
+            sim->regs[1] = 707; // 70.7 F
+            sim->regs[2] = 1000 + i;
+            probes[i].max_retries = MAX_RETRIES;
+            probes[i].batched_reads = (p & 1);
+            period_ms[i] = base_ms * (1 + (i % rates));
+        }
+        probe_sim_bus(b)->fault_percent = fault_percent;
+    }
+    probe_duty_t duty;
+    photometric_probe_duty_init(&duty, probes, n, period_ms, next_ms, results, window_ms, 0);
+    duty.get_time_us = probes[0].get_time_us;
+    uint64_t end_us = (uint64_t) (hours * 3600e6);
+    uint64_t series_us = (uint64_t) series_s * 1000000;
+    uint64_t next_row_us = series_us;
+    uint64_t rss_first = 0;
+    uint64_t rss_max = 0;
+    uint32_t empty_windows = 0;
+    uint64_t start_ns = host_ns();
+    uint32_t due_ms[PROBES];
+    // the distributions are resident from the start, so their pages do not show as growth
+    memset(jitter.buckets, 0, sizeof(jitter.buckets));
+    memset(drift.buckets, 0, sizeof(drift.buckets));
+    for(uint8_t p = 0; p < PHASE_COUNT; p++){
+        memset(phases[p].buckets, 0, sizeof(phases[p].buckets));
+    }
+    while(probe_sim_now_us() < end_us){
+        uint64_t start_us = probe_sim_now_us();
+        uint32_t wake_ms;
+        memcpy(due_ms, next_ms, n * sizeof(next_ms[0]));
+        uint64_t cpu_ns = host_ns();
+        photometric_probe_duty_run(&duty, (uint32_t) (start_us / 1000), &wake_ms);
+        record_window(n, due_ms, start_us, host_ns() - cpu_ns);
+        // sleeps until the next deadline, in the 32 bit millisecond time of the schedule
+        uint32_t sleep_ms = wake_ms - (uint32_t) (probe_sim_now_us() / 1000);
+        if((int32_t) sleep_ms > 0){
+            probe_sim_advance_to_us(((probe_sim_now_us() / 1000) + sleep_ms) * 1000);
+        }
+        else if(probe_sim_now_us() == start_us){
+            // nothing due yet within this millisecond
+            probe_sim_advance_to_us(start_us + 1000 - (start_us % 1000));
+        }
+        while(probe_sim_now_us() >= next_row_us){
+            uint64_t rss = rss_kb();
+            if(rss > rss_max){
+                rss_max = rss;
+            }
+            empty_windows += series.empty_windows;
+            series_row(out, (double) next_row_us / 3600e6, rss);
+            if(rss_first == 0){
+                // once every code path, output included, has run
+                rss_first = rss_kb();
+                rss_max = rss_first;
+            }
+            next_row_us += series_us;
+        }
+    }
+    uint64_t host_ms = (host_ns() - start_ns) / 1000000;
+    if(out != NULL){
+        fclose(out);
+    }
+    printf("fleet: %u buses x %u probes, period %u ms x 1..%u, window %u ms, faults %u%%, seed %u\n", bus_count, per_bus,
+           base_ms, rates, window_ms, fault_percent, seed);
+    printf("simulated %.2f h in %llu ms: %u windows, %u empty wakeups, %u samples, %u failed, awake max %u us\n", (double) probe_sim_now_us() / 3600e6,
+           (unsigned long long) host_ms, duty.windows, empty_windows + series.empty_windows, duty.samples, duty.failures, duty.awake_max_us);
+    printf("%-20s %12s %10s %10s %10s %10s %10s\n", "measure", "count", "mean", "p50", "p99", "p99.9", "max");
+    hist_print(&jitter);
+    hist_print(&drift);
+    for(uint8_t p = 0; p < PHASE_COUNT; p++){
+        hist_print(&phases[p]);
+    }
+    uint64_t rss_growth = (rss_max > rss_first) ? (rss_max - rss_first) : 0;
+    printf("resident memory: %llu kB after the first interval, %llu kB max, growth %llu kB\n", (unsigned long long) rss_first,
+           (unsigned long long) rss_max, (unsigned long long) rss_growth);
+    uint8_t failed = 0;
+    if((jitter_limit_us != 0) && (hist_percentile(&jitter, 99) > jitter_limit_us)){
+        printf("FAIL: p99 interval jitter above %llu us\n", (unsigned long long) jitter_limit_us);
+        failed = 1;
+    }
+    if(rss_growth > rss_limit_kb){
+        printf("FAIL: resident memory grew by more than %llu kB\n", (unsigned long long) rss_limit_kb);
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file lpph_wcet.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the worst case timing harness of the driver, run against the probe simulator
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * Build and run on the host:
+ *     gcc -O2 -o lpph_wcet bench/lpph_wcet.c bench/lpph_sim.c lpph.c -lm && ./lpph_wcet [iterations] [seed]
+ * Exits with 1 if a response time exceeds the bound given by the driver.
+ */
+
+#include "lpph_sim.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "time.h"
+
+#define BUSES                       2
+#define PROBES_PER_BUS              3
+#define PROBES                      (BUSES * PROBES_PER_BUS)
+#define MAX_RETRIES                 2
+#define FAULT_PERCENT               20
+
+/**
+ * @brief APIs under measurement
+ * 
+ */
+typedef enum{
+    API_READ_ILLUMINANCE,
+    API_READ_TEMPERATURE,
+    API_UPDATE_MEASUREMENTS,
+    API_UPDATE_MANY,
+    API_GROUP_SNAPSHOT,
+    API_COUNT
+}api_e;
+
+/**
+ * @brief Worst case timing of an API
+ * 
+ */
+typedef struct{
+    const char* name;
+    uint32_t calls;
+    uint32_t failures;
+    uint64_t exec_max_ns; // host time, simulator included
+    uint64_t response_max_us; // virtual time
+    uint64_t bound_us; // bound given by the driver
+    uint32_t violations; // calls exceeding the bound
+}api_stats_t;
+
+static photometric_probe_obj probes[PROBES];
+static api_stats_t stats[API_COUNT] = {
+    {"read_illuminance", 0, 0, 0, 0, 0, 0},
+    {"read_temperature_celsius", 0, 0, 0, 0, 0, 0},
+    {"update_measurements", 0, 0, 0, 0, 0, 0},
+    {"update_many", 0, 0, 0, 0, 0, 0},
+    {"group_snapshot", 0, 0, 0, 0, 0, 0},
+};
+
+/**
+ * @brief Reads the host monotonic clock
+ * 
+ * @return uint64_t: time in nanoseconds
+ */
+static uint64_t host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * @brief Calls an API once, on a random probe for single probe APIs
+ * 
+ * @param api: API to call
+ * @return probe_status_e: status of the call
+ */
+static probe_status_e call(api_e api){
+    photometric_probe_obj* obj = &probes[rand() % PROBES];
+    probe_status_e results[PROBES];
+    probe_sample_t samples[PROBES];
+    snapshot_report_t report;
+    switch(api){
+        case API_READ_ILLUMINANCE:
+            return (photometric_probe_read_illuminance(obj) != 0) ? STATUS_OK : STATUS_ERR;
+        case API_READ_TEMPERATURE:
+            return (photometric_probe_read_internal_temperature_celsius(obj) != 0) ? STATUS_OK : STATUS_ERR;
+        case API_UPDATE_MEASUREMENTS:
+            return photometric_probe_update_measurements(obj);
+        case API_UPDATE_MANY:
+            return photometric_probe_update_many(probes, PROBES, results);
+        case API_GROUP_SNAPSHOT:
+            return photometric_probe_group_snapshot(probes, PROBES, 1, samples, &report);
+        default:
+            return STATUS_ERR;
+    }
+}
+
+/**
+ * @brief Gives the bound of an API over all the probes it may be called on
+ * 
+ * @param api: API
+ * @return uint64_t: bound in microseconds
+ */
+static uint64_t bound(api_e api){
+    uint64_t bound_us = 0;
+    for(uint16_t i = 0; i < PROBES; i++){
+        uint64_t probe_us = 0;
+        switch(api){
+            case API_READ_ILLUMINANCE:
+            case API_READ_TEMPERATURE:
+                probe_us = photometric_probe_read_bound_us(&probes[i], 1);
+                break;
+            case API_UPDATE_MEASUREMENTS:
+                probe_us = photometric_probe_update_bound_us(&probes[i]);
+                break;
+            default:
+                return photometric_probe_batch_bound_us(probes, PROBES);
+        }
+        if(probe_us > bound_us){
+            bound_us = probe_us;
+        }
+    }
+    return bound_us;
+}
+
+int main(int argc, char** argv){
+    uint32_t iterations = (argc > 1) ? (uint32_t) atoi(argv[1]) : 20000;
+    uint32_t seed = (argc > 2) ? (uint32_t) atoi(argv[2]) : 1;
+    const baudrate_e baudrates[BUSES] = {BAUDRATE_19200, BAUDRATE_115200};
+    probe_sim_init(seed);
+    srand(seed);
+    for(uint8_t b = 0; b < BUSES; b++){
+        for(uint8_t p = 0; p < PROBES_PER_BUS; p++){
+            photometric_probe_obj* obj = &probes[(b * PROBES_PER_BUS) + p];
+            config_t cfg = {.address = 1 + p, .baudrate = baudrates[b], .mode = MODE_8N1, .range = LOW_RANGE};
+            photometric_probe_init(obj, cfg);
+            probe_sim_probe_t* sim = probe_sim_attach(obj, b);
+            sim->regs[0] = 215; // 21.5 C
+            sim->regs[1] = 707; // 70.7 F
+            sim->regs[2] = 1000 + p;
+            obj->max_retries = MAX_RETRIES;
+            obj->batched_reads = (p == 0) ? 1 : 0;
+        }
+        probe_sim_bus(b)->fault_percent = FAULT_PERCENT;
+    }
+    for(uint32_t i = 0; i < iterations; i++){
+        // alternate between random and extreme turnarounds
+        for(uint8_t b = 0; b < BUSES; b++){
+            probe_sim_bus(b)->extreme_turnaround = (i & 1);
+        }
+        for(uint8_t api = 0; api < API_COUNT; api++){
+            api_stats_t* s = &stats[api];
+            uint64_t start_ns = host_ns();
+            uint64_t start_us = probe_sim_now_us();
+            probe_status_e status = call((api_e) api);
+            uint64_t exec_ns = host_ns() - start_ns;
+            uint64_t response_us = probe_sim_now_us() - start_us;
+            s->calls++;
+            if(status != STATUS_OK){
+                s->failures++;
+            }
+            if(exec_ns > s->exec_max_ns){
+                s->exec_max_ns = exec_ns;
+            }
+            if(response_us > s->response_max_us){
+                s->response_max_us = response_us;
+            }
+            s->bound_us = bound((api_e) api);
+            if(response_us > s->bound_us){
+                s->violations++;
+            }
+        }
+    }
+    printf("%-26s %8s %8s %12s %14s %12s %6s\n", "api", "calls", "failed", "wcet ns", "worst resp us", "bound us", "ok");
+    uint32_t violations = 0;
+    for(uint8_t api = 0; api < API_COUNT; api++){
+        api_stats_t* s = &stats[api];
+        printf("%-26s %8u %8u %12llu %14llu %12llu %6s\n", s->name, s->calls, s->failures, (unsigned long long) s->exec_max_ns,
+               (unsigned long long) s->response_max_us, (unsigned long long) s->bound_us, s->violations ? "NO" : "yes");
+        violations += s->violations;
+    }
+    for(uint8_t b = 0; b < BUSES; b++){
+        probe_sim_bus_t* sim = probe_sim_bus(b);
+        printf("bus %u: %u requests, faults silent %u late %u truncated %u crc %u exception %u slow %u\n", b, sim->requests,
+               sim->faults[SIM_FAULT_SILENT], sim->faults[SIM_FAULT_LATE], sim->faults[SIM_FAULT_TRUNCATED],
+               sim->faults[SIM_FAULT_CRC], sim->faults[SIM_FAULT_EXCEPTION], sim->faults[SIM_FAULT_SLOW]);
+    }
+    return violations ? 1 : 0;
+}
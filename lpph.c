@@ -12,6 +12,8 @@
 #include "lpph.h"
 #include "stdio.h"
 #include "string.h"
+#include "stdlib.h"
+#include "math.h"
 
 
 /**
@@ -21,81 +23,569 @@
  * @param len: length of buffer
  * @return uint16_t
  */
-static uint16_t ModRTU_CRC(uint8_t* buf, int len);
+static uint16_t ModRTU_CRC(const uint8_t* buf, int len);
 
+/**
+ * @brief Feeds bytes to a Modbus CRC computed in software
+ * 
+ * @param crc: CRC of the previous bytes, 0xFFFF for the first ones
+ * @param buf: buffer array
+ * @param len: length of buffer
+ * @return uint16_t: CRC including buf
+ */
+static uint16_t crc_update(uint16_t crc, const uint8_t* buf, int len);
+
+
+/**
+ * @brief Calculates CRC of Modbus frame with the CRC provider of the probe, or in software if it has none
+ * 
+ * @param obj: pointer to probe object
+ * @param buf: buffer array
+ * @param len: length of buffer
+ * @return uint16_t
+ */
+static uint16_t frame_crc(const photometric_probe_obj* obj, const uint8_t* buf, uint8_t len);
 
 /**
  * @brief Validates CRC of frame
  * 
+ * @param obj: pointer to probe object
  * @param buf: buffer array
  * @param size: length of buffer
  * @return probe_status_e 
  * @retval STATUS_OK if CRC valid
  * @retval STATUS_ERR if CRC invalid
  */
-static probe_status_e crc_check(uint8_t* buf, uint8_t size);
+static probe_status_e crc_check(const photometric_probe_obj* obj, const uint8_t* buf, uint8_t size);
+
+/**
+ * @brief Calculates CRC of the first bytes of a frame received in place
+ * 
+ * @param obj: pointer to probe object
+ * @param frame: frame segments
+ * @param len: number of bytes covered by the CRC
+ * @return uint16_t
+ */
+static uint16_t view_crc(const photometric_probe_obj* obj, const probe_frame_view_t* frame, uint16_t len);
+
+/**
+ * @brief Gives a byte of a frame received in place
+ * 
+ * @param frame: frame segments
+ * @param idx: index of the byte in the frame
+ * @return uint8_t
+ */
+static uint8_t view_byte(const probe_frame_view_t* frame, uint16_t idx);
 
 
 #define CELSIUS_TEMP_ADDR           0x00
 #define FAHRENHEIT_TEMP_ADDR        0x01
 #define ILLUMINANCE_ADDR            0x02
 
+// framing of a read transaction in characters: request, response header and CRC, and two inter-frame gaps
+#define READ_OVERHEAD_CHARS         (PHOTOMETRIC_PROBE_REQUEST_LEN + PHOTOMETRIC_PROBE_RESPONSE_LEN(0) + 7)
+
+#ifndef PHOTOMETRIC_PROBE_MAX_TURNAROUND_US
+#define PHOTOMETRIC_PROBE_MAX_TURNAROUND_US 50000 // longest time the probe takes to start answering a request
+#endif
+
+#define PHOTOMETRIC_PROBE_INITIAL_RATE_VAR  10000.0f // variance of illuminance rate before the second sample, (100 Lux/s)^2
+
+#ifndef PHOTOMETRIC_PROBE_MAX_BUSES
+#define PHOTOMETRIC_PROBE_MAX_BUSES 8 // buses driven concurrently by a batch update, more buses are served in further passes
+#endif
+
 /**
- * @brief Reads a Modbus register
+ * @brief Reads a span of Modbus input registers
  * 
  * @param obj: pointer to probe object
- * @param reg_addr: address of holding register
+ * @param reg_addr: address of first input register
+ * @param count: number of registers to read (up to PHOTOMETRIC_PROBE_MAX_READ_REGS)
  * @param buf: buffer to which response frame will be copied
  * @return probe_status_e
  * @retval STATUS_ERR if CRC not OK
- * @retval STATUS_OK if register successfully read
+ * @retval STATUS_OK if registers successfully read
+ */
+static probe_status_e read_span(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, uint8_t* buf);
+
+/**
+ * @brief Sends a Modbus read input registers request without waiting for the response
+ * 
+ * @param obj: pointer to probe object
+ * @param reg_addr: address of first input register
+ * @param count: number of registers to read (up to PHOTOMETRIC_PROBE_MAX_READ_REGS)
+ */
+static void send_read_request(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count);
+
+/**
+ * @brief Starts the interrupt driven reception of a response, before its request is sent
+ * @note Does nothing if the probe has no OS hooks, the response is then read by receive_read_response
+ * 
+ * @param obj: pointer to probe object
+ * @param buf: buffer receiving the response frame, (count * 2) + 5 bytes long, must stay valid until receive_read_response returns
+ * @param count: number of registers requested
+ */
+static void receive_start(photometric_probe_obj* obj, uint8_t* buf, uint8_t count);
+
+/**
+ * @brief Receives the response frame of a previously sent read request
+ * @note With OS hooks, sleeps until the RX complete ISR signals or the response timeout elapses
+ * 
+ * @param obj: pointer to probe object
+ * @param buf: buffer to which response frame will be copied, (count * 2) + 5 bytes long, the one given to receive_start
+ * @param count: number of registers requested
+ * @return probe_status_e
+ * @retval STATUS_ERR if CRC not OK
+ * @retval STATUS_OK if response successfully received
+ */
+static probe_status_e receive_read_response(photometric_probe_obj* obj, uint8_t* buf, uint8_t count);
+
+/**
+ * @brief Receives bytes from the UART of a probe, giving up after timeout_us when the probe has a timed read
+ * @note On timeout, the rest of a late or truncated frame is dropped for one inter-frame gap so it does not shift the next response
+ * 
+ * @param obj: pointer to probe object
+ * @param buf: buffer receiving len bytes
+ * @param len: number of bytes to receive
+ * @param timeout_us: longest wait, ignored by the blocking uart_read
+ * @return probe_status_e
+ * @retval STATUS_OK if len bytes received
+ * @retval STATUS_ERR on timeout
+ */
+static probe_status_e uart_receive(const photometric_probe_obj* obj, uint8_t* buf, uint8_t len, uint32_t timeout_us);
+
+/**
+ * @brief Receives a response frame, recording when its first and last bytes arrived
+ * @note With get_time_us, the first byte is read alone so the return of each read stamps an end of the frame
+ * 
+ * @param obj: pointer to probe object
+ * @param buf: buffer receiving len bytes
+ * @param len: frame length
+ * @param timeout_us: longest wait for the whole frame
+ * @return probe_status_e
+ * @retval STATUS_OK if len bytes received
+ * @retval STATUS_ERR on timeout
+ */
+static probe_status_e receive_frame(photometric_probe_obj* obj, uint8_t* buf, uint8_t len, uint32_t timeout_us);
+
+/**
+ * @brief Records the receive time of the response about to be decoded, the transport capture of uart_rx_time taking precedence
+ * 
+ * @param obj: pointer to probe object
+ * @param first_us: arrival of the first byte, as seen by the caller
+ * @param last_us: arrival of the last byte, as seen by the caller
+ */
+static void rx_time_capture(photometric_probe_obj* obj, uint32_t first_us, uint32_t last_us);
+
+/**
+ * @brief Runs the configuration session of a probe once, at the current command pacing
+ * 
+ * @param obj: pointer to probe object
+ * @param cfg: configuration to write
+ * @param deadline_us: time at which the session is abandoned
+ * @return probe_status_e
+ * @retval STATUS_OK if the configuration read back matches cfg
+ * @retval STATUS_ERR otherwise
+ */
+static probe_status_e configure_session(photometric_probe_obj* obj, config_t cfg, uint32_t deadline_us);
+
+/**
+ * @brief Gives the next delay between commands to try, bisecting between the failed and the safe delays
+ * 
+ * @param pacing: pointer to command pacing object
+ * @return uint32_t: delay in microseconds, the safe one once learning is done
+ */
+static uint32_t pacing_trial_us(const probe_pacing_t* pacing);
+
+/**
+ * @brief Sends an ASCII command terminated by CR
+ * 
+ * @param obj: pointer to probe object
+ * @param cmd: command, without terminator
+ * @retval STATUS_OK if sent
+ * @retval STATUS_ERR if longer than PHOTOMETRIC_PROBE_COMMAND_LEN, nothing is sent
+ */
+static probe_status_e command_send(const photometric_probe_obj* obj, const char* cmd);
+
+/**
+ * @brief Receives an ASCII response line, skipping the empty lines left by CR LF terminators
+ * 
+ * @param obj: pointer to probe object
+ * @param rsp: buffer receiving the line without terminator
+ * @param rsp_len: size of rsp, NUL included
+ * @param deadline_us: time at which the reception is abandoned
+ * @return probe_status_e
+ * @retval STATUS_OK if a line was received
+ * @retval STATUS_ERR on timeout or if the line does not fit rsp
+ */
+static probe_status_e command_receive(const photometric_probe_obj* obj, char* rsp, uint8_t rsp_len, uint32_t deadline_us);
+
+/**
+ * @brief Receives one character of an ASCII response
+ * 
+ * @param obj: pointer to probe object
+ * @param c: received character
+ * @param deadline_us: time at which the reception is abandoned, ignored by the blocking uart_read
+ * @return probe_status_e
+ * @retval STATUS_OK if a character was received
+ * @retval STATUS_ERR on timeout
+ */
+static probe_status_e command_getc(const photometric_probe_obj* obj, uint8_t* c, uint32_t deadline_us);
+
+/**
+ * @brief Checks whether responses of a probe are received under interrupt
+ * 
+ * @param obj: pointer to probe object
+ * @return uint8_t: 1 if OS hooks and uart_read_start are set, 0 otherwise
+ */
+static uint8_t rx_async(const photometric_probe_obj* obj);
+
+/**
+ * @brief Takes the bus lock of a probe, does nothing without OS hooks
+ * 
+ * @param obj: pointer to probe object
+ */
+static void bus_lock(const photometric_probe_obj* obj);
+
+/**
+ * @brief Releases the bus lock of a probe, does nothing without OS hooks
+ * 
+ * @param obj: pointer to probe object
+ */
+static void bus_unlock(const photometric_probe_obj* obj);
+
+/**
+ * @brief Starts writing the measurements of a probe, without waiting
+ * @note Writers of a probe are serialized by its bus, another write in progress means the caller preempted it (e.g. a RX ISR
+ * interrupting a task), and waiting for it would never end on a single core
+ * 
+ * @param obj: pointer to probe object
+ * @return uint8_t: 1 if the write can proceed, 0 if another write is in progress
+ */
+static uint8_t measurements_write_begin(photometric_probe_obj* obj);
+
+/**
+ * @brief Ends writing the measurements of a probe, publishing them to readers
+ * 
+ * @param obj: pointer to probe object
+ */
+static void measurements_write_end(photometric_probe_obj* obj);
+
+/**
+ * @brief Copies the last published state of a probe, lock-free
+ * @note Readers only retry when a publication completed during their copy, a writer stalled halfway never holds them
+ * 
+ * @param obj: pointer to probe object
+ * @param published: copy of the published state
+ */
+static void measurements_read(const photometric_probe_obj* obj, probe_published_t* published);
+
+/**
+ * @brief Decodes every value held by a span of registers and stores the measurements into the probe object
+ * @note Registers of the span not described by the register map, e.g. bridged gaps, are skipped
+ * 
+ * @param obj: pointer to probe object
+ * @param reg_addr: address of the first register of the span
+ * @param count: number of registers of the span
+ * @param data: big endian register values in the response frame, NULL if the transaction failed
+ * @retval STATUS_OK if stored
+ * @retval STATUS_ERR if dropped, another write of the probe was in progress
+ */
+static probe_status_e store_span(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const uint8_t* data);
+
+/**
+ * @brief Decodes the registers of a span where the frame was received and stores the measurements it holds
+ * @note Values straddling the segments of the frame are read across them
+ * 
+ * @param obj: pointer to probe object
+ * @param reg_addr: address of the first register of the span
+ * @param count: number of registers of the span
+ * @param frame: frame holding the big endian register values, NULL if the transaction failed
+ * @param offset: index in the frame of the first register byte
+ * @retval STATUS_OK if stored
+ * @retval STATUS_ERR if dropped, another write of the probe was in progress
+ */
+static probe_status_e store_span_view(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const probe_frame_view_t* frame, uint16_t offset);
+
+/**
+ * @brief Decodes a value and stores the measurement into the probe object, within a measurements write
+ * 
+ * @param obj: pointer to probe object
+ * @param value: value
+ * @param frame: frame holding the big endian registers of the value, NULL if the transaction failed
+ * @param offset: index in the frame of the first register byte of the value
+ */
+static void store_value(photometric_probe_obj* obj, probe_value_e value, const probe_frame_view_t* frame, uint16_t offset);
+
+/**
+ * @brief Gives the register map of a probe
+ * 
+ * @param obj: pointer to probe object
+ * @return const probe_reg_desc_t*: PROBE_VALUE_COUNT descriptors indexed by value
+ */
+static const probe_reg_desc_t* probe_regs(const photometric_probe_obj* obj);
+
+/**
+ * @brief Gives the number of registers of a value
+ * 
+ * @param desc: descriptor of the value
+ * @return uint8_t
+ */
+static uint8_t reg_width(const probe_reg_desc_t* desc);
+
+/**
+ * @brief Checks whether a span of registers holds a value
+ * 
+ * @param obj: pointer to probe object
+ * @param reg_addr: address of the first register of the span
+ * @param count: number of registers of the span
+ * @param value: value
+ * @return uint8_t: 1 if all the registers of the value are in the span
+ */
+static uint8_t span_holds(const photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, probe_value_e value);
+
+/**
+ * @brief Feeds a new illuminance sample to the prediction filter of a probe
+ * @note Does nothing if the probe has no time source
+ * 
+ * @param obj: pointer to probe object
+ * @param illuminance: measured illuminance in Lux
+ */
+static void filter_illuminance(photometric_probe_obj* obj, uint32_t illuminance);
+
+/**
+ * @brief Propagates illuminance filter state and covariance by dt seconds (constant rate model)
+ * 
+ * @param filter: pointer to filter state, updated in place
+ * @param dt: propagation time in seconds
+ */
+static void filter_predict(illuminance_filter_t* filter, float dt);
+
+/**
+ * @brief Reads the time source of a probe
+ * 
+ * @param obj: pointer to probe object
+ * @return uint32_t: time in microseconds, 0 if the probe has no time source
+ */
+static uint32_t probe_time_us(const photometric_probe_obj* obj);
+
+/**
+ * @brief Validates a read input registers response: address, function, byte count and CRC
+ * @note A late response to an earlier request of the bus may have the expected length, only its header tells it apart
+ * 
+ * @param obj: pointer to probe object
+ * @param frame: response frame, PHOTOMETRIC_PROBE_RESPONSE_LEN(count) bytes
+ * @param count: number of registers read by the request
+ * @return probe_status_e
+ */
+static probe_status_e response_check(const photometric_probe_obj* obj, const uint8_t* frame, uint8_t count);
+
+/**
+ * @brief Checks whether a probe is the first one of its bus in the probes array
+ * @note Probes are on the same bus when they share the same uart_write API, as bus access functions carry no context
+ * 
+ * @param probes: array of probe objects
+ * @param idx: index of the probe to check
+ * @return uint8_t: 1 if first probe on its bus, 0 otherwise
+ */
+static uint8_t is_first_on_bus(const photometric_probe_obj* probes, uint16_t idx);
+
+/**
+ * @brief Finds the next probe sharing the bus of probes[idx]
+ * 
+ * @param probes: array of probe objects
+ * @param n: number of probes
+ * @param idx: index of the current probe
+ * @return uint16_t: index of the next probe on the same bus, n if none
+ */
+static uint16_t next_on_bus(const photometric_probe_obj* probes, uint16_t n, uint16_t idx);
+
+// register map of the LPPHOT03
+static const probe_reg_desc_t lpphot03_regs[PROBE_VALUE_COUNT] = {
+    {CELSIUS_TEMP_ADDR, PROBE_REG_U16, 0.1f},
+    {FAHRENHEIT_TEMP_ADDR, PROBE_REG_U16, 0.1f},
+    {ILLUMINANCE_ADDR, PROBE_REG_U16, 1.0f},
+};
+
+/**
+ * @brief A single read transaction of a batch
+ * 
+ */
+typedef struct{
+    uint8_t reg_addr; // first register read
+    uint8_t count; // number of registers read
+}read_step_t;
+
+/**
+ * @brief Selects the read transaction of a probe for a given step of a batch
+ * 
+ * @param obj: pointer to probe object
+ * @param step: index of the transaction for this probe, starting at 0
+ * @param ctx: batch context
+ * @param read: transaction to run
+ * @return uint8_t: 1 if read filled, 0 once the probe has no more transactions
+ */
+typedef uint8_t (*step_planner_t)(const photometric_probe_obj* obj, uint8_t step, void* ctx, read_step_t* read);
+
+/**
+ * @brief Consumes the response of a batch transaction
+ * 
+ * @param obj: pointer to probe object
+ * @param idx: index of the probe in the batch
+ * @param read: transaction which completed
+ * @param buf: response frame, NULL if the transaction failed
+ * @param ctx: batch context
  */
-static probe_status_e read_register(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t* buf);
+typedef void (*step_handler_t)(photometric_probe_obj* obj, uint16_t idx, const read_step_t* read, const uint8_t* buf, void* ctx);
+
+/**
+ * @brief Per bus progress of a batch
+ * 
+ */
+typedef struct{
+    uint16_t first; // index of the first probe of this bus, holding its OS hooks
+    uint16_t probe; // index of the probe currently served on this bus
+    uint8_t step; // index of the transaction in flight for this probe
+    uint8_t retries; // retries of the transaction in flight
+    read_step_t read; // transaction in flight
+    uint8_t rx[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN]; // response in flight, filled under interrupt with OS hooks
+}bus_cursor_t;
+
+/**
+ * @brief Runs read transactions of many probes, keeping one transaction in flight on every bus
+ * @note Responses are buffered by the UART of a bus while the other buses are served, so the wall time is the one of the busiest bus. 
+ * With OS hooks, the buses of a pass are locked in array order, tasks sharing several buses must list them in the same order
+ * 
+ * @param probes: array of probe objects
+ * @param n: number of probes
+ * @param plan: selects the transactions of each probe
+ * @param handle: consumes the responses
+ * @param ctx: batch context passed to plan and handle
+ * @return probe_status_e
+ * @retval STATUS_OK if all transactions succeeded
+ * @retval STATUS_ERR if at least one transaction failed
+ */
+static probe_status_e run_batch(photometric_probe_obj* probes, uint16_t n, step_planner_t plan, step_handler_t handle, void* ctx);
+
+/**
+ * @brief Moves a bus cursor to the next probe of the bus which has a transaction to run
+ * 
+ * @param probes: array of probe objects
+ * @param n: number of probes
+ * @param plan: selects the transactions of each probe
+ * @param ctx: batch context
+ * @param cursor: bus cursor, cursor->probe set to n once the bus is done
+ */
+static void seek_next_transaction(photometric_probe_obj* probes, uint16_t n, step_planner_t plan, void* ctx, bus_cursor_t* cursor);
+
+/**
+ * @brief Gives a transaction of the read plan of a set of values
+ * 
+ * @param obj: pointer to probe object
+ * @param values: set of values
+ * @param step: index of the transaction
+ * @param read: transaction to run
+ * @return uint8_t: 1 if read filled, 0 once the plan has no more transactions
+ */
+static uint8_t plan_step(const photometric_probe_obj* obj, uint32_t values, uint8_t step, read_step_t* read);
 
 
 
 probe_status_e photometric_probe_factory_init(photometric_probe_obj* obj, config_t cfg){
-    // at power up, entering user configuration mode
-    obj->uart_write((const uint8_t*) "@", 1);
-    obj->uart_write((const uint8_t*) "CAL USER ON", 11);
-    // configuring device address
-    char bdrate_cfg[10];
-    sprintf(bdrate_cfg, "CMA%03d", cfg.address);
-    obj->enable_transmission();
-    obj->uart_write((const uint8_t*) bdrate_cfg, strlen(bdrate_cfg));
-    obj->disable_transmission();
-    // configuring device baudrate
-    char param_cfg[8];
-    sprintf(param_cfg, "CMB%d", cfg.baudrate);
-    obj->enable_transmission();
-    obj->uart_write((const uint8_t*) param_cfg, strlen(param_cfg));
-    obj->disable_transmission();
-    // configuring UART transmission mode
-    sprintf(param_cfg, "CMP%d", cfg.mode);
-    obj->enable_transmission();
-    obj->uart_write((const uint8_t*) param_cfg, strlen(param_cfg));
-    obj->disable_transmission();
-    // verify parameters
-    obj->enable_transmission();
-    obj->uart_write((const uint8_t*) "RMA", 3);
-    obj->disable_transmission();
-    uint8_t rsp;
-    obj->uart_read(&rsp, 1);
-    if(rsp != cfg.address){
-        return STATUS_ERR;
+    // the session settings of the caller survive the reset: timed reads so a probe that does not answer cannot hang it,
+    // pipelining, pacing, bus lock, OS hooks and CRC provider so it runs as the caller's other sessions do
+    const photometric_probe_obj kept = *obj;
+    photometric_probe_init(obj, cfg);
+    obj->uart_read_timeout = kept.uart_read_timeout;
+    obj->get_time_us = kept.get_time_us;
+    obj->command_depth = kept.command_depth;
+    obj->pacing = kept.pacing;
+    obj->lock = kept.lock;
+    obj->os = kept.os;
+    obj->crc = kept.crc;
+    uint32_t deadline_us = (obj->get_time_us != NULL) ? (obj->get_time_us() + PHOTOMETRIC_PROBE_FACTORY_TIMEOUT_US) : 0;
+    return photometric_probe_configure(obj, cfg, deadline_us);
+}
+
+probe_status_e photometric_probe_configure(photometric_probe_obj* obj, config_t cfg, uint32_t deadline_us){
+    probe_pacing_t* pacing = obj->pacing;
+    if(pacing == NULL){
+        return configure_session(obj, cfg, deadline_us);
     }
-    obj->enable_transmission();
-    obj->uart_write((const uint8_t*) "RMB", 3);
-    obj->disable_transmission();
-    obj->uart_read(&rsp, 1);
-    if(rsp != cfg.baudrate){
+    uint32_t safe_us = pacing->safe_us;
+    uint32_t fail_us = pacing->fail_us;
+    uint32_t trial_deadline_us = deadline_us;
+    pacing->current_us = pacing->safe_us;
+    // a command dropped at a short delay is never answered, trials need timed reads and keep half the time for the fallback
+    if((obj->uart_read_timeout != NULL) && (obj->get_time_us != NULL)){
+        uint32_t now_us = obj->get_time_us();
+        // the clock wraps, a deadline already passed fails at once without teaching the pacing anything
+        int32_t remaining_us = (int32_t) (deadline_us - now_us);
+        if(remaining_us <= 0){
+            return STATUS_ERR;
+        }
+        pacing->current_us = pacing_trial_us(pacing);
+        trial_deadline_us = now_us + (uint32_t) (remaining_us / 2);
+    }
+    probe_status_e status = configure_session(obj, cfg, (pacing->current_us < pacing->safe_us) ? trial_deadline_us : deadline_us);
+    if((status != STATUS_OK) && (pacing->current_us < pacing->safe_us)){
+        pacing->fail_us = pacing->current_us;
+        pacing->current_us = pacing->safe_us;
+        status = configure_session(obj, cfg, deadline_us);
+    }
+    if(status == STATUS_OK){
+        pacing->safe_us = pacing->current_us;
+    }
+    else{
+        // the safe delay failed too, the probe may be slower than learned
+        pacing->safe_us = (pacing->safe_us < (PHOTOMETRIC_PROBE_PACING_MAX_US / 2)) ? (2 * pacing->safe_us) + PHOTOMETRIC_PROBE_PACING_RESOLUTION_US : PHOTOMETRIC_PROBE_PACING_MAX_US;
+        if(pacing->fail_us >= pacing->safe_us){
+            pacing->fail_us = 0;
+        }
+    }
+    if(((pacing->safe_us != safe_us) || (pacing->fail_us != fail_us)) && (pacing->save != NULL)){
+        pacing->save(pacing->ctx, pacing);
+    }
+    return status;
+}
+
+void photometric_probe_pacing_init(probe_pacing_t* pacing, void(*delay_us)(uint32_t us)){
+    pacing->current_us = PHOTOMETRIC_PROBE_PACING_MAX_US;
+    pacing->safe_us = PHOTOMETRIC_PROBE_PACING_MAX_US;
+    pacing->fail_us = 0;
+    pacing->delay_us = delay_us;
+    pacing->save = NULL;
+    pacing->ctx = NULL;
+}
+
+static probe_status_e configure_session(photometric_probe_obj* obj, config_t cfg, uint32_t deadline_us){
+    char cma[8];
+    char cmb[8];
+    char cmp[8];
+    char rma[PHOTOMETRIC_PROBE_COMMAND_LEN + 1];
+    char rmb[PHOTOMETRIC_PROBE_COMMAND_LEN + 1];
+    char rmp[PHOTOMETRIC_PROBE_COMMAND_LEN + 1];
+    char ack[PHOTOMETRIC_PROBE_COMMAND_LEN + 1];
+    snprintf(cma, sizeof(cma), "CMA%03d", cfg.address);
+    snprintf(cmb, sizeof(cmb), "CMB%d", cfg.baudrate);
+    snprintf(cmp, sizeof(cmp), "CMP%d", cfg.mode);
+    probe_command_t session[] = {
+        // at power up, entering user configuration mode, "@" is not answered
+        {"@", NULL, 0, STATUS_ERR},
+        {"CAL USER ON", ack, sizeof(ack), STATUS_ERR},
+        // settings are independent, they are sent back-to-back
+        {cma, ack, sizeof(ack), STATUS_ERR},
+        {cmb, ack, sizeof(ack), STATUS_ERR},
+        {cmp, ack, sizeof(ack), STATUS_ERR},
+        // verify parameters
+        {"RMA", rma, sizeof(rma), STATUS_ERR},
+        {"RMB", rmb, sizeof(rmb), STATUS_ERR},
+        {"RMP", rmp, sizeof(rmp), STATUS_ERR},
+    };
+    if(photometric_probe_command_pipeline(obj, session, sizeof(session) / sizeof(session[0]), deadline_us) != STATUS_OK){
         return STATUS_ERR;
     }
-    obj->enable_transmission();
-    obj->uart_write((const uint8_t*) "RMP", 3);
-    obj->disable_transmission();
-    obj->uart_read(&rsp, 1);
-    if(rsp != cfg.mode){
+    if((strtoul(rma, NULL, 10) != cfg.address) || (strtoul(rmb, NULL, 10) != (unsigned long) cfg.baudrate) || (strtoul(rmp, NULL, 10) != (unsigned long) cfg.mode)){
         return STATUS_ERR;
     }
     obj->cfg = cfg;
@@ -108,91 +598,679 @@ void photometric_probe_init(photometric_probe_obj* obj, config_t cfg){
     obj->illuminance = 0;
     obj->internal_temp_celsius = 0;
     obj->internal_temp_fahrenheit = 0;
+    // optional features are disabled until set by the application
+    obj->get_time_us = NULL;
+    obj->batched_reads = 0;
+    obj->lux_filter.samples = 0;
+    obj->lux_filter.process_noise = PHOTOMETRIC_PROBE_DEFAULT_PROCESS_NOISE;
+    obj->os = NULL;
+    obj->uart_read_start = NULL;
+    obj->uart_read_abort = NULL;
+    obj->lock = NULL;
+    obj->seq = 0;
+    obj->writing = 0;
+    obj->crc = NULL;
+    obj->transceiver_power = NULL;
+    obj->uart_read_timeout = NULL;
+    obj->max_retries = 0;
+    obj->command_depth = 1;
+    obj->pacing = NULL;
+    obj->regs = NULL;
+    obj->uart_rx_time = NULL;
+    obj->rx_time.first_us = 0;
+    obj->rx_time.last_us = 0;
+    for(uint8_t v = 0; v < PROBE_VALUE_COUNT; v++){
+        obj->value_time[v] = obj->rx_time;
+    }
+    // readers see the reset state
+    measurements_write_begin(obj);
+    measurements_write_end(obj);
     // set configuration
     obj->cfg = cfg;
 }
 
 float photometric_probe_read_internal_temperature_celsius(photometric_probe_obj* obj){
-    uint8_t rxBuf[7] = {};
-    if(read_register(obj, CELSIUS_TEMP_ADDR, rxBuf) == STATUS_ERR){
+    if(photometric_probe_read_values(obj, PROBE_VALUE_BIT(PROBE_VALUE_CELSIUS)) == STATUS_ERR){
         return 0;
     }
-	// Decode temperature
-	uint16_t tmp = 0;
-	tmp = rxBuf[3] << 8;
-	tmp |= rxBuf[4];
-	float temperature = ((float) tmp)/10;
-	return temperature;
+    return obj->internal_temp_celsius;
 }
 
 float photometric_probe_read_internal_temperature_fahrenheit(photometric_probe_obj* obj){
-    uint8_t rxBuf[7] = {};
-    if(read_register(obj, FAHRENHEIT_TEMP_ADDR, rxBuf) == STATUS_ERR){
+    if(photometric_probe_read_values(obj, PROBE_VALUE_BIT(PROBE_VALUE_FAHRENHEIT)) == STATUS_ERR){
         return 0;
     }
-	// Decode temperature
-	uint16_t tmp = 0;
-	tmp = rxBuf[3] << 8;
-	tmp |= rxBuf[4];
-	float temperature = ((float) tmp)/10;
-	return temperature;
+    return obj->internal_temp_fahrenheit;
 }
 
 uint32_t photometric_probe_read_illuminance(photometric_probe_obj* obj){
-    uint8_t rxBuf[7] = {};
-    if(read_register(obj, ILLUMINANCE_ADDR, rxBuf) == STATUS_ERR){
+    if(photometric_probe_read_values(obj, PROBE_VALUE_BIT(PROBE_VALUE_ILLUMINANCE)) == STATUS_ERR){
         return 0;
     }
-	// Decode illuminance
-	uint16_t tmp = 0;
-	tmp = rxBuf[3] << 8;
-	tmp |= rxBuf[4];
-    uint32_t illuminance = 0;
-    switch(obj->cfg.range){
-        case LOW_RANGE:
-            illuminance = tmp;
-            break;
-        case HIGH_RANGE:
-            illuminance = tmp * 10;
-            break;
-        default:
-            break;
-    }
-	return illuminance;
+    return obj->illuminance;
 }
 
 
 probe_status_e photometric_probe_update_measurements(photometric_probe_obj* obj){
-    obj->internal_temp_celsius = photometric_probe_read_internal_temperature_celsius(obj);
-    obj->internal_temp_fahrenheit = photometric_probe_read_internal_temperature_fahrenheit(obj);
-    obj->illuminance = photometric_probe_read_illuminance(obj);
-    if((obj->internal_temp_celsius == 0) || (obj->internal_temp_fahrenheit == 0) || (obj->illuminance == 0)){
-        return STATUS_ERR;
-    }
-    return STATUS_OK;
+    return photometric_probe_read_values(obj, PROBE_VALUES_ALL);
 }
 
 
-static uint16_t ModRTU_CRC(uint8_t* buf, int len){
-  uint16_t crc = 0xFFFF;
-  for (int pos = 0; pos < len; pos++) {
-    crc ^= (uint16_t)buf[pos];
-    for (int i = 8; i != 0; i--) {
-      if ((crc & 0x0001) != 0) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      }
-      else
-        crc >>= 1;
+uint8_t photometric_probe_plan_reads(const photometric_probe_obj* obj, uint32_t values, probe_read_span_t* spans){
+    const probe_reg_desc_t* regs = probe_regs(obj);
+    uint32_t left = values & PROBE_VALUES_ALL;
+    uint8_t n = 0;
+    while(left){
+        // values in ascending register order
+        uint8_t value = PROBE_VALUE_COUNT;
+        for(uint8_t v = 0; v < PROBE_VALUE_COUNT; v++){
+            if((left & PROBE_VALUE_BIT(v)) && ((value == PROBE_VALUE_COUNT) || (regs[v].reg_addr < regs[value].reg_addr))){
+                value = v;
+            }
+        }
+        left &= ~PROBE_VALUE_BIT(value);
+        uint8_t start = regs[value].reg_addr;
+        uint8_t end = start + reg_width(&regs[value]);
+        if(n > 0){
+            probe_read_span_t* last = &spans[n - 1];
+            uint8_t last_end = last->reg_addr + last->count;
+            if(end <= last_end){
+                // already read
+                continue;
+            }
+            // each bridged register costs 2 characters, against the framing of a second transaction
+            uint8_t gap = (start > last_end) ? (start - last_end) : 0;
+            if(obj->batched_reads && ((end - last->reg_addr) <= PHOTOMETRIC_PROBE_MAX_READ_REGS) && ((2 * gap) < READ_OVERHEAD_CHARS)){
+                last->count = end - last->reg_addr;
+                continue;
+            }
+        }
+        spans[n].reg_addr = start;
+        spans[n].count = end - start;
+        n++;
     }
-  }
-  return crc;
+    return n;
 }
 
+probe_status_e photometric_probe_read_values(photometric_probe_obj* obj, uint32_t values){
+    probe_read_span_t spans[PHOTOMETRIC_PROBE_MAX_SPANS];
+    uint8_t n = photometric_probe_plan_reads(obj, values, spans);
+    probe_status_e status = STATUS_OK;
+    for(uint8_t i = 0; i < n; i++){
+        uint8_t rxBuf[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN] = {};
+        if(read_span(obj, spans[i].reg_addr, spans[i].count, rxBuf) == STATUS_ERR){
+            store_span(obj, spans[i].reg_addr, spans[i].count, NULL);
+            status = STATUS_ERR;
+            continue;
+        }
+        if(store_span(obj, spans[i].reg_addr, spans[i].count, &rxBuf[3]) != STATUS_OK){
+            status = STATUS_ERR;
+        }
+    }
+    return status;
+}
 
-static probe_status_e crc_check(uint8_t* buf, uint8_t size){
+
+uint32_t photometric_probe_baudrate_bps(baudrate_e baudrate){
+    switch(baudrate){
+        case BAUDRATE_9600:
+            return 9600;
+        case BAUDRATE_19200:
+            return 19200;
+        case BAUDRATE_38400:
+            return 38400;
+        case BAUDRATE_57600:
+            return 57600;
+        case BAUDRATE_115200:
+            return 115200;
+        default:
+            return 9600;
+    }
+}
+
+
+uint32_t photometric_probe_char_time_us(config_t cfg){
+    // start bit, 8 data bits, parity and stop bits
+    uint32_t bits = 10;
+    switch(cfg.mode){
+        case MODE_8N2:
+        case MODE_8E1:
+        case MODE_8O1:
+            bits = 11;
+            break;
+        case MODE_8E2:
+        case MODE_802:
+            bits = 12;
+            break;
+        default:
+            break;
+    }
+    uint32_t bps = photometric_probe_baudrate_bps(cfg.baudrate);
+    return ((bits * 1000000) + bps - 1) / bps;
+}
+
+
+uint32_t photometric_probe_frame_gap_us(config_t cfg){
+    // Modbus RTU fixes t3.5 to 1750 us above 19200 baud
+    if(photometric_probe_baudrate_bps(cfg.baudrate) > 19200){
+        return 1750;
+    }
+    return ((photometric_probe_char_time_us(cfg) * 7) + 1) / 2;
+}
+
+
+uint32_t photometric_probe_response_timeout_us(config_t cfg, uint8_t count){
+    uint32_t frames = PHOTOMETRIC_PROBE_REQUEST_LEN + PHOTOMETRIC_PROBE_RESPONSE_LEN(count);
+    return (frames * photometric_probe_char_time_us(cfg)) + photometric_probe_frame_gap_us(cfg) + PHOTOMETRIC_PROBE_MAX_TURNAROUND_US;
+}
+
+
+uint32_t photometric_probe_read_bound_us(const photometric_probe_obj* obj, uint8_t count){
+    // request written, response awaited until its timeout, then the line drained for one gap
+    uint32_t attempt_us = (PHOTOMETRIC_PROBE_REQUEST_LEN * photometric_probe_char_time_us(obj->cfg)) + photometric_probe_response_timeout_us(obj->cfg, count) + photometric_probe_frame_gap_us(obj->cfg);
+    return attempt_us * (obj->max_retries + 1);
+}
+
+
+uint32_t photometric_probe_update_bound_us(const photometric_probe_obj* obj){
+    return photometric_probe_batch_bound_us(obj, 1);
+}
+
+
+uint32_t photometric_probe_batch_bound_us(const photometric_probe_obj* probes, uint16_t n){
+    uint32_t bound_us = 0;
+    for(uint16_t i = 0; i < n; i++){
+        uint8_t reg_addr;
+        uint8_t count;
+        for(uint8_t step = 0; photometric_probe_update_step(&probes[i], step, &reg_addr, &count); step++){
+            bound_us += photometric_probe_read_bound_us(&probes[i], count);
+        }
+    }
+    return bound_us;
+}
+
+
+uint8_t photometric_probe_update_step(const photometric_probe_obj* obj, uint8_t step, uint8_t* reg_addr, uint8_t* count){
+    read_step_t read;
+    if(!plan_step(obj, PROBE_VALUES_ALL, step, &read)){
+        return 0;
+    }
+    *reg_addr = read.reg_addr;
+    *count = read.count;
+    return 1;
+}
+
+
+uint8_t photometric_probe_encode_read_request(const photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, uint8_t* frame){
+    frame[0] = obj->cfg.address;
+    frame[1] = 0x04;
+    frame[2] = 0x00;
+    frame[3] = reg_addr;
+    frame[4] = 0x00;
+    frame[5] = count;
+    uint16_t crc = frame_crc(obj, frame, 6);
+    frame[6] = crc & 0xFF;
+    frame[7] = crc >> 8;
+    return PHOTOMETRIC_PROBE_REQUEST_LEN;
+}
+
+
+probe_status_e photometric_probe_decode_read_response_view(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const probe_frame_view_t* frame){
+    uint16_t len = frame->len[0] + frame->len[1];
+    if((count > PHOTOMETRIC_PROBE_MAX_READ_REGS) || (len != PHOTOMETRIC_PROBE_RESPONSE_LEN(count))){
+        return STATUS_ERR;
+    }
+    if((view_byte(frame, 0) != obj->cfg.address) || (view_byte(frame, 1) != 0x04) || (view_byte(frame, 2) != (count * 2))){
+        return STATUS_ERR;
+    }
+    uint16_t crc = view_crc(obj, frame, len - 2);
+    if((view_byte(frame, len - 2) != (crc & 0xFF)) || (view_byte(frame, len - 1) != (crc >> 8))){
+        return STATUS_ERR;
+    }
+    return store_span_view(obj, reg_addr, count, frame, 3);
+}
+
+probe_status_e photometric_probe_decode_read_response(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const uint8_t* frame, uint8_t len){
+    if((count > PHOTOMETRIC_PROBE_MAX_READ_REGS) || (len != PHOTOMETRIC_PROBE_RESPONSE_LEN(count))){
+        return STATUS_ERR;
+    }
+    if(response_check(obj, frame, count) != STATUS_OK){
+        return STATUS_ERR;
+    }
+    return store_span(obj, reg_addr, count, &frame[3]);
+}
+
+
+/**
+ * @brief Plans the transactions of an update
+ * 
+ */
+static uint8_t plan_update(const photometric_probe_obj* obj, uint8_t step, void* ctx, read_step_t* read){
+    (void) ctx;
+    return photometric_probe_update_step(obj, step, &read->reg_addr, &read->count);
+}
+
+/**
+ * @brief Stores the measurement of an update transaction, ctx is the results array
+ * 
+ */
+static void handle_update(photometric_probe_obj* obj, uint16_t idx, const read_step_t* read, const uint8_t* buf, void* ctx){
+    probe_status_e* results = (probe_status_e*) ctx;
+    if((store_span(obj, read->reg_addr, read->count, (buf != NULL) ? &buf[3] : NULL) != STATUS_OK) || (buf == NULL)){
+        results[idx] = STATUS_ERR;
+    }
+}
+
+probe_status_e photometric_probe_update_many(photometric_probe_obj* probes, uint16_t n, probe_status_e* results){
+    for(uint16_t i = 0; i < n; i++){
+        results[i] = STATUS_OK;
+    }
+    return run_batch(probes, n, &plan_update, &handle_update, results);
+}
+
+
+probe_status_e photometric_probe_predict_illuminance(const photometric_probe_obj* obj, illuminance_estimate_t* estimate){
+    probe_published_t state;
+    measurements_read(obj, &state);
+    illuminance_filter_t filter = state.lux_filter;
+    if((obj->get_time_us == NULL) || !filter.samples){
+        return STATUS_ERR;
+    }
+    estimate->age_us = obj->get_time_us() - filter.timestamp_us;
+    filter_predict(&filter, ((float) estimate->age_us) / 1000000);
+    estimate->illuminance = (filter.illuminance > 0) ? filter.illuminance : 0;
+    estimate->uncertainty = sqrtf(filter.var_illuminance);
+    estimate->samples = filter.samples;
+    return STATUS_OK;
+}
+
+
+/**
+ * @brief Snapshot state shared by the planner and handler
+ * 
+ */
+typedef struct{
+    uint8_t with_temperature;
+    probe_sample_t* samples;
+    snapshot_report_t* report;
+    uint8_t started; // 1 once the first illuminance response is timestamped
+}snapshot_ctx_t;
+
+/**
+ * @brief Checks whether a snapshot reads the temperature of a probe with its illuminance, in a single transaction
+ * 
+ */
+static uint8_t snapshot_batches_temperature(const photometric_probe_obj* obj){
+    probe_read_span_t spans[PHOTOMETRIC_PROBE_MAX_SPANS];
+    return (photometric_probe_plan_reads(obj, PROBE_VALUE_BIT(PROBE_VALUE_ILLUMINANCE) | PROBE_VALUE_BIT(PROBE_VALUE_CELSIUS), spans) == 1) ? 1 : 0;
+}
+
+/**
+ * @brief Plans the transactions of a group snapshot
+ * @note Step 0 is the timing critical illuminance read, batched with temperature when the probe supports it. 
+ * Step 1 reads temperature of non batching probes, it runs after every illuminance read of the bus so it adds no skew
+ * 
+ */
+static uint8_t plan_snapshot(const photometric_probe_obj* obj, uint8_t step, void* ctx, read_step_t* read){
+    const snapshot_ctx_t* snap = (const snapshot_ctx_t*) ctx;
+    uint32_t values = PROBE_VALUE_BIT(PROBE_VALUE_ILLUMINANCE);
+    if(snap->with_temperature && snapshot_batches_temperature(obj)){
+        values |= PROBE_VALUE_BIT(PROBE_VALUE_CELSIUS);
+    }
+    return plan_step(obj, values, step, read);
+}
+
+/**
+ * @brief Plans the late temperature reads of a group snapshot, for probes without batched reads
+ * 
+ */
+static uint8_t plan_snapshot_temperature(const photometric_probe_obj* obj, uint8_t step, void* ctx, read_step_t* read){
+    (void) ctx;
+    if(snapshot_batches_temperature(obj)){
+        return 0;
+    }
+    return plan_step(obj, PROBE_VALUE_BIT(PROBE_VALUE_CELSIUS), step, read);
+}
+
+/**
+ * @brief Timestamps and stores the response of a snapshot transaction
+ * 
+ */
+static void handle_snapshot(photometric_probe_obj* obj, uint16_t idx, const read_step_t* read, const uint8_t* buf, void* ctx){
+    snapshot_ctx_t* snap = (snapshot_ctx_t*) ctx;
+    probe_sample_t* sample = &snap->samples[idx];
+    // a failed read resets the values of its span and their receive times, as an update does
+    if((store_span(obj, read->reg_addr, read->count, (buf != NULL) ? &buf[3] : NULL) != STATUS_OK) || (buf == NULL)){
+        if(span_holds(obj, read->reg_addr, read->count, PROBE_VALUE_ILLUMINANCE)){
+            sample->status = STATUS_ERR;
+            snap->report->failed++;
+        }
+        return;
+    }
+    sample->internal_temp_celsius = obj->internal_temp_celsius;
+    if(!span_holds(obj, read->reg_addr, read->count, PROBE_VALUE_ILLUMINANCE)){
+        // late temperature read, not part of the snapshot timing
+        return;
+    }
+    // the sample is dated by the arrival of its response, not by when the batch got to it
+    uint32_t now = obj->value_time[PROBE_VALUE_ILLUMINANCE].first_us;
+    sample->illuminance = obj->illuminance;
+    sample->timestamp_us = now;
+    sample->status = STATUS_OK;
+    // batches handle the buses in turn, not in arrival order: keep the earliest and latest stamps, wraparound safe
+    if(!snap->started){
+        snap->report->first_us = now;
+        snap->report->last_us = now;
+        snap->started = 1;
+    }
+    else if((int32_t) (now - snap->report->first_us) < 0){
+        snap->report->first_us = now;
+    }
+    else if((int32_t) (now - snap->report->last_us) > 0){
+        snap->report->last_us = now;
+    }
+}
+
+probe_status_e photometric_probe_group_snapshot(photometric_probe_obj* probes, uint16_t n, uint8_t with_temperature, probe_sample_t* samples, snapshot_report_t* report){
+    snapshot_ctx_t snap = {with_temperature, samples, report, 0};
+    report->first_us = 0;
+    report->last_us = 0;
+    report->failed = 0;
+    for(uint16_t i = 0; i < n; i++){
+        samples[i].address = probes[i].cfg.address;
+        samples[i].status = STATUS_ERR;
+        samples[i].timestamp_us = 0;
+        samples[i].illuminance = 0;
+        samples[i].internal_temp_celsius = 0;
+    }
+    probe_status_e status = run_batch(probes, n, &plan_snapshot, &handle_snapshot, &snap);
+    report->skew_us = report->last_us - report->first_us;
+    if(with_temperature){
+        // temperature failures are reported through the status only, illuminance samples stay valid
+        if(run_batch(probes, n, &plan_snapshot_temperature, &handle_snapshot, &snap) != STATUS_OK){
+            status = STATUS_ERR;
+        }
+    }
+    return status;
+}
+
+
+/**
+ * @brief Duty cycle window shared by the planner and handler
+ * 
+ */
+typedef struct{
+    probe_duty_t* duty;
+    uint32_t horizon_ms; // probes due before horizon_ms are sampled in this window
+}duty_window_t;
+
+/**
+ * @brief Checks whether a probe of a duty cycle schedule is due in a window
+ * 
+ */
+static uint8_t duty_due(const duty_window_t* window, uint16_t idx){
+    return ((int32_t) (window->duty->next_ms[idx] - window->horizon_ms) < 0) ? 1 : 0;
+}
+
+/**
+ * @brief Plans the update transactions of the probes due in a window
+ * 
+ */
+static uint8_t plan_duty(const photometric_probe_obj* obj, uint8_t step, void* ctx, read_step_t* read){
+    const duty_window_t* window = (const duty_window_t*) ctx;
+    if(!duty_due(window, obj - window->duty->probes)){
+        return 0;
+    }
+    return photometric_probe_update_step(obj, step, &read->reg_addr, &read->count);
+}
+
+/**
+ * @brief Stores the measurement of a window transaction
+ * 
+ */
+static void handle_duty(photometric_probe_obj* obj, uint16_t idx, const read_step_t* read, const uint8_t* buf, void* ctx){
+    duty_window_t* window = (duty_window_t*) ctx;
+    handle_update(obj, idx, read, buf, window->duty->results);
+}
+
+/**
+ * @brief Switches the transceivers of the buses having a probe due in a window
+ * 
+ * @return uint8_t: number of transceivers switched
+ */
+static uint8_t duty_power(const duty_window_t* window, uint8_t on){
+    const probe_duty_t* duty = window->duty;
+    uint8_t switched = 0;
+    for(uint16_t i = 0; i < duty->n; i++){
+        if(!is_first_on_bus(duty->probes, i) || (duty->probes[i].transceiver_power == NULL)){
+            continue;
+        }
+        for(uint16_t j = i; j < duty->n; j = next_on_bus(duty->probes, duty->n, j)){
+            if(duty_due(window, j)){
+                duty->probes[i].transceiver_power(on);
+                switched++;
+                break;
+            }
+        }
+    }
+    return switched;
+}
+
+void photometric_probe_duty_init(probe_duty_t* duty, photometric_probe_obj* probes, uint16_t n, const uint32_t* period_ms, uint32_t* next_ms, probe_status_e* results, uint32_t window_ms, uint32_t now_ms){
+    duty->probes = probes;
+    duty->n = n;
+    duty->period_ms = period_ms;
+    duty->next_ms = next_ms;
+    duty->results = results;
+    duty->window_ms = window_ms;
+    duty->get_time_us = NULL;
+    duty->windows = 0;
+    duty->samples = 0;
+    duty->failures = 0;
+    duty->awake_us = 0;
+    duty->awake_max_us = 0;
+    duty->transceiver_on_us = 0;
+    for(uint16_t i = 0; i < n; i++){
+        next_ms[i] = now_ms;
+        results[i] = STATUS_ERR;
+    }
+}
+
+probe_status_e photometric_probe_duty_run(probe_duty_t* duty, uint32_t now_ms, uint32_t* wake_ms){
+    // samples due at the wakeup itself are on time, those due up to window_ms later are taken early
+    duty_window_t window = {duty, now_ms + duty->window_ms + 1};
+    uint32_t start_us = (duty->get_time_us != NULL) ? duty->get_time_us() : 0;
+    probe_status_e status = STATUS_OK;
+    uint16_t due = 0;
+    for(uint16_t i = 0; i < duty->n; i++){
+        if(duty_due(&window, i)){
+            duty->results[i] = STATUS_OK;
+            due++;
+        }
+    }
+    if(due){
+        uint8_t powered = duty_power(&window, 1);
+        uint32_t on_us = (duty->get_time_us != NULL) ? duty->get_time_us() : 0;
+        status = run_batch(duty->probes, duty->n, &plan_duty, &handle_duty, &window);
+        uint32_t off_us = (duty->get_time_us != NULL) ? duty->get_time_us() : 0;
+        duty_power(&window, 0);
+        duty->transceiver_on_us += (uint64_t) powered * (off_us - on_us);
+        for(uint16_t i = 0; i < duty->n; i++){
+            if(!duty_due(&window, i)){
+                continue;
+            }
+            if(duty->results[i] != STATUS_OK){
+                duty->failures++;
+            }
+            // samples taken early keep their grid, missed ones are skipped
+            do{
+                duty->next_ms[i] += duty->period_ms[i];
+            }while((int32_t) (duty->next_ms[i] - window.horizon_ms) < 0);
+        }
+        duty->samples += due;
+        duty->windows++;
+        if(duty->get_time_us != NULL){
+            uint32_t awake_us = duty->get_time_us() - start_us;
+            duty->awake_us += awake_us;
+            if(awake_us > duty->awake_max_us){
+                duty->awake_max_us = awake_us;
+            }
+        }
+    }
+    *wake_ms = (duty->n > 0) ? duty->next_ms[0] : now_ms;
+    for(uint16_t i = 1; i < duty->n; i++){
+        if((int32_t) (duty->next_ms[i] - *wake_ms) < 0){
+            *wake_ms = duty->next_ms[i];
+        }
+    }
+    return status;
+}
+
+uint32_t photometric_probe_duty_max_sleep_ms(const probe_duty_t* duty){
+    if(duty->n == 0){
+        return 0;
+    }
+    uint32_t period_ms = duty->period_ms[0];
+    for(uint16_t i = 1; i < duty->n; i++){
+        if(duty->period_ms[i] < period_ms){
+            period_ms = duty->period_ms[i];
+        }
+    }
+    uint32_t window_us = duty->awake_max_us;
+    if(!duty->windows){
+        // buses run concurrently, the window is the one of the slowest bus
+        for(uint16_t i = 0; i < duty->n; i++){
+            if(!is_first_on_bus(duty->probes, i)){
+                continue;
+            }
+            uint32_t bus_us = 0;
+            for(uint16_t j = i; j < duty->n; j = next_on_bus(duty->probes, duty->n, j)){
+                uint8_t reg_addr;
+                uint8_t count;
+                for(uint8_t step = 0; photometric_probe_update_step(&duty->probes[j], step, &reg_addr, &count); step++){
+                    bus_us += photometric_probe_response_timeout_us(duty->probes[j].cfg, count);
+                }
+            }
+            if(bus_us > window_us){
+                window_us = bus_us;
+            }
+        }
+    }
+    uint32_t window_ms = (window_us + 999) / 1000;
+    return (period_ms > window_ms) ? (period_ms - window_ms) : 0;
+}
+
+probe_status_e photometric_probe_command(photometric_probe_obj* obj, const char* cmd, char* rsp, uint8_t rsp_len, uint32_t deadline_us){
+    probe_command_t command = {cmd, rsp, rsp_len, STATUS_ERR};
+    return photometric_probe_command_pipeline(obj, &command, 1, deadline_us);
+}
+
+probe_status_e photometric_probe_command_pipeline(photometric_probe_obj* obj, probe_command_t* cmds, uint8_t n, uint32_t deadline_us){
+    uint8_t depth = (obj->command_depth > 0) ? obj->command_depth : 1;
+    uint8_t sent = 0;
+    uint8_t done = 0;
+    probe_status_e status = STATUS_OK;
+    bus_lock(obj);
+    while((done < n) && (status == STATUS_OK)){
+        // unanswered commands wait for the pipeline to drain, so they keep their place in the sequence
+        while((sent < n) && ((sent - done) < depth) && ((cmds[sent].rsp != NULL) || (sent == done))){
+            if((sent > 0) && (obj->pacing != NULL) && (obj->pacing->current_us > 0)){
+                obj->pacing->delay_us(obj->pacing->current_us);
+            }
+            if(command_send(obj, cmds[sent].cmd) != STATUS_OK){
+                status = STATUS_ERR;
+                break;
+            }
+            if(cmds[sent].rsp == NULL){
+                cmds[done++].status = STATUS_OK;
+            }
+            sent++;
+        }
+        if((status == STATUS_OK) && (done < sent)){
+            status = command_receive(obj, cmds[done].rsp, cmds[done].rsp_len, deadline_us);
+            cmds[done++].status = status;
+        }
+    }
+    bus_unlock(obj);
+    while(done < n){
+        cmds[done++].status = STATUS_ERR;
+    }
+    return status;
+}
+
+void photometric_probe_bus_lock_init(probe_bus_lock_t* lock){
+    lock->next = 0;
+    lock->serving = 0;
+}
+
+void photometric_probe_get_measurements(const photometric_probe_obj* obj, probe_measurements_t* measurements){
+    probe_published_t state;
+    measurements_read(obj, &state);
+    *measurements = state.measurements;
+}
+
+void photometric_probe_set_rx_time(photometric_probe_obj* obj, uint32_t first_us, uint32_t last_us){
+    rx_time_capture(obj, first_us, last_us);
+}
+
+void photometric_probe_rx_complete(const photometric_probe_obj* obj){
+    obj->os->event_signal_from_isr(obj->os->event);
+}
+
+
+static uint16_t ModRTU_CRC(const uint8_t* buf, int len){
+  return crc_update(0xFFFF, buf, len);
+}
+
+
+static uint16_t crc_update(uint16_t crc, const uint8_t* buf, int len){
+  for (int pos = 0; pos < len; pos++) {
+    crc ^= (uint16_t)buf[pos];
+    for (int i = 8; i != 0; i--) {
+      if ((crc & 0x0001) != 0) {
+        crc >>= 1;
+        crc ^= 0xA001;
+      }
+      else
+        crc >>= 1;
+    }
+  }
+  return crc;
+}
+
+
+static uint16_t frame_crc(const photometric_probe_obj* obj, const uint8_t* buf, uint8_t len){
+    if(obj->crc == NULL){
+        return ModRTU_CRC(buf, len);
+    }
+    obj->crc->begin(obj->crc->ctx);
+    obj->crc->update(obj->crc->ctx, buf, len);
+    return obj->crc->finish(obj->crc->ctx);
+}
+
+
+static uint16_t view_crc(const photometric_probe_obj* obj, const probe_frame_view_t* frame, uint16_t len){
+    uint16_t head = (len < frame->len[0]) ? len : frame->len[0];
+    if(obj->crc == NULL){
+        return crc_update(crc_update(0xFFFF, frame->seg[0], head), frame->seg[1], len - head);
+    }
+    obj->crc->begin(obj->crc->ctx);
+    obj->crc->update(obj->crc->ctx, frame->seg[0], head);
+    if(len > head){
+        obj->crc->update(obj->crc->ctx, frame->seg[1], len - head);
+    }
+    return obj->crc->finish(obj->crc->ctx);
+}
+
+
+static uint8_t view_byte(const probe_frame_view_t* frame, uint16_t idx){
+    return (idx < frame->len[0]) ? frame->seg[0][idx] : frame->seg[1][idx - frame->len[0]];
+}
+
+
+static probe_status_e crc_check(const photometric_probe_obj* obj, const uint8_t* buf, uint8_t size){
 	uint16_t crc_to_verify = 0;
-	crc_to_verify = ModRTU_CRC(buf, size - 2);
+	crc_to_verify = frame_crc(obj, buf, size - 2);
 	uint8_t lb_crc = crc_to_verify & 0xFF;
 	uint8_t hb_crc = crc_to_verify >> 8;
 	if(buf[size - 2] == lb_crc && buf[size - 1] == hb_crc){
@@ -202,24 +1280,484 @@ static probe_status_e crc_check(uint8_t* buf, uint8_t size){
 }
 
 
-static probe_status_e read_register(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t* buf){
-	uint8_t buffer[8] = {obj->cfg.address, 0x04, 0x00, reg_addr, 0x00, 0x01};
-	uint16_t crc = ModRTU_CRC(buffer, 6);
-	uint8_t crc_low_byte = crc & 0xFF;
-	uint8_t crc_high_byte = crc >> 8;
-	buffer[6] = crc_low_byte;
-	buffer[7] = crc_high_byte;
+static probe_status_e store_span(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const uint8_t* data){
+    const probe_frame_view_t view = {{data, NULL}, {count * 2, 0}};
+    return store_span_view(obj, reg_addr, count, (data != NULL) ? &view : NULL, 0);
+}
+
+
+static probe_status_e store_span_view(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const probe_frame_view_t* frame, uint16_t offset){
+    const probe_reg_desc_t* regs = probe_regs(obj);
+    const probe_rx_time_t none = {0, 0};
+    if(!measurements_write_begin(obj)){
+        return STATUS_ERR;
+    }
+    for(uint8_t v = 0; v < PROBE_VALUE_COUNT; v++){
+        if(span_holds(obj, reg_addr, count, (probe_value_e) v)){
+            store_value(obj, (probe_value_e) v, frame, offset + (2 * (regs[v].reg_addr - reg_addr)));
+            obj->value_time[v] = (frame != NULL) ? obj->rx_time : none;
+        }
+    }
+    measurements_write_end(obj);
+    return STATUS_OK;
+}
+
+
+static void store_value(photometric_probe_obj* obj, probe_value_e value, const probe_frame_view_t* frame, uint16_t offset){
+    const probe_reg_desc_t* desc = &probe_regs(obj)[value];
+    uint32_t raw = 0;
+    if(frame != NULL){
+        raw = (view_byte(frame, offset) << 8) | view_byte(frame, offset + 1);
+        if(desc->type == PROBE_REG_U32){
+            raw = (raw << 16) | (view_byte(frame, offset + 2) << 8) | view_byte(frame, offset + 3);
+        }
+    }
+    float scaled = (desc->type == PROBE_REG_S16) ? ((float) (int16_t) raw) * desc->scale : ((float) raw) * desc->scale;
+    switch(value){
+        case PROBE_VALUE_CELSIUS:
+            obj->internal_temp_celsius = scaled;
+            break;
+        case PROBE_VALUE_FAHRENHEIT:
+            obj->internal_temp_fahrenheit = scaled;
+            break;
+        case PROBE_VALUE_ILLUMINANCE:
+            // unscaled counts stay exact beyond float precision
+            obj->illuminance = (desc->scale == 1.0f) ? raw : (uint32_t) (scaled + 0.5f);
+            if(obj->cfg.range == HIGH_RANGE){
+                obj->illuminance *= 10;
+            }
+            if(frame != NULL){
+                filter_illuminance(obj, obj->illuminance);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+static const probe_reg_desc_t* probe_regs(const photometric_probe_obj* obj){
+    return (obj->regs != NULL) ? obj->regs : lpphot03_regs;
+}
+
+
+static uint8_t reg_width(const probe_reg_desc_t* desc){
+    return (desc->type == PROBE_REG_U32) ? 2 : 1;
+}
+
+
+static uint8_t span_holds(const photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, probe_value_e value){
+    const probe_reg_desc_t* desc = &probe_regs(obj)[value];
+    return ((desc->reg_addr >= reg_addr) && ((desc->reg_addr + reg_width(desc)) <= (reg_addr + count))) ? 1 : 0;
+}
+
+
+static void filter_predict(illuminance_filter_t* filter, float dt){
+    float q = filter->process_noise;
+    filter->illuminance += filter->rate * dt;
+    filter->var_illuminance += (2 * dt * filter->cov) + (dt * dt * filter->var_rate) + (q * dt * dt * dt / 3);
+    filter->cov += (dt * filter->var_rate) + (q * dt * dt / 2);
+    filter->var_rate += q * dt;
+}
+
+
+static void filter_illuminance(photometric_probe_obj* obj, uint32_t illuminance){
+    if(obj->get_time_us == NULL){
+        return;
+    }
+    illuminance_filter_t* filter = &obj->lux_filter;
+    // dated by the arrival of the response, not by when it got decoded
+    uint32_t now = ((obj->rx_time.first_us != 0) || (obj->rx_time.last_us != 0)) ? obj->rx_time.first_us : obj->get_time_us();
+    // measurement noise from the range resolution, 1 Lux in low range, 10 Lux in high range
+    float r = (obj->cfg.range == HIGH_RANGE) ? 100 : 1;
+    float z = (float) illuminance;
+    if(!filter->samples){
+        filter->illuminance = z;
+        filter->rate = 0;
+        filter->var_illuminance = r;
+        filter->cov = 0;
+        filter->var_rate = PHOTOMETRIC_PROBE_INITIAL_RATE_VAR;
+    }
+    else{
+        filter_predict(filter, ((float) (now - filter->timestamp_us)) / 1000000);
+        float s = filter->var_illuminance + r;
+        float k0 = filter->var_illuminance / s;
+        float k1 = filter->cov / s;
+        float y = z - filter->illuminance;
+        filter->illuminance += k0 * y;
+        filter->rate += k1 * y;
+        filter->var_rate -= k1 * filter->cov;
+        filter->cov -= k0 * filter->cov;
+        filter->var_illuminance -= k0 * filter->var_illuminance;
+    }
+    filter->timestamp_us = now;
+    if(filter->samples < UINT8_MAX){
+        filter->samples++;
+    }
+}
+
+
+static uint32_t probe_time_us(const photometric_probe_obj* obj){
+    return (obj->get_time_us != NULL) ? obj->get_time_us() : 0;
+}
+
+
+static probe_status_e response_check(const photometric_probe_obj* obj, const uint8_t* frame, uint8_t count){
+    if((frame[0] != obj->cfg.address) || (frame[1] != 0x04) || (frame[2] != (count * 2))){
+        return STATUS_ERR;
+    }
+    return crc_check(obj, frame, PHOTOMETRIC_PROBE_RESPONSE_LEN(count));
+}
+
+
+static uint8_t is_first_on_bus(const photometric_probe_obj* probes, uint16_t idx){
+    for(uint16_t i = 0; i < idx; i++){
+        if(probes[i].uart_write == probes[idx].uart_write){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static uint16_t next_on_bus(const photometric_probe_obj* probes, uint16_t n, uint16_t idx){
+    uint16_t i = idx + 1;
+    while((i < n) && (probes[i].uart_write != probes[idx].uart_write)){
+        i++;
+    }
+    return i;
+}
+
+
+static uint8_t plan_step(const photometric_probe_obj* obj, uint32_t values, uint8_t step, read_step_t* read){
+    probe_read_span_t spans[PHOTOMETRIC_PROBE_MAX_SPANS];
+    if(step >= photometric_probe_plan_reads(obj, values, spans)){
+        return 0;
+    }
+    read->reg_addr = spans[step].reg_addr;
+    read->count = spans[step].count;
+    return 1;
+}
+
+
+static void seek_next_transaction(photometric_probe_obj* probes, uint16_t n, step_planner_t plan, void* ctx, bus_cursor_t* cursor){
+    while(cursor->probe < n){
+        if(plan(&probes[cursor->probe], cursor->step, ctx, &cursor->read)){
+            return;
+        }
+        cursor->probe = next_on_bus(probes, n, cursor->probe);
+        cursor->step = 0;
+    }
+}
+
+
+static probe_status_e run_batch(photometric_probe_obj* probes, uint16_t n, step_planner_t plan, step_handler_t handle, void* ctx){
+    probe_status_e status = STATUS_OK;
+    bus_cursor_t buses[PHOTOMETRIC_PROBE_MAX_BUSES];
+    uint16_t scan = 0;
+    // buses are served in passes of at most PHOTOMETRIC_PROBE_MAX_BUSES
+    while(scan < n){
+        uint8_t bus_count = 0;
+        uint16_t next_scan = n;
+        // one walk of the array collects the buses of the pass, probes are matched against the few buses already found
+        for(uint16_t i = scan; i < n; i++){
+            uint8_t known = 0;
+            for(uint8_t b = 0; (b < bus_count) && !known; b++){
+                known = (probes[buses[b].first].uart_write == probes[i].uart_write) ? 1 : 0;
+            }
+            // beyond PHOTOMETRIC_PROBE_MAX_BUSES buses, those of the earlier passes are looked up in the array
+            if(known || ((scan > 0) && !is_first_on_bus(probes, i))){
+                continue;
+            }
+            if(bus_count == PHOTOMETRIC_PROBE_MAX_BUSES){
+                next_scan = i;
+                break;
+            }
+            bus_lock(&probes[i]);
+            buses[bus_count].first = i;
+            buses[bus_count].probe = i;
+            buses[bus_count].step = 0;
+            buses[bus_count].retries = 0;
+            seek_next_transaction(probes, n, plan, ctx, &buses[bus_count]);
+            bus_count++;
+        }
+        scan = next_scan;
+        uint8_t active = bus_count;
+        while(active){
+            // one request in flight on every bus
+            for(uint8_t b = 0; b < bus_count; b++){
+                if(buses[b].probe < n){
+                    receive_start(&probes[buses[b].probe], buses[b].rx, buses[b].read.count);
+                    send_read_request(&probes[buses[b].probe], buses[b].read.reg_addr, buses[b].read.count);
+                }
+            }
+            active = 0;
+            for(uint8_t b = 0; b < bus_count; b++){
+                if(buses[b].probe >= n){
+                    continue;
+                }
+                photometric_probe_obj* obj = &probes[buses[b].probe];
+                if(receive_read_response(obj, buses[b].rx, buses[b].read.count) == STATUS_OK){
+                    handle(obj, buses[b].probe, &buses[b].read, buses[b].rx, ctx);
+                }
+                else if(buses[b].retries < obj->max_retries){
+                    // sent again in the next round
+                    buses[b].retries++;
+                    active++;
+                    continue;
+                }
+                else{
+                    handle(obj, buses[b].probe, &buses[b].read, NULL, ctx);
+                    status = STATUS_ERR;
+                }
+                buses[b].step++;
+                buses[b].retries = 0;
+                seek_next_transaction(probes, n, plan, ctx, &buses[b]);
+                if(buses[b].probe < n){
+                    active++;
+                }
+            }
+        }
+        for(uint8_t b = 0; b < bus_count; b++){
+            bus_unlock(&probes[buses[b].first]);
+        }
+    }
+    return status;
+}
+
+
+static probe_status_e read_span(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, uint8_t* buf){
+    probe_status_e status = STATUS_ERR;
+    bus_lock(obj);
+    for(uint8_t attempt = 0; (attempt <= obj->max_retries) && (status != STATUS_OK); attempt++){
+        receive_start(obj, buf, count);
+        send_read_request(obj, reg_addr, count);
+        status = receive_read_response(obj, buf, count);
+    }
+    bus_unlock(obj);
+    return status;
+}
+
+
+static void send_read_request(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count){
+	uint8_t buffer[PHOTOMETRIC_PROBE_REQUEST_LEN];
+	photometric_probe_encode_read_request(obj, reg_addr, count, buffer);
 	obj->enable_transmission();
     obj->uart_write((const uint8_t*) buffer, 8);
 	obj->disable_transmission();
-	// Receiving buffer will be 7 bytes long, (1 * 2) + 5 initial bytes
-	uint8_t rxBuf[7] = {};
-    obj->uart_read(rxBuf, 7);
-	if(crc_check(rxBuf, 7) != STATUS_OK){
+}
+
+
+static void receive_start(photometric_probe_obj* obj, uint8_t* buf, uint8_t count){
+    if(rx_async(obj)){
+        obj->uart_read_start(buf, PHOTOMETRIC_PROBE_RESPONSE_LEN(count));
+    }
+}
+
+
+static probe_status_e receive_read_response(photometric_probe_obj* obj, uint8_t* buf, uint8_t count){
+	// Receiving buffer will be (count * 2) + 5 initial bytes long
+	uint8_t len = (count * 2) + 5;
+    if(rx_async(obj)){
+        // the task sleeps, the ISR fills buf
+        if(!obj->os->event_wait(obj->os->event, photometric_probe_response_timeout_us(obj->cfg, count))){
+            obj->uart_read_abort();
+            // a completion racing the abort must not wake the next wait
+            obj->os->event_wait(obj->os->event, 0);
+            return STATUS_ERR;
+        }
+        // woken at the last byte, the first one is dated back by the frame duration
+        uint32_t last_us = probe_time_us(obj);
+        rx_time_capture(obj, last_us - ((len - 1) * photometric_probe_char_time_us(obj->cfg)), last_us);
+        return response_check(obj, buf, count);
+    }
+	uint8_t rxBuf[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN] = {};
+    if(receive_frame(obj, rxBuf, len, photometric_probe_response_timeout_us(obj->cfg, count)) != STATUS_OK){
+        return STATUS_ERR;
+    }
+	if(response_check(obj, rxBuf, count) != STATUS_OK){
 		return STATUS_ERR;
 	}
-    for(uint8_t j = 0; j < 7 ; j ++){
+    for(uint8_t j = 0; j < len ; j ++){
         buf[j] = rxBuf[j];
     }
     return STATUS_OK;
-}
\ No newline at end of file
+}
+
+
+static probe_status_e uart_receive(const photometric_probe_obj* obj, uint8_t* buf, uint8_t len, uint32_t timeout_us){
+    if(obj->uart_read_timeout == NULL){
+        obj->uart_read(buf, len);
+        return STATUS_OK;
+    }
+    if(obj->uart_read_timeout(buf, len, timeout_us) == len){
+        return STATUS_OK;
+    }
+    uint8_t drop[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN];
+    obj->uart_read_timeout(drop, sizeof(drop), photometric_probe_frame_gap_us(obj->cfg));
+    return STATUS_ERR;
+}
+
+
+static probe_status_e receive_frame(photometric_probe_obj* obj, uint8_t* buf, uint8_t len, uint32_t timeout_us){
+    if(obj->get_time_us == NULL){
+        rx_time_capture(obj, 0, 0);
+        return uart_receive(obj, buf, len, timeout_us);
+    }
+    uint32_t start_us = obj->get_time_us();
+    if(uart_receive(obj, buf, 1, timeout_us) != STATUS_OK){
+        return STATUS_ERR;
+    }
+    uint32_t first_us = obj->get_time_us();
+    uint32_t elapsed_us = first_us - start_us;
+    if(uart_receive(obj, &buf[1], len - 1, (elapsed_us < timeout_us) ? (timeout_us - elapsed_us) : 0) != STATUS_OK){
+        return STATUS_ERR;
+    }
+    rx_time_capture(obj, first_us, obj->get_time_us());
+    return STATUS_OK;
+}
+
+
+static void rx_time_capture(photometric_probe_obj* obj, uint32_t first_us, uint32_t last_us){
+    if((obj->uart_rx_time != NULL) && obj->uart_rx_time(&obj->rx_time)){
+        return;
+    }
+    obj->rx_time.first_us = first_us;
+    obj->rx_time.last_us = last_us;
+}
+
+
+static uint32_t pacing_trial_us(const probe_pacing_t* pacing){
+    if((pacing->safe_us <= pacing->fail_us) || ((pacing->safe_us - pacing->fail_us) <= PHOTOMETRIC_PROBE_PACING_RESOLUTION_US)){
+        return pacing->safe_us;
+    }
+    return pacing->fail_us + ((pacing->safe_us - pacing->fail_us) / 2);
+}
+
+
+static probe_status_e command_send(const photometric_probe_obj* obj, const char* cmd){
+    uint8_t buf[PHOTOMETRIC_PROBE_COMMAND_LEN + 1];
+    uint8_t len = 0;
+    while(cmd[len] != '\0'){
+        if(len == PHOTOMETRIC_PROBE_COMMAND_LEN){
+            // a truncated command would be another command
+            return STATUS_ERR;
+        }
+        buf[len] = cmd[len];
+        len++;
+    }
+    buf[len++] = '\r';
+    obj->enable_transmission();
+    obj->uart_write(buf, len);
+    obj->disable_transmission();
+    return STATUS_OK;
+}
+
+
+static probe_status_e command_receive(const photometric_probe_obj* obj, char* rsp, uint8_t rsp_len, uint32_t deadline_us){
+    uint8_t len = 0;
+    // bounded by the longest line, so a noisy line cannot hold the bus
+    for(uint8_t i = 0; i <= (2 * PHOTOMETRIC_PROBE_COMMAND_LEN); i++){
+        uint8_t c;
+        if(command_getc(obj, &c, deadline_us) != STATUS_OK){
+            return STATUS_ERR;
+        }
+        if((c == '\r') || (c == '\n')){
+            if(len == 0){
+                continue;
+            }
+            if(len >= rsp_len){
+                return STATUS_ERR;
+            }
+            rsp[len] = '\0';
+            return STATUS_OK;
+        }
+        if(len < rsp_len){
+            rsp[len] = (char) c;
+        }
+        if(len < UINT8_MAX){
+            len++;
+        }
+    }
+    return STATUS_ERR;
+}
+
+
+static probe_status_e command_getc(const photometric_probe_obj* obj, uint8_t* c, uint32_t deadline_us){
+    if((obj->uart_read_timeout == NULL) || (obj->get_time_us == NULL)){
+        obj->uart_read(c, 1);
+        return STATUS_OK;
+    }
+    int32_t remaining_us = (int32_t) (deadline_us - obj->get_time_us());
+    if(remaining_us <= 0){
+        return STATUS_ERR;
+    }
+    return (obj->uart_read_timeout(c, 1, remaining_us) == 1) ? STATUS_OK : STATUS_ERR;
+}
+
+
+static uint8_t rx_async(const photometric_probe_obj* obj){
+    return ((obj->os != NULL) && (obj->os->event_wait != NULL) && (obj->uart_read_start != NULL)) ? 1 : 0;
+}
+
+
+static void bus_lock(const photometric_probe_obj* obj){
+    if(obj->lock != NULL){
+        uint32_t ticket = __atomic_fetch_add(&obj->lock->next, 1, __ATOMIC_RELAXED);
+        while(__atomic_load_n(&obj->lock->serving, __ATOMIC_ACQUIRE) != ticket){
+            if((obj->os != NULL) && (obj->os->yield != NULL)){
+                obj->os->yield();
+            }
+        }
+        return;
+    }
+    if((obj->os != NULL) && (obj->os->mutex_lock != NULL)){
+        obj->os->mutex_lock(obj->os->mutex);
+    }
+}
+
+
+static void bus_unlock(const photometric_probe_obj* obj){
+    if(obj->lock != NULL){
+        // only the owner moves serving forward
+        __atomic_store_n(&obj->lock->serving, obj->lock->serving + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if((obj->os != NULL) && (obj->os->mutex_unlock != NULL)){
+        obj->os->mutex_unlock(obj->os->mutex);
+    }
+}
+
+
+static uint8_t measurements_write_begin(photometric_probe_obj* obj){
+    return (__atomic_exchange_n(&obj->writing, 1, __ATOMIC_ACQUIRE) == 0) ? 1 : 0;
+}
+
+
+static void measurements_write_end(photometric_probe_obj* obj){
+    probe_published_t state;
+    state.measurements.internal_temp_celsius = obj->internal_temp_celsius;
+    state.measurements.internal_temp_fahrenheit = obj->internal_temp_fahrenheit;
+    state.measurements.illuminance = obj->illuminance;
+    for(uint8_t v = 0; v < PROBE_VALUE_COUNT; v++){
+        state.measurements.time[v] = obj->value_time[v];
+    }
+    state.lux_filter = obj->lux_filter;
+    // latch: readers take copy 1 while copy 0 is updated, then copy 0 while copy 1 is
+    for(uint8_t copy = 0; copy < 2; copy++){
+        __atomic_fetch_add(&obj->seq, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        obj->published[copy] = state;
+    }
+    __atomic_store_n(&obj->writing, 0, __ATOMIC_RELEASE);
+}
+
+
+static void measurements_read(const photometric_probe_obj* obj, probe_published_t* published){
+    uint32_t seq;
+    do{
+        seq = __atomic_load_n(&obj->seq, __ATOMIC_ACQUIRE);
+        *published = obj->published[seq & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while(__atomic_load_n(&obj->seq, __ATOMIC_RELAXED) != seq);
+}
@@ -9,9 +9,32 @@
  * 
  */
 
+#ifndef LPPH_H
+#define LPPH_H
 
 #include "stdint.h"
 
+#define PHOTOMETRIC_PROBE_REQUEST_LEN           8 // length of a read input registers request frame
+#define PHOTOMETRIC_PROBE_RESPONSE_LEN(count)   (((count) * 2) + 5) // length of the response to a read of count registers
+#ifndef PHOTOMETRIC_PROBE_MAX_READ_REGS
+#define PHOTOMETRIC_PROBE_MAX_READ_REGS         3 // longest read span, response buffers are sized for it
+#endif
+#define PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN      PHOTOMETRIC_PROBE_RESPONSE_LEN(PHOTOMETRIC_PROBE_MAX_READ_REGS) // response to the longest read span
+#define PHOTOMETRIC_PROBE_MAX_SPANS             PROBE_VALUE_COUNT // most read spans planned for a set of values
+#define PHOTOMETRIC_PROBE_COMMAND_LEN           32 // longest ASCII command or response line, terminator excluded
+
+#ifndef PHOTOMETRIC_PROBE_PACING_MAX_US
+#define PHOTOMETRIC_PROBE_PACING_MAX_US         200000 // worst case delay between configuration commands, used until a shorter one is learned
+#endif
+
+#ifndef PHOTOMETRIC_PROBE_FACTORY_TIMEOUT_US
+#define PHOTOMETRIC_PROBE_FACTORY_TIMEOUT_US    3000000 // longest factory configuration session, with timed reads
+#endif
+
+#ifndef PHOTOMETRIC_PROBE_PACING_RESOLUTION_US
+#define PHOTOMETRIC_PROBE_PACING_RESOLUTION_US  1000 // learning stops once the safe delay is known within this resolution
+#endif
+
 /**
  * @brief List of allowable baudrates for LPPHOT03 probe
  * 
@@ -66,6 +89,168 @@ typedef struct{
     photometric_range_e range; // low or high
 }config_t;
 
+#define PHOTOMETRIC_PROBE_DEFAULT_PROCESS_NOISE     100.0f // default illuminance filter process noise, Lux^2/s^3
+
+/**
+ * @brief Values measured by a probe, a set of values is a mask of PROBE_VALUE_BIT(value)
+ * 
+ */
+typedef enum{
+    PROBE_VALUE_CELSIUS,
+    PROBE_VALUE_FAHRENHEIT,
+    PROBE_VALUE_ILLUMINANCE,
+    PROBE_VALUE_COUNT
+}probe_value_e;
+
+#define PROBE_VALUE_BIT(value)  (1UL << (value))
+#define PROBE_VALUES_ALL        (PROBE_VALUE_BIT(PROBE_VALUE_COUNT) - 1)
+
+/**
+ * @brief Encoding of a value in input registers
+ * 
+ */
+typedef enum{
+    PROBE_REG_U16,
+    PROBE_REG_S16,
+    PROBE_REG_U32 // two registers, high word first
+}probe_reg_type_e;
+
+/**
+ * @brief Descriptor of the input registers holding a value
+ * 
+ */
+typedef struct{
+    uint8_t reg_addr; // first register of the value
+    probe_reg_type_e type;
+    float scale; // value = raw * scale, illuminance is further multiplied by 10 in HIGH_RANGE
+}probe_reg_desc_t;
+
+/**
+ * @brief Contiguous read input registers transaction
+ * 
+ */
+typedef struct{
+    uint8_t reg_addr; // first register read
+    uint8_t count; // number of registers read
+}probe_read_span_t;
+
+/**
+ * @brief Receive time of a response frame, in the time base of get_time_us
+ * 
+ */
+typedef struct{
+    uint32_t first_us; // arrival of the first byte
+    uint32_t last_us; // arrival of the last byte
+}probe_rx_time_t;
+
+/**
+ * @brief Illuminance prediction filter, constant rate Kalman filter fed with every illuminance read
+ * 
+ */
+typedef struct{
+    float illuminance; // filtered illuminance at timestamp_us, Lux
+    float rate; // filtered illuminance rate of change, Lux/s
+    float var_illuminance; // covariance matrix of the state
+    float cov;
+    float var_rate;
+    float process_noise; // how fast illuminance rate may change, higher values follow changes faster but predict with more uncertainty
+    uint32_t timestamp_us; // time of the last filtered sample
+    uint8_t samples; // number of filtered samples, saturates at 255
+}illuminance_filter_t;
+
+/**
+ * @brief Illuminance predicted without bus access
+ * 
+ */
+typedef struct{
+    float illuminance; // predicted illuminance, Lux
+    float uncertainty; // standard deviation of the prediction, Lux
+    uint32_t age_us; // age of the last measured sample
+    uint8_t samples; // number of samples the prediction is based on
+}illuminance_estimate_t;
+
+/**
+ * @brief Optional OS services of a bus, shared by all the probes of the bus
+ * @note With these hooks and uart_read_start set, the calling task sleeps on the event while the response is received 
+ * under interrupt, instead of spinning in uart_read
+ * 
+ */
+typedef struct{
+    void* mutex; // bus lock, taken for every transaction so tasks sharing a bus do not interleave frames
+    void(*mutex_lock)(void* mutex);
+    void(*mutex_unlock)(void* mutex);
+    void* event; // binary semaphore signaled once the response is received
+    uint8_t(*event_wait)(void* event, uint32_t timeout_us); // returns 1 if signaled, 0 on timeout; consumes the signal
+    void(*event_signal_from_isr)(void* event);
+    void(*yield)(void); // optional, lets other tasks run while waiting for a bus lock
+}probe_os_hooks_t;
+
+/**
+ * @brief Fair bus lock, tasks get the bus in arrival order
+ * 
+ */
+typedef struct{
+    uint32_t next; // next ticket handed out
+    uint32_t serving; // ticket owning the bus
+}probe_bus_lock_t;
+
+/**
+ * @brief Consistent copy of the measurements of a probe
+ * 
+ */
+typedef struct{
+    float internal_temp_celsius;
+    float internal_temp_fahrenheit;
+    uint32_t illuminance;
+    probe_rx_time_t time[PROBE_VALUE_COUNT]; // receive time of the response each value was decoded from, indexed by value
+}probe_measurements_t;
+
+/**
+ * @brief State of a probe published to lock-free readers
+ * 
+ */
+typedef struct{
+    probe_measurements_t measurements;
+    illuminance_filter_t lux_filter;
+}probe_published_t;
+
+/**
+ * @brief CRC provider, computes the Modbus CRC (polynomial 0xA001 reflected, initial value 0xFFFF) incrementally, 
+ * typically on a CRC peripheral
+ * @note The driver computes CRCs from the tasks using the probes, a provider shared by several buses must serialize its users
+ * 
+ */
+typedef struct{
+    void* ctx;
+    void(*begin)(void* ctx); // starts a new CRC
+    void(*update)(void* ctx, const uint8_t* buf, uint16_t len);
+    uint16_t(*finish)(void* ctx); // gives the CRC, its low byte is sent first
+}probe_crc_provider_t;
+
+/**
+ * @brief Response frame received in place, e.g. in a circular DMA buffer
+ * 
+ */
+typedef struct{
+    const uint8_t* seg[2]; // frame bytes, the second segment holds the bytes wrapped to the start of a circular buffer
+    uint16_t len[2]; // segment lengths, len[1] is 0 if the frame does not wrap
+}probe_frame_view_t;
+
+/**
+ * @brief Learned delay between configuration commands, one per probe or per firmware version
+ * @note The safe delay is searched by bisection between the longest delay seen to fail and the shortest one verified by a read back
+ * 
+ */
+typedef struct probe_pacing probe_pacing_t;
+struct probe_pacing{
+    uint32_t current_us; // delay between commands in use
+    uint32_t safe_us; // shortest delay verified by a read back
+    uint32_t fail_us; // longest delay seen to fail, 0 if none
+    void(*delay_us)(uint32_t us); // waits us microseconds
+    void(*save)(void* ctx, const probe_pacing_t* pacing); // optional, persists safe_us and fail_us once they change, e.g. in non volatile storage
+    void* ctx;
+};
+
 /**
  * @brief Structure for a photometric probe object, must provide API for uart_write and uart_read in the application code as well as RS485 Enable pin control API
  * 
@@ -80,12 +265,90 @@ typedef struct{
     uint32_t illuminance;
     uint32_t avg_illuminance;
     config_t cfg;
+    uint32_t(*get_time_us)(void); // optional monotonic time source in microseconds, used to timestamp samples
+    uint8_t batched_reads; // set to 1 if the probe answers multi-register reads, 0 by default
+    illuminance_filter_t lux_filter; // illuminance history, updated when get_time_us is set
+    const probe_os_hooks_t* os; // optional OS services, NULL to use the blocking uart_read
+    void(*uart_read_start)(uint8_t* buf, uint8_t len); // optional, starts an interrupt driven reception of len bytes and returns immediately
+    void(*uart_read_abort)(void); // stops a reception started by uart_read_start, required with it
+    probe_bus_lock_t* lock; // optional, fair lock shared by all the probes of a bus, used instead of the OS mutex hooks
+    uint32_t seq; // incremented before each published copy is updated, its low bit gives readers the copy at rest
+    uint8_t writing; // 1 while measurements are written, a writer that preempted another one drops its update instead of waiting
+    probe_published_t published[2]; // copies of the measurements, readers take the one not being updated and never wait for a writer
+    const probe_crc_provider_t* crc; // optional, CRC offload for requests and responses, NULL for the built-in software CRC
+    void(*transceiver_power)(uint8_t on); // optional, powers the RS485 transceiver of the bus on (1) or off (0), returns once it can drive the bus
+    uint8_t(*uart_read_timeout)(uint8_t* buf, uint8_t len, uint32_t timeout_us); // optional, returns the number of bytes read once len bytes arrived or timeout_us elapsed, used instead of uart_read
+    uint8_t max_retries; // retries of a failed read transaction, 0 by default
+    uint8_t command_depth; // ASCII commands the probe buffers, sent ahead of their responses when pipelined, 1 by default
+    probe_pacing_t* pacing; // optional, delay between the commands of a pipeline, learned by photometric_probe_configure
+    const probe_reg_desc_t* regs; // optional register map of a probe variant, PROBE_VALUE_COUNT descriptors indexed by value, NULL for the LPPHOT03 map
+    uint8_t(*uart_rx_time)(probe_rx_time_t* time); // optional, gives the receive time of the last frame as captured by the UART driver (RX ISR or hardware timestamps), returns 0 if unavailable
+    probe_rx_time_t rx_time; // receive time of the response being decoded, set by the receive path
+    probe_rx_time_t value_time[PROBE_VALUE_COUNT]; // receive time of the response each value was decoded from, 0 if the read failed
 }photometric_probe_obj;
 
+/**
+ * @brief Timestamped measurement of a probe
+ * 
+ */
+typedef struct{
+    uint8_t address; // device address
+    probe_status_e status;
+    uint32_t timestamp_us; // time at which the first byte of the illuminance response was received
+    uint32_t illuminance;
+    float internal_temp_celsius;
+}probe_sample_t;
+
+/**
+ * @brief Timing report of a group snapshot
+ * 
+ */
+typedef struct{
+    uint32_t first_us; // timestamp of the earliest illuminance response
+    uint32_t last_us; // timestamp of the latest illuminance response
+    uint32_t skew_us; // achieved skew, last_us - first_us
+    uint16_t failed; // number of probes without illuminance sample
+}snapshot_report_t;
+
+/**
+ * @brief ASCII command of a pipeline
+ * 
+ */
+typedef struct{
+    const char* cmd; // command, without terminator
+    char* rsp; // buffer receiving the response line without terminator, NULL if the command is not answered
+    uint8_t rsp_len; // size of rsp, NUL included
+    probe_status_e status; // set once the command completes
+}probe_command_t;
+
+/**
+ * @brief Duty cycled polling schedule of a group of probes, for battery and solar powered nodes
+ * 
+ */
+typedef struct{
+    photometric_probe_obj* probes;
+    uint16_t n;
+    const uint32_t* period_ms; // sample period of each probe
+    uint32_t* next_ms; // next sample deadline of each probe
+    probe_status_e* results; // status of the last sample of each probe
+    uint32_t window_ms; // samples due at most window_ms after a wakeup are taken early, in the same window
+    uint32_t(*get_time_us)(void); // optional, measures awake and transceiver on times
+    uint32_t windows; // number of wake windows run
+    uint32_t samples; // number of probe samples taken, transceiver_on_us / samples is the transceiver on time per sample
+    uint32_t failures; // number of failed samples
+    uint64_t awake_us; // time spent in wake windows
+    uint32_t awake_max_us; // longest wake window
+    uint64_t transceiver_on_us; // transceiver on time, summed over buses
+}probe_duty_t;
+
 /**
  * @brief Initializes (Factory) LPPHOT03 photometric probe with the given configuration parameters 
  * @note This function should only be called once, after detecting whether the device has previously been configured or not, 
  * this can be a flag set by the application and stored in non volatile storage. If device has already been configured preivously, then the non factory init API must be used.
+ * The probe object is initialized as with photometric_probe_init, then configured with photometric_probe_configure. uart_read_timeout, get_time_us, 
+ * command_depth, pacing, lock, os and crc are kept, call photometric_probe_init first and set the ones needed before the call. With uart_read_timeout and get_time_us, 
+ * the session is abandoned after PHOTOMETRIC_PROBE_FACTORY_TIMEOUT_US when the probe does not answer (wrong baudrate, not in configuration mode), 
+ * otherwise acknowledgements are read with the blocking uart_read.
  * 
  * @param obj: A pointer to a photometric probe object
  * @param cfg: A copy of the configuration structure
@@ -95,8 +358,65 @@ typedef struct{
  */
 probe_status_e photometric_probe_factory_init(photometric_probe_obj* obj, config_t cfg);
 
+/**
+ * @brief Writes a configuration to the probe through its ASCII command channel, then reads it back
+ * @note The session enters user configuration mode, then pipelines the address, baudrate and mode settings and their read backs. 
+ * Optional fields of the probe object are honored, e.g. uart_read_timeout bounds the session by deadline_us. 
+ * With pacing set, uart_read_timeout and get_time_us, every session tries a shorter delay between commands than the safe one until 
+ * it is known within PHOTOMETRIC_PROBE_PACING_RESOLUTION_US. A trial gets half the time left to deadline_us; if it fails, the session 
+ * is run again at the safe delay, and a session failing at the safe delay doubles it. At most two sessions are run, 
+ * none if deadline_us has already passed
+ * 
+ * @param obj: A pointer to an initialized photometric probe object
+ * @param cfg: A copy of the configuration structure
+ * @param deadline_us: time at which the session is abandoned, on the get_time_us clock
+ * @retval STATUS_OK if the configuration read back matches cfg
+ * @retval STATUS_ERR otherwise
+ */
+probe_status_e photometric_probe_configure(photometric_probe_obj* obj, config_t cfg, uint32_t deadline_us);
+
+/**
+ * @brief Sends an ASCII command and receives its response line
+ * @note Commands are terminated by CR, responses end at the first CR or LF. With get_time_us and uart_read_timeout set, 
+ * the exchange gives up at deadline_us, otherwise the response is read with the blocking uart_read
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param cmd: command, without terminator, up to PHOTOMETRIC_PROBE_COMMAND_LEN characters
+ * @param rsp: buffer receiving the response without terminator, NULL if the command is not answered
+ * @param rsp_len: size of rsp, NUL included
+ * @param deadline_us: time at which the exchange is abandoned, on the get_time_us clock
+ * @retval STATUS_OK if the response was received
+ * @retval STATUS_ERR on timeout, if the response does not fit rsp, or if cmd is too long (it is not sent)
+ */
+probe_status_e photometric_probe_command(photometric_probe_obj* obj, const char* cmd, char* rsp, uint8_t rsp_len, uint32_t deadline_us);
+
+/**
+ * @brief Runs a sequence of ASCII commands, sending up to command_depth of them ahead of their responses
+ * @note Commands must be independent of each other's responses. A command which is not answered is sent once all 
+ * previous responses are received, so it orders the pipeline. The sequence stops at the first failure, 
+ * the remaining commands are marked STATUS_ERR. A command longer than PHOTOMETRIC_PROBE_COMMAND_LEN stops it unsent. With pacing set, commands are sent pacing->current_us apart
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param cmds: An array of n commands
+ * @param n: Number of commands
+ * @param deadline_us: time at which the sequence is abandoned, on the get_time_us clock
+ * @retval STATUS_OK if all responses were received
+ * @retval STATUS_ERR otherwise, see the status of each command
+ */
+probe_status_e photometric_probe_command_pipeline(photometric_probe_obj* obj, probe_command_t* cmds, uint8_t n, uint32_t deadline_us);
+
+/**
+ * @brief Initializes a command pacing with the worst case delay, PHOTOMETRIC_PROBE_PACING_MAX_US
+ * @note save and ctx are reset, set them after initialization. To resume learning, restore safe_us and fail_us from storage
+ * 
+ * @param pacing: A pointer to a command pacing object
+ * @param delay_us: waits the given number of microseconds
+ */
+void photometric_probe_pacing_init(probe_pacing_t* pacing, void(*delay_us)(uint32_t us));
+
 /**
  * @brief Initializes probe object
+ * @note Optional fields (get_time_us, batched_reads, os, uart_read_start, uart_read_abort, lock, crc, transceiver_power, uart_read_timeout, max_retries, command_depth, pacing, regs, uart_rx_time) are reset, set them after initialization
  * 
  * @param obj: A pointer to a photometric probe object
  * @return None
@@ -129,6 +449,7 @@ uint32_t photometric_probe_read_illuminance(photometric_probe_obj* obj);
 
 /**
  * @brief Updates illuminance and internal temperature measurements 
+ * @note Probes with batched_reads set are updated in a single read
  * 
  * @param obj: A pointer to a photometric probe object
  * @retval STATUS_OK if measurements succesfully updated
@@ -136,4 +457,258 @@ uint32_t photometric_probe_read_illuminance(photometric_probe_obj* obj);
  */
 probe_status_e photometric_probe_update_measurements(photometric_probe_obj* obj);
 
+/**
+ * @brief Plans the fewest contiguous read transactions covering a set of values
+ * @note On probes with batched_reads set, values are merged into spans of up to PHOTOMETRIC_PROBE_MAX_READ_REGS registers, 
+ * bridging the registers between them when reading these costs less than the framing of another transaction. Other probes get one read per value
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param values: set of values, mask of PROBE_VALUE_BIT
+ * @param spans: planned transactions in ascending register order, PHOTOMETRIC_PROBE_MAX_SPANS long
+ * @return uint8_t: number of planned transactions
+ */
+uint8_t photometric_probe_plan_reads(const photometric_probe_obj* obj, uint32_t values, probe_read_span_t* spans);
+
+/**
+ * @brief Reads a set of values in the transactions planned by photometric_probe_plan_reads, and stores every value their responses hold
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param values: set of values, mask of PROBE_VALUE_BIT
+ * @retval STATUS_OK if all transactions succeeded
+ * @retval STATUS_ERR if a transaction failed, its values are reset to 0
+ */
+probe_status_e photometric_probe_read_values(photometric_probe_obj* obj, uint32_t values);
+
+/**
+ * @brief Updates illuminance and internal temperature measurements of many probes at once
+ * @note Probes sharing the same uart_write API are considered on the same bus. Transactions of a bus are run back-to-back,
+ * while one transaction is kept in flight on every bus at a time, so the wall time is the one of the busiest bus instead of the sum over all probes.
+ * This requires the UART of each bus to buffer received bytes (interrupt or DMA driven reception) while other buses are served.
+ * 
+ * @param probes: An array of n photometric probe objects
+ * @param n: Number of probes
+ * @param results: An array of n statuses, filled with the update status of each probe
+ * @retval STATUS_OK if all probes succesfully updated
+ * @retval STATUS_ERR if at least one probe failed, see results
+ */
+probe_status_e photometric_probe_update_many(photometric_probe_obj* probes, uint16_t n, probe_status_e* results);
+
+/**
+ * @brief Takes an illuminance snapshot of a group of probes, measured as close together in time as possible
+ * @note Illuminance reads of the group are scheduled consecutively with one transaction in flight on every bus, 
+ * splitting the group across buses divides the skew by the number of buses. When temperature is requested, it is read 
+ * in the same transaction on probes with batched_reads set, and after all illuminance reads on other probes.
+ * Each response is timestamped with the get_time_us API of its probe.
+ * 
+ * @param probes: An array of n photometric probe objects
+ * @param n: Number of probes
+ * @param with_temperature: 1 to also read internal temperature in Celsius
+ * @param samples: An array of n samples, filled with the timestamped measurement of each probe
+ * @param report: Timing report of the snapshot
+ * @retval STATUS_OK if all probes succesfully read
+ * @retval STATUS_ERR if at least one transaction failed, see samples
+ */
+probe_status_e photometric_probe_group_snapshot(photometric_probe_obj* probes, uint16_t n, uint8_t with_temperature, probe_sample_t* samples, snapshot_report_t* report);
+
+/**
+ * @brief Predicts illuminance for the current time from the recent samples, without bus access
+ * @note Every illuminance read feeds a constant rate Kalman filter, the prediction extrapolates it to the current time 
+ * and its uncertainty grows with the age of the last sample. Requires the get_time_us API. Lock-free like photometric_probe_get_measurements.
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param estimate: Predicted illuminance, uncertainty and sample age
+ * @retval STATUS_OK if prediction available
+ * @retval STATUS_ERR if no sample has been read yet or probe has no time source
+ */
+probe_status_e photometric_probe_predict_illuminance(const photometric_probe_obj* obj, illuminance_estimate_t* estimate);
+
+/**
+ * @brief Initializes a duty cycled polling schedule, the first samples of all probes are due at now_ms
+ * @note get_time_us is reset, set it after initialization
+ * 
+ * @param duty: A pointer to a duty cycle schedule
+ * @param probes: An array of n photometric probe objects
+ * @param n: Number of probes
+ * @param period_ms: An array of n sample periods in milliseconds, greater than 0
+ * @param next_ms: An array of n deadlines, managed by the schedule
+ * @param results: An array of n statuses, filled with the status of the last sample of each probe
+ * @param window_ms: samples due at most window_ms after a wakeup are taken in the same window, so close deadlines share one wakeup
+ * @param now_ms: current time in milliseconds
+ */
+void photometric_probe_duty_init(probe_duty_t* duty, photometric_probe_obj* probes, uint16_t n, const uint32_t* period_ms, uint32_t* next_ms, probe_status_e* results, uint32_t window_ms, uint32_t now_ms);
+
+/**
+ * @brief Runs one wake window: updates all the probes due, then gives the time at which the node must wake up next
+ * @note The due transactions of all buses are batched as in photometric_probe_update_many. The transceiver of a bus is powered on 
+ * for the window only, and only if one of its probes is due; the MCU and transceivers may sleep until wake_ms. 
+ * Sample deadlines follow a fixed grid, samples missed by a late wakeup are skipped instead of burst.
+ * 
+ * @param duty: A pointer to a duty cycle schedule
+ * @param now_ms: current time in milliseconds
+ * @param wake_ms: next wakeup time in milliseconds
+ * @retval STATUS_OK if all the probes due were updated
+ * @retval STATUS_ERR if at least one probe failed, see results
+ */
+probe_status_e photometric_probe_duty_run(probe_duty_t* duty, uint32_t now_ms, uint32_t* wake_ms);
+
+/**
+ * @brief Estimates the longest sleep the node can take on every cycle with the configured sample periods
+ * @note The shortest period minus the longest wake window measured, or before the first window, the worst case window 
+ * with every probe due and every response arriving at its timeout. Wakeups of all probes coincide when periods are 
+ * multiples of the shortest one, other periods lead to extra windows unless merged by window_ms
+ * 
+ * @param duty: A pointer to a duty cycle schedule
+ * @return uint32_t: sleep time in milliseconds
+ */
+uint32_t photometric_probe_duty_max_sleep_ms(const probe_duty_t* duty);
+
+/**
+ * @brief Converts a baudrate setting to bits per second
+ * 
+ * @param baudrate: baudrate setting
+ * @return uint32_t: baudrate in bits per second
+ */
+uint32_t photometric_probe_baudrate_bps(baudrate_e baudrate);
+
+/**
+ * @brief Computes the time needed to transmit one character with the given configuration
+ * 
+ * @param cfg: A copy of the configuration structure
+ * @return uint32_t: character time in microseconds
+ */
+uint32_t photometric_probe_char_time_us(config_t cfg);
+
+/**
+ * @brief Computes the Modbus RTU inter-frame gap (t3.5) with the given configuration
+ * 
+ * @param cfg: A copy of the configuration structure
+ * @return uint32_t: inter-frame gap in microseconds
+ */
+uint32_t photometric_probe_frame_gap_us(config_t cfg);
+
+/**
+ * @brief Computes how long to wait for the response to a read, from the start of the request transmission
+ * @note Sum of request and response frame times, inter-frame gap and PHOTOMETRIC_PROBE_MAX_TURNAROUND_US
+ * 
+ * @param cfg: A copy of the configuration structure
+ * @param count: number of registers read
+ * @return uint32_t: response timeout in microseconds
+ */
+uint32_t photometric_probe_response_timeout_us(config_t cfg, uint8_t count);
+
+/**
+ * @brief Bounds the time of a read transaction of count registers, retries included, e.g. photometric_probe_read_illuminance with count 1
+ * @note The bound holds in deterministic mode, i.e. with uart_read_timeout or the OS hooks set: every wait then ends at the 
+ * timeout of the timing model and a failed transaction is retried max_retries times at most. Time spent waiting for a bus lock 
+ * held by another task is not included
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param count: number of registers read
+ * @return uint32_t: worst case transaction time in microseconds
+ */
+uint32_t photometric_probe_read_bound_us(const photometric_probe_obj* obj, uint8_t count);
+
+/**
+ * @brief Bounds the time of photometric_probe_update_measurements in deterministic mode
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @return uint32_t: worst case update time in microseconds
+ */
+uint32_t photometric_probe_update_bound_us(const photometric_probe_obj* obj);
+
+/**
+ * @brief Bounds the time of photometric_probe_update_many and photometric_probe_group_snapshot in deterministic mode
+ * @note Assumes every transaction of every bus times out, the time actually taken with several buses is shorter
+ * 
+ * @param probes: An array of n photometric probe objects
+ * @param n: Number of probes
+ * @return uint32_t: worst case batch time in microseconds
+ */
+uint32_t photometric_probe_batch_bound_us(const photometric_probe_obj* probes, uint16_t n);
+
+/**
+ * @brief Gives the read transactions of a measurement update, for applications driving the bus themselves
+ * @note The transactions are planned by photometric_probe_plan_reads for all the values
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param step: index of the transaction, starting at 0
+ * @param reg_addr: first register to read
+ * @param count: number of registers to read
+ * @return uint8_t: 1 if reg_addr and count filled, 0 once the update has no more transactions
+ */
+uint8_t photometric_probe_update_step(const photometric_probe_obj* obj, uint8_t step, uint8_t* reg_addr, uint8_t* count);
+
+/**
+ * @brief Encodes a read input registers request frame
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param reg_addr: first register to read
+ * @param count: number of registers to read
+ * @param frame: buffer of at least PHOTOMETRIC_PROBE_REQUEST_LEN bytes
+ * @return uint8_t: frame length
+ */
+uint8_t photometric_probe_encode_read_request(const photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, uint8_t* frame);
+
+/**
+ * @brief Validates a read input registers response frame and stores its measurements into the probe object
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param reg_addr: first register read by the request
+ * @param count: number of registers read by the request
+ * @param frame: response frame
+ * @param len: response frame length
+ * @retval STATUS_OK if measurements succesfully decoded
+ * @retval STATUS_ERR if frame length, header or CRC invalid, or if the call preempted a write of the probe measurements (e.g. from an ISR), 
+ * the response is then dropped rather than waited for
+ */
+probe_status_e photometric_probe_decode_read_response(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const uint8_t* frame, uint8_t len);
+
+/**
+ * @brief Validates a read input registers response frame received in place and stores its measurements into the probe object
+ * @note The frame is read where it was received, even when it wraps around the end of a circular buffer
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param reg_addr: first register read by the request
+ * @param count: number of registers read by the request
+ * @param frame: response frame, exception responses included
+ * @retval STATUS_OK if measurements succesfully decoded
+ * @retval STATUS_ERR if frame length, header or CRC invalid, exception response, or if the call preempted a write of the probe measurements
+ */
+probe_status_e photometric_probe_decode_read_response_view(photometric_probe_obj* obj, uint8_t reg_addr, uint8_t count, const probe_frame_view_t* frame);
+
+/**
+ * @brief Sets the receive time of a response before it is decoded, for applications driving the bus themselves
+ * @note Without get_time_us, pass 0. The uart_rx_time hook, when it has a capture, takes precedence
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param first_us: arrival of the first byte
+ * @param last_us: arrival of the last byte
+ */
+void photometric_probe_set_rx_time(photometric_probe_obj* obj, uint32_t first_us, uint32_t last_us);
+
+/**
+ * @brief Initializes a fair bus lock, to be shared by all the probes of a bus
+ * @note Waiting tasks spin on the lock, calling the yield OS hook when set
+ * 
+ * @param lock: A pointer to a bus lock
+ */
+void photometric_probe_bus_lock_init(probe_bus_lock_t* lock);
+
+/**
+ * @brief Copies the last measurements of a probe without locking, never waits for the bus
+ * @note Safe to call from any task or ISR while the probe is being updated, the copy never mixes a half written value. 
+ * Measurements are published in two copies, so a reader that preempts a writer takes the previous copy instead of waiting
+ * 
+ * @param obj: A pointer to a photometric probe object
+ * @param measurements: copy of the measurements
+ */
+void photometric_probe_get_measurements(const photometric_probe_obj* obj, probe_measurements_t* measurements);
+
+/**
+ * @brief Wakes the task waiting for a response, to be called by the RX complete ISR once the bytes given to uart_read_start are received
+ * 
+ * @param obj: A pointer to a photometric probe object with OS hooks
+ */
+void photometric_probe_rx_complete(const photometric_probe_obj* obj);
 
+#endif
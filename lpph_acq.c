@@ -0,0 +1,240 @@
+/**
+ * @file lpph_acq.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the interrupt driven periodic acquisition engine of LPPHOT03 photometric probes
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_acq.h"
+#include "stddef.h"
+
+#define US_TO_TICKS(acq, us)        (((us) + (acq)->tick_us - 1) / (acq)->tick_us)
+
+
+/**
+ * @brief Starts the next transaction if the bus is idle and the inter-frame gap elapsed
+ * 
+ * @param acq: pointer to acquisition engine object
+ */
+static void transaction_start(probe_acq_obj* acq);
+
+/**
+ * @brief Ends the transaction in flight, moving to the next transaction of the sample or ending the sample
+ * 
+ * @param acq: pointer to acquisition engine object
+ * @param status: STATUS_OK if the response was decoded
+ */
+static void transaction_done(probe_acq_obj* acq, probe_status_e status);
+
+/**
+ * @brief Ends the sample in progress and pushes it to the ring
+ * 
+ * @param acq: pointer to acquisition engine object
+ * @param status: STATUS_OK if all the transactions of the sample succeeded
+ */
+static void sample_done(probe_acq_obj* acq, probe_status_e status);
+
+/**
+ * @brief Pushes a sample to the ring, counting it as dropped if the ring is full
+ * 
+ * @param acq: pointer to acquisition engine object
+ * @param sample: sample to push
+ */
+static void ring_push(probe_acq_obj* acq, const probe_sample_t* sample);
+
+/**
+ * @brief Dates the response completed in the ISR, its first byte one frame duration before the last
+ * @note Uses the probe get_time_us, or the timer ticks without it
+ * 
+ * @param acq: pointer to acquisition engine object
+ * @param len: response frame length
+ */
+static void rx_stamp(probe_acq_obj* acq, uint16_t len);
+
+
+
+void probe_acq_init(probe_acq_obj* acq, probe_transport_t transport, uint32_t tick_us, probe_sample_t* ring_buf, uint16_t ring_size){
+    acq->transport = transport;
+    acq->channels = NULL;
+    acq->tick = 0;
+    acq->tick_us = tick_us;
+    acq->resume_tick = 0;
+    acq->active = NULL;
+    acq->busy = 0;
+    acq->step = 0;
+    acq->ring.buf = ring_buf;
+    acq->ring.mask = ring_size - 1;
+    acq->ring.head = 0;
+    acq->ring.tail = 0;
+    acq->samples = 0;
+    acq->failures = 0;
+    acq->overruns = 0;
+    acq->dropped = 0;
+}
+
+void probe_acq_add_channel(probe_acq_obj* acq, probe_acq_channel_t* channel, photometric_probe_obj* probe, uint32_t period_ticks){
+    channel->probe = probe;
+    channel->period_ticks = period_ticks;
+    channel->next_tick = acq->tick + 1;
+    channel->pending = 0;
+    channel->next = NULL;
+    // channels due on the same tick are served in the order they were added
+    probe_acq_channel_t** link = &acq->channels;
+    while(*link != NULL){
+        link = &(*link)->next;
+    }
+    *link = channel;
+}
+
+void probe_acq_tick(probe_acq_obj* acq){
+    acq->tick++;
+    for(probe_acq_channel_t* channel = acq->channels; channel != NULL; channel = channel->next){
+        if((int32_t) (acq->tick - channel->next_tick) < 0){
+            continue;
+        }
+        if(channel->pending){
+            acq->overruns++;
+        }
+        channel->pending = 1;
+        // slots follow a fixed grid, late samples do not shift the next ones
+        channel->next_tick += channel->period_ticks;
+    }
+    if(acq->busy && ((int32_t) (acq->tick - acq->deadline_tick) >= 0)){
+        if(acq->active->probe->uart_read_abort != NULL){
+            acq->active->probe->uart_read_abort();
+        }
+        acq->busy = 0;
+        sample_done(acq, STATUS_ERR);
+    }
+    transaction_start(acq);
+}
+
+void probe_acq_rx_complete(probe_acq_obj* acq){
+    if(!acq->busy){
+        return;
+    }
+    rx_stamp(acq, PHOTOMETRIC_PROBE_RESPONSE_LEN(acq->count));
+    transaction_done(acq, photometric_probe_decode_read_response(acq->active->probe, acq->reg_addr, acq->count, acq->rx, PHOTOMETRIC_PROBE_RESPONSE_LEN(acq->count)));
+}
+
+void probe_acq_rx_frame(void* ctx, const probe_frame_view_t* frame){
+    probe_acq_obj* acq = (probe_acq_obj*) ctx;
+    if(!acq->busy){
+        // unsolicited or late frame
+        return;
+    }
+    rx_stamp(acq, frame->len[0] + frame->len[1]);
+    transaction_done(acq, photometric_probe_decode_read_response_view(acq->active->probe, acq->reg_addr, acq->count, frame));
+}
+
+uint8_t probe_acq_read(probe_acq_obj* acq, probe_sample_t* sample){
+    uint32_t tail = acq->ring.tail;
+    if(tail == __atomic_load_n(&acq->ring.head, __ATOMIC_ACQUIRE)){
+        return 0;
+    }
+    *sample = acq->ring.buf[tail & acq->ring.mask];
+    // releases the slot to the ISRs only once copied
+    __atomic_store_n(&acq->ring.tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+static void transaction_done(probe_acq_obj* acq, probe_status_e status){
+    photometric_probe_obj* probe = acq->active->probe;
+    acq->busy = 0;
+    if(status != STATUS_OK){
+        sample_done(acq, STATUS_ERR);
+        return;
+    }
+    acq->step++;
+    acq->resume_tick = acq->tick + US_TO_TICKS(acq, photometric_probe_frame_gap_us(probe->cfg));
+    uint8_t reg_addr;
+    uint8_t count;
+    if(!photometric_probe_update_step(probe, acq->step, &reg_addr, &count)){
+        sample_done(acq, STATUS_OK);
+    }
+}
+
+
+static void transaction_start(probe_acq_obj* acq){
+    if(acq->busy || ((int32_t) (acq->tick - acq->resume_tick) < 0)){
+        return;
+    }
+    if(acq->active == NULL){
+        for(probe_acq_channel_t* channel = acq->channels; channel != NULL; channel = channel->next){
+            if(channel->pending){
+                acq->active = channel;
+                acq->step = 0;
+                break;
+            }
+        }
+        if(acq->active == NULL){
+            return;
+        }
+    }
+    photometric_probe_obj* probe = acq->active->probe;
+    photometric_probe_update_step(probe, acq->step, &acq->reg_addr, &acq->count);
+    uint8_t frame[PHOTOMETRIC_PROBE_REQUEST_LEN];
+    uint8_t len = photometric_probe_encode_read_request(probe, acq->reg_addr, acq->count, frame);
+    // armed before sending so no response byte is missed, circular DMA reception needs no arming
+    if(probe->uart_read_start != NULL){
+        probe->uart_read_start(acq->rx, PHOTOMETRIC_PROBE_RESPONSE_LEN(acq->count));
+    }
+    acq->busy = 1;
+    acq->deadline_tick = acq->tick + US_TO_TICKS(acq, photometric_probe_response_timeout_us(probe->cfg, acq->count)) + 1;
+    if(acq->transport.send(acq->transport.ctx, frame, len) != 0){
+        if(probe->uart_read_abort != NULL){
+            probe->uart_read_abort();
+        }
+        acq->busy = 0;
+        sample_done(acq, STATUS_ERR);
+    }
+}
+
+
+static void sample_done(probe_acq_obj* acq, probe_status_e status){
+    photometric_probe_obj* probe = acq->active->probe;
+    probe_sample_t sample;
+    sample.address = probe->cfg.address;
+    sample.status = status;
+    if(status == STATUS_OK){
+        // arrival of the illuminance response
+        sample.timestamp_us = probe->value_time[PROBE_VALUE_ILLUMINANCE].first_us;
+    }
+    else{
+        sample.timestamp_us = (probe->get_time_us != NULL) ? probe->get_time_us() : (acq->tick * acq->tick_us);
+    }
+    sample.illuminance = (status == STATUS_OK) ? probe->illuminance : 0;
+    sample.internal_temp_celsius = (status == STATUS_OK) ? probe->internal_temp_celsius : 0;
+    acq->active->pending = 0;
+    acq->active = NULL;
+    acq->resume_tick = acq->tick + US_TO_TICKS(acq, photometric_probe_frame_gap_us(probe->cfg));
+    acq->samples++;
+    if(status != STATUS_OK){
+        acq->failures++;
+    }
+    ring_push(acq, &sample);
+}
+
+
+static void ring_push(probe_acq_obj* acq, const probe_sample_t* sample){
+    uint32_t head = acq->ring.head;
+    if((head - __atomic_load_n(&acq->ring.tail, __ATOMIC_ACQUIRE)) > acq->ring.mask){
+        acq->dropped++;
+        return;
+    }
+    acq->ring.buf[head & acq->ring.mask] = *sample;
+    // publishes the sample to the main loop only once written
+    __atomic_store_n(&acq->ring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+static void rx_stamp(probe_acq_obj* acq, uint16_t len){
+    photometric_probe_obj* probe = acq->active->probe;
+    uint32_t last_us = (probe->get_time_us != NULL) ? probe->get_time_us() : (acq->tick * acq->tick_us);
+    photometric_probe_set_rx_time(probe, last_us - ((len - 1) * photometric_probe_char_time_us(probe->cfg)), last_us);
+}
@@ -0,0 +1,123 @@
+/**
+ * @file lpph_acq.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the interrupt driven periodic acquisition engine of LPPHOT03 photometric probes
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_ACQ_H
+#define LPPH_ACQ_H
+
+#include "lpph.h"
+#include "lpph_engine.h"
+
+typedef struct probe_acq_channel probe_acq_channel_t;
+
+/**
+ * @brief Periodically sampled probe of an acquisition engine
+ * 
+ */
+struct probe_acq_channel{
+    photometric_probe_obj* probe; // uart_read_start and uart_read_abort must be set, unless responses come from probe_dma_rx
+    uint32_t period_ticks; // sample period
+    uint32_t next_tick; // next sample slot
+    uint8_t pending; // 1 if the sample of the current slot waits for the bus or is in flight
+    probe_acq_channel_t* next;
+};
+
+/**
+ * @brief Single producer single consumer ring of samples, written by the ISRs and read by the main loop
+ * 
+ */
+typedef struct{
+    probe_sample_t* buf;
+    uint16_t mask; // size - 1, size is a power of 2
+    uint32_t head; // next sample written, owned by the ISRs
+    uint32_t tail; // next sample read, owned by the main loop
+}probe_acq_ring_t;
+
+/**
+ * @brief Structure for an acquisition engine object, one per bus
+ * 
+ */
+typedef struct{
+    probe_transport_t transport; // non blocking send, callable from the timer ISR
+    probe_acq_channel_t* channels;
+    uint32_t tick; // timer ISR count
+    uint32_t tick_us; // timer ISR period
+    uint32_t resume_tick; // tick from which the bus may be used again, after the inter-frame gap or a timeout
+    probe_acq_channel_t* active; // channel with a sample in progress, NULL if none
+    uint8_t busy; // 1 while a transaction is in flight
+    uint8_t step; // transaction of the sample in progress
+    uint8_t reg_addr;
+    uint8_t count;
+    uint8_t rx[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN]; // response in flight, filled by the UART
+    uint32_t deadline_tick; // response timeout of the transaction in flight
+    probe_acq_ring_t ring;
+    uint32_t samples; // number of samples pushed, failed ones included
+    uint32_t failures; // number of samples pushed with STATUS_ERR
+    uint32_t overruns; // number of sample slots skipped because the previous sample of the channel was not done
+    uint32_t dropped; // number of samples lost because the ring was full
+}probe_acq_obj;
+
+/**
+ * @brief Initializes an acquisition engine
+ * 
+ * @param acq: A pointer to an acquisition engine object
+ * @param transport: non blocking transport of the bus, its send function is called from the timer ISR
+ * @param tick_us: period of the timer ISR in microseconds
+ * @param ring_buf: sample ring storage
+ * @param ring_size: number of samples in ring_buf, a power of 2
+ */
+void probe_acq_init(probe_acq_obj* acq, probe_transport_t transport, uint32_t tick_us, probe_sample_t* ring_buf, uint16_t ring_size);
+
+/**
+ * @brief Adds a probe sampled every period_ticks, its first sample is due on the next tick
+ * @note Must be called before the timer is started
+ * 
+ * @param acq: A pointer to an acquisition engine object
+ * @param channel: A pointer to a channel object
+ * @param probe: A pointer to an initialized photometric probe object with uart_read_start and uart_read_abort set, or left NULL with DMA reception
+ * @param period_ticks: sample period in ticks, greater than 0
+ */
+void probe_acq_add_channel(probe_acq_obj* acq, probe_acq_channel_t* channel, photometric_probe_obj* probe, uint32_t period_ticks);
+
+/**
+ * @brief Advances the engine by one tick: schedules due samples, handles timeouts and starts the next transaction
+ * @note To be called from the timer ISR, which must not preempt the UART ISR nor be preempted by it (same priority)
+ * 
+ * @param acq: A pointer to an acquisition engine object
+ */
+void probe_acq_tick(probe_acq_obj* acq);
+
+/**
+ * @brief Completes the transaction in flight, to be called from the UART ISR once the bytes given to uart_read_start are received
+ * 
+ * @param acq: A pointer to an acquisition engine object
+ */
+void probe_acq_rx_complete(probe_acq_obj* acq);
+
+/**
+ * @brief Completes the transaction in flight with a received frame, to be used as on_frame of a DMA receiver with acq as context
+ * @note Called from the UART idle line ISR, frames received while no transaction is in flight are ignored
+ * 
+ * @param ctx: A pointer to an acquisition engine object
+ * @param frame: received frame, read in place
+ */
+void probe_acq_rx_frame(void* ctx, const probe_frame_view_t* frame);
+
+/**
+ * @brief Pops the oldest sample, to be called from the main loop
+ * @note Every sample slot of every channel yields exactly one sample or one overrun, failed samples are pushed with STATUS_ERR
+ * 
+ * @param acq: A pointer to an acquisition engine object
+ * @param sample: oldest sample
+ * @return uint8_t: 1 if a sample was popped, 0 if the ring is empty
+ */
+uint8_t probe_acq_read(probe_acq_obj* acq, probe_sample_t* sample);
+
+#endif
@@ -0,0 +1,364 @@
+/**
+ * @file lpph_arrow.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the Arrow IPC export of probe samples
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * The metadata of each message is a flatbuffer, built front to back: every table is preceded by its vtable,
+ * and every object referenced by a table comes after it, so all offsets are forward.
+ * Columns are written in the native byte order, the schema declares little endian.
+ */
+
+#include "lpph_arrow.h"
+#include "string.h"
+
+#define ARROW_CONTINUATION          0xFFFFFFFF
+#define ARROW_METADATA_V5           4
+#define ARROW_HEADER_SCHEMA         1
+#define ARROW_HEADER_RECORD_BATCH   3
+#define ARROW_TYPE_INT              2
+#define ARROW_TYPE_FLOATING_POINT   3
+#define ARROW_PRECISION_SINGLE      1
+#define ARROW_COLUMNS               4
+#define ARROW_BUFFERS               (2 * ARROW_COLUMNS) // validity and data of each column
+
+#define ALIGN8(len)                 (((len) + 7) & ~((uint32_t) 7))
+
+/**
+ * @brief Flatbuffer under construction
+ * 
+ */
+typedef struct{
+    uint8_t buf[PROBE_ARROW_METADATA_LEN];
+    uint32_t len;
+}fb_builder_t;
+
+/**
+ * @brief Field of the schema
+ * 
+ */
+typedef struct{
+    const char* name;
+    uint8_t nullable;
+    uint8_t type; // ARROW_TYPE_INT or ARROW_TYPE_FLOATING_POINT
+    uint8_t bit_width; // of integers
+}arrow_column_t;
+
+static const arrow_column_t columns[ARROW_COLUMNS] = {
+    {"timestamp_us", 0, ARROW_TYPE_INT, 32},
+    {"address", 0, ARROW_TYPE_INT, 8},
+    {"illuminance", 1, ARROW_TYPE_INT, 32},
+    {"temperature_celsius", 1, ARROW_TYPE_FLOATING_POINT, 32},
+};
+
+static const uint8_t zeros[8];
+
+/**
+ * @brief Writes a little endian scalar into a flatbuffer
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param pos: position of the scalar
+ * @param value: value
+ * @param size: size of the scalar in bytes
+ */
+static void fb_put(fb_builder_t* fb, uint32_t pos, uint64_t value, uint8_t size);
+
+/**
+ * @brief Appends a vtable and its zeroed table, the table is aligned to 8 bytes
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param fields: position of each field in the table, 0 if absent
+ * @param n: number of fields
+ * @param size: size of the table, its vtable offset included
+ * @return uint32_t: position of the table
+ */
+static uint32_t fb_table(fb_builder_t* fb, const uint8_t* fields, uint8_t n, uint8_t size);
+
+/**
+ * @brief Appends a vector, its elements follow the returned length field
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param count: number of elements
+ * @param elem_size: size of an element
+ * @param align: alignment of the elements
+ * @return uint32_t: position of the vector
+ */
+static uint32_t fb_vector(fb_builder_t* fb, uint32_t count, uint8_t elem_size, uint8_t align);
+
+/**
+ * @brief Appends a NUL terminated string
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param str: string
+ * @return uint32_t: position of the string
+ */
+static uint32_t fb_string(fb_builder_t* fb, const char* str);
+
+/**
+ * @brief Points an offset field to an object appended after it
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param field: position of the offset field
+ * @param target: position of the object
+ */
+static void fb_ref(fb_builder_t* fb, uint32_t field, uint32_t target);
+
+/**
+ * @brief Starts the metadata of a message with its Message table, the root of the flatbuffer
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param header_type: ARROW_HEADER_SCHEMA or ARROW_HEADER_RECORD_BATCH
+ * @param body_len: length of the message body
+ * @return uint32_t: position of the header offset field, to be pointed to the header table
+ */
+static uint32_t message_start(fb_builder_t* fb, uint8_t header_type, uint32_t body_len);
+
+/**
+ * @brief Writes the encapsulation prefix and the metadata of a message
+ * 
+ * @param fb: A pointer to a flatbuffer
+ * @param sink: stream sink
+ * @return probe_status_e
+ */
+static probe_status_e message_write(fb_builder_t* fb, const probe_arrow_sink_t* sink);
+
+/**
+ * @brief Appends a sample to a batch with room left
+ * 
+ * @param batch: A pointer to a batch object
+ * @param sample: sample
+ */
+static void batch_push(probe_arrow_batch_t* batch, const probe_sample_t* sample);
+
+
+
+void probe_arrow_batch_init(probe_arrow_batch_t* batch, uint64_t* storage, uint32_t capacity){
+    uint32_t words32 = ((4 * capacity) + 7) / 8;
+    batch->timestamp_us = (uint32_t*) storage;
+    batch->illuminance = (uint32_t*) (storage + words32);
+    batch->temperature_celsius = (float*) (storage + (2 * words32));
+    batch->address = (uint8_t*) (storage + (3 * words32));
+    batch->valid = (uint8_t*) (storage + (3 * words32) + ((capacity + 7) / 8));
+    batch->capacity = capacity;
+    probe_arrow_batch_reset(batch);
+}
+
+void probe_arrow_batch_reset(probe_arrow_batch_t* batch){
+    batch->length = 0;
+    batch->null_count = 0;
+    memset(batch->valid, 0, (batch->capacity + 7) / 8);
+}
+
+uint32_t probe_arrow_append(probe_arrow_batch_t* batch, const probe_sample_t* samples, uint32_t n){
+    uint32_t i;
+    for(i = 0; (i < n) && (batch->length < batch->capacity); i++){
+        batch_push(batch, &samples[i]);
+    }
+    return i;
+}
+
+uint32_t probe_arrow_drain(probe_arrow_batch_t* batch, probe_acq_obj* acq){
+    uint32_t tail = acq->ring.tail;
+    uint32_t head = __atomic_load_n(&acq->ring.head, __ATOMIC_ACQUIRE);
+    uint32_t moved = 0;
+    while((tail != head) && (batch->length < batch->capacity)){
+        batch_push(batch, &acq->ring.buf[tail & acq->ring.mask]);
+        tail++;
+        moved++;
+    }
+    // releases the slots to the ISRs only once copied
+    __atomic_store_n(&acq->ring.tail, tail, __ATOMIC_RELEASE);
+    return moved;
+}
+
+probe_status_e probe_arrow_write_schema(const probe_arrow_sink_t* sink){
+    fb_builder_t fb;
+    uint32_t header = message_start(&fb, ARROW_HEADER_SCHEMA, 0);
+    // endianness left to its default, little endian
+    const uint8_t schema_fields[] = {0, 4};
+    uint32_t schema = fb_table(&fb, schema_fields, sizeof(schema_fields), 8);
+    fb_ref(&fb, header, schema);
+    uint32_t fields = fb_vector(&fb, ARROW_COLUMNS, 4, 4);
+    fb_ref(&fb, schema + 4, fields);
+    for(uint8_t c = 0; c < ARROW_COLUMNS; c++){
+        const arrow_column_t* col = &columns[c];
+        // name, nullable, type_type, type, dictionary, children
+        const uint8_t field_fields[] = {4, 8, 9, 12, 0, 16};
+        uint32_t field = fb_table(&fb, field_fields, sizeof(field_fields), 20);
+        fb_ref(&fb, fields + 4 + (4 * c), field);
+        fb_put(&fb, field + 8, col->nullable, 1);
+        fb_put(&fb, field + 9, col->type, 1);
+        fb_ref(&fb, field + 4, fb_string(&fb, col->name));
+        uint32_t type;
+        if(col->type == ARROW_TYPE_INT){
+            // bitWidth, is_signed
+            const uint8_t int_fields[] = {4, 8};
+            type = fb_table(&fb, int_fields, sizeof(int_fields), 12);
+            fb_put(&fb, type + 4, col->bit_width, 4);
+        }
+        else{
+            // precision
+            const uint8_t float_fields[] = {4};
+            type = fb_table(&fb, float_fields, sizeof(float_fields), 8);
+            fb_put(&fb, type + 4, ARROW_PRECISION_SINGLE, 2);
+        }
+        fb_ref(&fb, field + 12, type);
+        fb_ref(&fb, field + 16, fb_vector(&fb, 0, 4, 4));
+    }
+    return message_write(&fb, sink);
+}
+
+probe_status_e probe_arrow_write_batch(const probe_arrow_batch_t* batch, const probe_arrow_sink_t* sink){
+    uint32_t n = batch->length;
+    // validity buffers are omitted on columns without nulls
+    const uint8_t* valid = batch->null_count ? batch->valid : NULL;
+    uint32_t valid_len = batch->null_count ? ((n + 7) / 8) : 0;
+    const uint8_t* bufs[ARROW_BUFFERS] = {
+        NULL, (const uint8_t*) batch->timestamp_us,
+        NULL, batch->address,
+        valid, (const uint8_t*) batch->illuminance,
+        valid, (const uint8_t*) batch->temperature_celsius,
+    };
+    const uint32_t lens[ARROW_BUFFERS] = {0, 4 * n, 0, n, valid_len, 4 * n, valid_len, 4 * n};
+    const uint32_t null_counts[ARROW_COLUMNS] = {0, 0, batch->null_count, batch->null_count};
+    uint32_t body_len = 0;
+    for(uint8_t b = 0; b < ARROW_BUFFERS; b++){
+        body_len += ALIGN8(lens[b]);
+    }
+    fb_builder_t fb;
+    uint32_t header = message_start(&fb, ARROW_HEADER_RECORD_BATCH, body_len);
+    // length, nodes, buffers
+    const uint8_t batch_fields[] = {8, 4, 16};
+    uint32_t record_batch = fb_table(&fb, batch_fields, sizeof(batch_fields), 24);
+    fb_ref(&fb, header, record_batch);
+    fb_put(&fb, record_batch + 8, n, 8);
+    // FieldNode structs: length, null_count
+    uint32_t nodes = fb_vector(&fb, ARROW_COLUMNS, 16, 8);
+    fb_ref(&fb, record_batch + 4, nodes);
+    for(uint8_t c = 0; c < ARROW_COLUMNS; c++){
+        fb_put(&fb, nodes + 4 + (16 * c), n, 8);
+        fb_put(&fb, nodes + 12 + (16 * c), null_counts[c], 8);
+    }
+    // Buffer structs: offset, length in the body
+    uint32_t buffers = fb_vector(&fb, ARROW_BUFFERS, 16, 8);
+    fb_ref(&fb, record_batch + 16, buffers);
+    uint32_t offset = 0;
+    for(uint8_t b = 0; b < ARROW_BUFFERS; b++){
+        fb_put(&fb, buffers + 4 + (16 * b), offset, 8);
+        fb_put(&fb, buffers + 12 + (16 * b), lens[b], 8);
+        offset += ALIGN8(lens[b]);
+    }
+    if(message_write(&fb, sink) != STATUS_OK){
+        return STATUS_ERR;
+    }
+    // the body, straight from the columns
+    for(uint8_t b = 0; b < ARROW_BUFFERS; b++){
+        uint32_t pad = ALIGN8(lens[b]) - lens[b];
+        if((lens[b] && sink->write(sink->ctx, bufs[b], lens[b])) || (pad && sink->write(sink->ctx, zeros, pad))){
+            return STATUS_ERR;
+        }
+    }
+    return STATUS_OK;
+}
+
+probe_status_e probe_arrow_write_eos(const probe_arrow_sink_t* sink){
+    // continuation marker and an empty metadata
+    const uint8_t eos[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+    return sink->write(sink->ctx, eos, sizeof(eos)) ? STATUS_ERR : STATUS_OK;
+}
+
+
+static void fb_put(fb_builder_t* fb, uint32_t pos, uint64_t value, uint8_t size){
+    for(uint8_t i = 0; i < size; i++){
+        fb->buf[pos + i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+
+static uint32_t fb_table(fb_builder_t* fb, const uint8_t* fields, uint8_t n, uint8_t size){
+    uint32_t vtable_len = 4 + (2 * n);
+    // the vtable ends where the table starts
+    uint32_t vtable = ALIGN8(fb->len + vtable_len) - vtable_len;
+    uint32_t table = vtable + vtable_len;
+    fb_put(fb, vtable, vtable_len, 2);
+    fb_put(fb, vtable + 2, size, 2);
+    for(uint8_t i = 0; i < n; i++){
+        fb_put(fb, vtable + 4 + (2 * i), fields[i], 2);
+    }
+    fb_put(fb, table, table - vtable, 4);
+    fb->len = table + size;
+    return table;
+}
+
+
+static uint32_t fb_vector(fb_builder_t* fb, uint32_t count, uint8_t elem_size, uint8_t align){
+    // the length field is right before the aligned elements
+    uint32_t vector = (((fb->len + 4 + align - 1) / align) * align) - 4;
+    fb_put(fb, vector, count, 4);
+    fb->len = vector + 4 + (count * elem_size);
+    return vector;
+}
+
+
+static uint32_t fb_string(fb_builder_t* fb, const char* str){
+    uint32_t len = strlen(str);
+    uint32_t string = (fb->len + 3) & ~((uint32_t) 3);
+    fb_put(fb, string, len, 4);
+    memcpy(&fb->buf[string + 4], str, len + 1);
+    fb->len = string + 4 + len + 1;
+    return string;
+}
+
+
+static void fb_ref(fb_builder_t* fb, uint32_t field, uint32_t target){
+    fb_put(fb, field, target - field, 4);
+}
+
+
+static uint32_t message_start(fb_builder_t* fb, uint8_t header_type, uint32_t body_len){
+    memset(fb->buf, 0, sizeof(fb->buf));
+    // root offset
+    fb->len = 4;
+    // version, header_type, header, bodyLength
+    const uint8_t message_fields[] = {4, 6, 8, 16};
+    uint32_t message = fb_table(fb, message_fields, sizeof(message_fields), 24);
+    fb_ref(fb, 0, message);
+    fb_put(fb, message + 4, ARROW_METADATA_V5, 2);
+    fb_put(fb, message + 6, header_type, 1);
+    fb_put(fb, message + 16, body_len, 8);
+    return message + 8;
+}
+
+
+static probe_status_e message_write(fb_builder_t* fb, const probe_arrow_sink_t* sink){
+    // the body that follows starts 8 byte aligned
+    uint32_t len = ALIGN8(fb->len);
+    // continuation marker and metadata length, little endian
+    uint64_t marker = ARROW_CONTINUATION | ((uint64_t) len << 32);
+    uint8_t prefix[8];
+    for(uint8_t i = 0; i < sizeof(prefix); i++){
+        prefix[i] = (marker >> (8 * i)) & 0xFF;
+    }
+    if(sink->write(sink->ctx, prefix, sizeof(prefix)) || sink->write(sink->ctx, fb->buf, len)){
+        return STATUS_ERR;
+    }
+    return STATUS_OK;
+}
+
+
+static void batch_push(probe_arrow_batch_t* batch, const probe_sample_t* sample){
+    uint32_t i = batch->length++;
+    batch->timestamp_us[i] = sample->timestamp_us;
+    batch->address[i] = sample->address;
+    batch->illuminance[i] = sample->illuminance;
+    batch->temperature_celsius[i] = sample->internal_temp_celsius;
+    if(sample->status == STATUS_OK){
+        batch->valid[i >> 3] |= 1 << (i & 7);
+    }
+    else{
+        batch->null_count++;
+    }
+}
@@ -0,0 +1,110 @@
+/**
+ * @file lpph_arrow.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the columnar export of probe samples as an Arrow IPC stream
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_ARROW_H
+#define LPPH_ARROW_H
+
+#include "lpph.h"
+#include "lpph_acq.h"
+
+#define PROBE_ARROW_METADATA_LEN    512 // flatbuffer metadata of a message, upper bound
+
+// 8 byte words of storage of a batch of n samples, each column padded to 8 bytes
+#define PROBE_ARROW_BATCH_WORDS(n)  ((3 * (((4 * (n)) + 7) / 8)) + (((n) + 7) / 8) + (((n) + 63) / 64))
+
+/**
+ * @brief Sink of an Arrow IPC stream, e.g. a file or a socket
+ * 
+ */
+typedef struct{
+    int(*write)(void* ctx, const uint8_t* buf, uint32_t len); // returns 0 on success
+    void* ctx;
+}probe_arrow_sink_t;
+
+/**
+ * @brief Columnar batch of samples, each column is a contiguous array written to the stream as is
+ * @note Columns: timestamp_us (uint32), address (uint8), illuminance (uint32) and temperature_celsius (float32).
+ * Illuminance and temperature of failed samples are null, through a shared validity bitmap
+ * 
+ */
+typedef struct{
+    uint32_t* timestamp_us;
+    uint8_t* address;
+    uint32_t* illuminance;
+    float* temperature_celsius;
+    uint8_t* valid; // bit i set if sample i is valid, least significant bit first
+    uint32_t capacity;
+    uint32_t length; // number of samples in the batch
+    uint32_t null_count; // number of failed samples
+}probe_arrow_batch_t;
+
+/**
+ * @brief Initializes an empty batch over caller provided storage
+ * 
+ * @param batch: A pointer to a batch object
+ * @param storage: PROBE_ARROW_BATCH_WORDS(capacity) words
+ * @param capacity: maximum number of samples
+ */
+void probe_arrow_batch_init(probe_arrow_batch_t* batch, uint64_t* storage, uint32_t capacity);
+
+/**
+ * @brief Empties a batch, e.g. once written
+ * 
+ * @param batch: A pointer to a batch object
+ */
+void probe_arrow_batch_reset(probe_arrow_batch_t* batch);
+
+/**
+ * @brief Appends samples to a batch
+ * 
+ * @param batch: A pointer to a batch object
+ * @param samples: An array of n samples
+ * @param n: Number of samples
+ * @return uint32_t: number of samples appended, less than n if the batch is full
+ */
+uint32_t probe_arrow_append(probe_arrow_batch_t* batch, const probe_sample_t* samples, uint32_t n);
+
+/**
+ * @brief Moves the samples of an acquisition ring into a batch, straight from the ring slots
+ * @note To be called from the main loop, in place of probe_acq_read
+ * 
+ * @param batch: A pointer to a batch object
+ * @param acq: A pointer to an acquisition engine object
+ * @return uint32_t: number of samples moved, the ring is empty unless the batch is full
+ */
+uint32_t probe_arrow_drain(probe_arrow_batch_t* batch, probe_acq_obj* acq);
+
+/**
+ * @brief Writes the schema message, which starts an Arrow IPC stream
+ * 
+ * @param sink: stream sink
+ * @return probe_status_e: STATUS_ERR if a write failed
+ */
+probe_status_e probe_arrow_write_schema(const probe_arrow_sink_t* sink);
+
+/**
+ * @brief Writes a batch as a record batch message, its columns are written from the batch storage without copy
+ * 
+ * @param batch: A pointer to a batch object
+ * @param sink: stream sink
+ * @return probe_status_e: STATUS_ERR if a write failed
+ */
+probe_status_e probe_arrow_write_batch(const probe_arrow_batch_t* batch, const probe_arrow_sink_t* sink);
+
+/**
+ * @brief Writes the end of stream marker
+ * 
+ * @param sink: stream sink
+ * @return probe_status_e: STATUS_ERR if a write failed
+ */
+probe_status_e probe_arrow_write_eos(const probe_arrow_sink_t* sink);
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file lpph_crc_sw.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the software reference implementation of the probe CRC provider
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_crc_sw.h"
+
+
+/**
+ * @brief Resets the CRC to the Modbus initial value
+ * 
+ * @param ctx: pointer to software CRC provider object
+ */
+static void crc_begin(void* ctx);
+
+/**
+ * @brief Feeds bytes to the CRC
+ * 
+ * @param ctx: pointer to software CRC provider object
+ * @param buf: bytes
+ * @param len: number of bytes
+ */
+static void crc_update(void* ctx, const uint8_t* buf, uint16_t len);
+
+/**
+ * @brief Gives the CRC of the bytes fed since crc_begin
+ * 
+ * @param ctx: pointer to software CRC provider object
+ * @return uint16_t
+ */
+static uint16_t crc_finish(void* ctx);
+
+
+
+void probe_crc_sw_init(probe_crc_sw_t* sw){
+    sw->crc = 0xFFFF;
+    sw->provider.ctx = sw;
+    sw->provider.begin = &crc_begin;
+    sw->provider.update = &crc_update;
+    sw->provider.finish = &crc_finish;
+}
+
+
+static void crc_begin(void* ctx){
+    ((probe_crc_sw_t*) ctx)->crc = 0xFFFF;
+}
+
+
+static void crc_update(void* ctx, const uint8_t* buf, uint16_t len){
+    probe_crc_sw_t* sw = (probe_crc_sw_t*) ctx;
+    uint16_t crc = sw->crc;
+    for(uint16_t pos = 0; pos < len; pos++){
+        crc ^= buf[pos];
+        for(uint8_t i = 0; i < 8; i++){
+            crc = (crc & 0x0001) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    sw->crc = crc;
+}
+
+
+static uint16_t crc_finish(void* ctx){
+    return ((probe_crc_sw_t*) ctx)->crc;
+}
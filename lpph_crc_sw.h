@@ -0,0 +1,33 @@
+/**
+ * @file lpph_crc_sw.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the software reference implementation of the probe CRC provider
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_CRC_SW_H
+#define LPPH_CRC_SW_H
+
+#include "lpph.h"
+
+/**
+ * @brief Software CRC provider, a model of the begin/update/finish sequence expected from CRC peripherals
+ * 
+ */
+typedef struct{
+    uint16_t crc; // CRC in progress
+    probe_crc_provider_t provider; // to be set as the crc field of the probes
+}probe_crc_sw_t;
+
+/**
+ * @brief Initializes a software CRC provider
+ * 
+ * @param sw: A pointer to a software CRC provider object
+ */
+void probe_crc_sw_init(probe_crc_sw_t* sw);
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * @file lpph_dma_rx.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the reference design of a circular DMA reception framed by UART idle line detection
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_dma_rx.h"
+
+
+
+void probe_dma_rx_init(probe_dma_rx_t* rx, const uint8_t* buf, uint16_t size, void(*on_frame)(void* ctx, const probe_frame_view_t* frame), void* ctx){
+    rx->buf = buf;
+    rx->size = size;
+    rx->read_pos = 0;
+    rx->on_frame = on_frame;
+    rx->ctx = ctx;
+    rx->frames = 0;
+    rx->overflows = 0;
+}
+
+void probe_dma_rx_idle(probe_dma_rx_t* rx, uint16_t write_pos){
+    if(write_pos >= rx->size){
+        // the DMA reloads its counter when the buffer wraps
+        write_pos = 0;
+    }
+    if(write_pos == rx->read_pos){
+        return;
+    }
+    probe_frame_view_t frame;
+    frame.seg[0] = &rx->buf[rx->read_pos];
+    if(write_pos > rx->read_pos){
+        frame.len[0] = write_pos - rx->read_pos;
+        frame.seg[1] = rx->buf;
+        frame.len[1] = 0;
+    }
+    else{
+        // the frame wraps, its tail is at the start of the buffer
+        frame.len[0] = rx->size - rx->read_pos;
+        frame.seg[1] = rx->buf;
+        frame.len[1] = write_pos;
+    }
+    if((frame.len[0] + frame.len[1]) > PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN){
+        // longer than any response, the DMA may have lapped unread bytes
+        rx->overflows++;
+    }
+    rx->read_pos = write_pos;
+    rx->frames++;
+    rx->on_frame(rx->ctx, &frame);
+}
+
+uint32_t probe_dma_rx_timeout_bits(config_t cfg){
+    uint32_t bps = photometric_probe_baudrate_bps(cfg.baudrate);
+    return (uint32_t) ((((uint64_t) photometric_probe_frame_gap_us(cfg) * bps) + 999999) / 1000000);
+}
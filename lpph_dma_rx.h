@@ -0,0 +1,60 @@
+/**
+ * @file lpph_dma_rx.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the reference design of a circular DMA reception framed by UART idle line detection
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_DMA_RX_H
+#define LPPH_DMA_RX_H
+
+#include "lpph.h"
+
+/**
+ * @brief Circular DMA reception of a bus
+ * @note The DMA writes the RX buffer continuously; the idle line or receiver timeout interrupt delimits frames, 
+ * which are handed over where the DMA wrote them
+ * 
+ */
+typedef struct{
+    const uint8_t* buf; // circular DMA buffer
+    uint16_t size;
+    uint16_t read_pos; // start of the next frame
+    void(*on_frame)(void* ctx, const probe_frame_view_t* frame); // called from the interrupt, the frame is valid until it returns
+    void* ctx;
+    uint32_t frames; // number of frames delimited
+    uint32_t overflows; // number of times the DMA lapped unread bytes
+}probe_dma_rx_t;
+
+/**
+ * @brief Initializes a circular DMA reception, the DMA must be started on buf in circular mode
+ * 
+ * @param rx: A pointer to a DMA reception object
+ * @param buf: DMA buffer, larger than the longest response
+ * @param size: DMA buffer size
+ * @param on_frame: frame handler, e.g. probe_acq_rx_frame
+ * @param ctx: frame handler context
+ */
+void probe_dma_rx_init(probe_dma_rx_t* rx, const uint8_t* buf, uint16_t size, void(*on_frame)(void* ctx, const probe_frame_view_t* frame), void* ctx);
+
+/**
+ * @brief Delimits the frame received since the previous one, to be called from the idle line or receiver timeout interrupt
+ * 
+ * @param rx: A pointer to a DMA reception object
+ * @param write_pos: DMA write position in buf, i.e. size minus the DMA remaining transfer count
+ */
+void probe_dma_rx_idle(probe_dma_rx_t* rx, uint16_t write_pos);
+
+/**
+ * @brief Gives the receiver timeout matching the Modbus inter-frame gap t3.5, for UARTs counting it in bit times
+ * 
+ * @param cfg: probe configuration (baudrate and mode)
+ * @return uint32_t: receiver timeout in bit times
+ */
+uint32_t probe_dma_rx_timeout_bits(config_t cfg);
+
+#endif
@@ -0,0 +1,294 @@
+/**
+ * @file lpph_engine.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the bus engine polling fleets of LPPHOT03 photometric probes
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_engine.h"
+#include "stddef.h"
+
+#define US_TO_MS(us)                (((us) + 999) / 1000)
+
+
+/**
+ * @brief Poll deadline or retry backoff of a probe expired, queues it on its bus
+ * 
+ * @param arg: pointer to polled probe object
+ */
+static void node_due(void* arg);
+
+/**
+ * @brief Response timeout or inter-frame gap of a bus expired
+ * 
+ * @param arg: pointer to bus object
+ */
+static void bus_timer_expired(void* arg);
+
+/**
+ * @brief Starts the next queued transaction if the bus is idle
+ * 
+ * @param bus: pointer to bus object
+ */
+static void bus_kick(probe_bus_obj* bus);
+
+/**
+ * @brief Ends the transaction in flight and releases the bus after the inter-frame gap
+ * 
+ * @param bus: pointer to bus object
+ * @param status: STATUS_OK if the response was decoded, STATUS_ERR on timeout, invalid frame or send failure
+ */
+static void bus_complete(probe_bus_obj* bus, probe_status_e status);
+
+/**
+ * @brief Ends the update of a probe and arms its next poll
+ * 
+ * @param node: pointer to polled probe object
+ * @param status: update status
+ */
+static void node_finish(probe_node_obj* node, probe_status_e status);
+
+/**
+ * @brief Queues a probe on its bus
+ * 
+ * @param node: pointer to polled probe object
+ * @param front: 1 to queue in front, so the transactions of an update run back-to-back
+ */
+static void bus_enqueue(probe_node_obj* node, uint8_t front);
+
+
+
+void probe_engine_init(probe_engine_obj* engine, uint32_t now_ms){
+    probe_wheel_init(&engine->wheel, now_ms);
+    engine->now_ms = now_ms;
+    engine->buses = NULL;
+}
+
+void probe_engine_add_bus(probe_engine_obj* engine, probe_bus_obj* bus, probe_transport_t transport){
+    bus->transport = transport;
+    bus->engine = engine;
+    bus->state = BUS_IDLE;
+    bus->head = NULL;
+    bus->tail = NULL;
+    bus->active = NULL;
+    bus->nodes = NULL;
+    bus->rx_len = 0;
+    bus->rx_expected = 0;
+    bus->transactions = 0;
+    bus->failures = 0;
+    bus->latency_ms = 0;
+    bus->disconnects = 0;
+    probe_timer_init(&bus->timer, &bus_timer_expired, bus);
+    bus->next = engine->buses;
+    engine->buses = bus;
+}
+
+void probe_engine_add_probe(probe_node_obj* node, probe_bus_obj* bus, photometric_probe_obj* probe, uint32_t period_ms){
+    probe_engine_obj* engine = bus->engine;
+    node->probe = probe;
+    node->bus = bus;
+    node->period_ms = period_ms;
+    node->next_poll_ms = engine->now_ms;
+    node->step = 0;
+    node->retries = 0;
+    node->status = STATUS_ERR;
+    node->on_update = NULL;
+    node->next = NULL;
+    node->sibling = bus->nodes;
+    bus->nodes = node;
+    probe_timer_init(&node->timer, &node_due, node);
+    probe_wheel_arm(&engine->wheel, &node->timer, node->next_poll_ms);
+}
+
+void probe_engine_process(probe_engine_obj* engine, uint32_t now_ms){
+    engine->now_ms = now_ms;
+    probe_wheel_advance(&engine->wheel, now_ms);
+}
+
+uint8_t probe_engine_next_deadline(const probe_engine_obj* engine, uint32_t* deadline_ms){
+    return probe_wheel_next_expiry(&engine->wheel, deadline_ms);
+}
+
+void probe_engine_bus_down(probe_bus_obj* bus){
+    probe_engine_obj* engine = bus->engine;
+    if(bus->state == BUS_DOWN){
+        return;
+    }
+    bus->state = BUS_DOWN;
+    bus->disconnects++;
+    bus->active = NULL;
+    bus->head = NULL;
+    bus->tail = NULL;
+    probe_wheel_cancel(&engine->wheel, &bus->timer);
+    // nothing stays armed for the bus, an outage costs no wakeups
+    for(probe_node_obj* node = bus->nodes; node != NULL; node = node->sibling){
+        probe_wheel_cancel(&engine->wheel, &node->timer);
+        node->next = NULL;
+        node->step = 0;
+        node->retries = 0;
+        node->status = STATUS_ERR;
+    }
+    for(probe_node_obj* node = bus->nodes; node != NULL; node = node->sibling){
+        if(node->on_update != NULL){
+            node->on_update(node, STATUS_ERR);
+        }
+    }
+}
+
+void probe_engine_bus_up(probe_bus_obj* bus){
+    probe_engine_obj* engine = bus->engine;
+    if(bus->state != BUS_DOWN){
+        return;
+    }
+    bus->state = BUS_IDLE;
+    bus->rx_len = 0;
+    for(probe_node_obj* node = bus->nodes; node != NULL; node = node->sibling){
+        node->next_poll_ms = engine->now_ms;
+        probe_wheel_arm(&engine->wheel, &node->timer, node->next_poll_ms);
+    }
+}
+
+void probe_engine_bus_receive(probe_bus_obj* bus, const uint8_t* data, uint16_t len){
+    uint32_t rx_us = 0;
+    if((bus->state == BUS_BUSY) && (bus->active->probe->get_time_us != NULL)){
+        rx_us = bus->active->probe->get_time_us();
+    }
+    probe_engine_bus_receive_at(bus, data, len, rx_us);
+}
+
+void probe_engine_bus_receive_at(probe_bus_obj* bus, const uint8_t* data, uint16_t len, uint32_t rx_us){
+    for(uint16_t i = 0; (i < len) && (bus->state == BUS_BUSY); i++){
+        // bytes of a chunk arrived back to back, one character time apart, ending at rx_us
+        uint32_t byte_us = rx_us - ((len - 1 - i) * photometric_probe_char_time_us(bus->active->probe->cfg));
+        if(bus->rx_len == 0){
+            bus->rx_time.first_us = byte_us;
+        }
+        bus->rx_time.last_us = byte_us;
+        bus->rx[bus->rx_len++] = data[i];
+        // exception responses are 5 bytes long
+        if((bus->rx_len == 2) && (bus->rx[1] & 0x80)){
+            bus->rx_expected = PHOTOMETRIC_PROBE_RESPONSE_LEN(0);
+        }
+        if(bus->rx_len == bus->rx_expected){
+            photometric_probe_set_rx_time(bus->active->probe, bus->rx_time.first_us, bus->rx_time.last_us);
+            probe_status_e status = photometric_probe_decode_read_response(bus->active->probe, bus->reg_addr, bus->count, bus->rx, bus->rx_len);
+            bus_complete(bus, status);
+        }
+    }
+}
+
+
+static void node_due(void* arg){
+    probe_node_obj* node = (probe_node_obj*) arg;
+    bus_enqueue(node, 0);
+    bus_kick(node->bus);
+}
+
+
+static void bus_timer_expired(void* arg){
+    probe_bus_obj* bus = (probe_bus_obj*) arg;
+    if(bus->state == BUS_BUSY){
+        // response timeout
+        bus_complete(bus, STATUS_ERR);
+        return;
+    }
+    bus->state = BUS_IDLE;
+    bus_kick(bus);
+}
+
+
+static void bus_kick(probe_bus_obj* bus){
+    if((bus->state != BUS_IDLE) || (bus->head == NULL)){
+        return;
+    }
+    probe_node_obj* node = bus->head;
+    bus->head = node->next;
+    if(bus->head == NULL){
+        bus->tail = NULL;
+    }
+    node->next = NULL;
+    if(!photometric_probe_update_step(node->probe, node->step, &bus->reg_addr, &bus->count)){
+        node_finish(node, STATUS_OK);
+        bus_kick(bus);
+        return;
+    }
+    uint8_t frame[PHOTOMETRIC_PROBE_REQUEST_LEN];
+    uint8_t len = photometric_probe_encode_read_request(node->probe, bus->reg_addr, bus->count, frame);
+    bus->active = node;
+    bus->rx_len = 0;
+    bus->rx_expected = PHOTOMETRIC_PROBE_RESPONSE_LEN(bus->count);
+    bus->state = BUS_BUSY;
+    bus->transactions++;
+    if(bus->transport.send(bus->transport.ctx, frame, len) != 0){
+        bus_complete(bus, STATUS_ERR);
+        return;
+    }
+    uint32_t timeout_ms = US_TO_MS(photometric_probe_response_timeout_us(node->probe->cfg, bus->count)) + bus->latency_ms + 1;
+    probe_wheel_arm(&bus->engine->wheel, &bus->timer, bus->engine->now_ms + timeout_ms);
+}
+
+
+static void bus_complete(probe_bus_obj* bus, probe_status_e status){
+    probe_engine_obj* engine = bus->engine;
+    probe_node_obj* node = bus->active;
+    bus->active = NULL;
+    if(status == STATUS_OK){
+        node->step++;
+        node->retries = 0;
+        bus_enqueue(node, 1);
+    }
+    else{
+        bus->failures++;
+        if(node->retries < PROBE_ENGINE_MAX_RETRIES){
+            // the bus serves other probes during the backoff
+            probe_wheel_arm(&engine->wheel, &node->timer, engine->now_ms + (PROBE_ENGINE_BACKOFF_MS << node->retries));
+            node->retries++;
+        }
+        else{
+            node_finish(node, STATUS_ERR);
+        }
+    }
+    bus->state = BUS_GAP;
+    probe_wheel_arm(&engine->wheel, &bus->timer, engine->now_ms + US_TO_MS(photometric_probe_frame_gap_us(node->probe->cfg)));
+}
+
+
+static void node_finish(probe_node_obj* node, probe_status_e status){
+    probe_engine_obj* engine = node->bus->engine;
+    node->status = status;
+    node->step = 0;
+    node->retries = 0;
+    // skip the polls missed by an overrun instead of bursting them
+    do{
+        node->next_poll_ms += node->period_ms;
+    }while((int32_t) (node->next_poll_ms - engine->now_ms) < 0);
+    probe_wheel_arm(&engine->wheel, &node->timer, node->next_poll_ms);
+    if(node->on_update != NULL){
+        node->on_update(node, status);
+    }
+}
+
+
+static void bus_enqueue(probe_node_obj* node, uint8_t front){
+    probe_bus_obj* bus = node->bus;
+    if(front){
+        node->next = bus->head;
+        bus->head = node;
+        if(bus->tail == NULL){
+            bus->tail = node;
+        }
+        return;
+    }
+    node->next = NULL;
+    if(bus->tail != NULL){
+        bus->tail->next = node;
+    }
+    else{
+        bus->head = node;
+    }
+    bus->tail = node;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file lpph_engine.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the bus engine polling fleets of LPPHOT03 photometric probes over non blocking transports
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_ENGINE_H
+#define LPPH_ENGINE_H
+
+#include "lpph.h"
+#include "lpph_wheel.h"
+
+#ifndef PROBE_ENGINE_MAX_RETRIES
+#define PROBE_ENGINE_MAX_RETRIES    2 // retries of a failed transaction before the update is reported as failed
+#endif
+
+#ifndef PROBE_ENGINE_BACKOFF_MS
+#define PROBE_ENGINE_BACKOFF_MS     10 // delay before the first retry, doubled on every further retry
+#endif
+
+/**
+ * @brief State of a bus
+ * 
+ */
+typedef enum{
+    BUS_IDLE,
+    BUS_BUSY, // transaction in flight, waiting for the response
+    BUS_GAP, // response received, waiting for the inter-frame gap
+    BUS_DOWN // transport disconnected, probes are not polled
+}probe_bus_state_e;
+
+/**
+ * @brief Non blocking transport of a bus, must be provided by the application
+ * @note send queues a frame for transmission and returns immediately (RS485 direction control included),
+ * received bytes are pushed to the engine with probe_engine_bus_receive
+ * 
+ */
+typedef struct{
+    int(*send)(void* ctx, const uint8_t* buf, uint8_t len); // returns 0 on success
+    void* ctx;
+}probe_transport_t;
+
+typedef struct probe_node probe_node_obj;
+typedef struct probe_bus probe_bus_obj;
+typedef struct probe_engine probe_engine_obj;
+
+/**
+ * @brief Structure for a bus object, shared by all the probes of a RS485 line
+ * 
+ */
+struct probe_bus{
+    probe_transport_t transport;
+    probe_engine_obj* engine;
+    probe_bus_state_e state;
+    probe_node_obj* head; // probes waiting for the bus, in order
+    probe_node_obj* tail;
+    probe_node_obj* active; // probe with a transaction in flight
+    probe_node_obj* nodes; // all the probes of the bus
+    uint8_t reg_addr; // transaction in flight
+    uint8_t count;
+    uint8_t rx[PHOTOMETRIC_PROBE_MAX_RESPONSE_LEN];
+    uint8_t rx_len;
+    uint8_t rx_expected;
+    probe_rx_time_t rx_time; // arrival of the first and last bytes of the response in flight
+    probe_timer_t timer; // response timeout or inter-frame gap
+    uint32_t transactions; // number of transactions run
+    uint32_t failures; // number of failed transactions, timeouts included
+    uint32_t latency_ms; // delivery latency of the transport (e.g. USB adapter buffering), added to response timeouts
+    uint32_t disconnects; // number of times the transport was lost
+    probe_bus_obj* next;
+};
+
+/**
+ * @brief Structure for a polled probe, links a photometric probe object to its bus and poll schedule
+ * 
+ */
+struct probe_node{
+    photometric_probe_obj* probe;
+    probe_bus_obj* bus;
+    uint32_t period_ms; // poll period
+    uint32_t next_poll_ms; // poll deadline, advanced by period_ms on every update so polls do not drift
+    probe_timer_t timer; // poll deadline or retry backoff
+    uint8_t step; // transaction of the update in progress
+    uint8_t retries; // retries of the transaction in progress
+    probe_status_e status; // status of the last update
+    void(*on_update)(probe_node_obj* node, probe_status_e status); // optional, called once an update completes
+    probe_node_obj* next;
+    probe_node_obj* sibling; // next probe of the bus
+};
+
+/**
+ * @brief Structure for a bus engine object
+ * 
+ */
+struct probe_engine{
+    probe_wheel_t wheel; // poll deadlines, retries, backoffs and timeouts, 1 ms ticks
+    uint32_t now_ms;
+    probe_bus_obj* buses;
+};
+
+/**
+ * @brief Initializes a bus engine
+ * 
+ * @param engine: A pointer to a bus engine object
+ * @param now_ms: current time in milliseconds
+ */
+void probe_engine_init(probe_engine_obj* engine, uint32_t now_ms);
+
+/**
+ * @brief Adds a bus to the engine
+ * 
+ * @param engine: A pointer to a bus engine object
+ * @param bus: A pointer to a bus object
+ * @param transport: non blocking transport of the bus
+ */
+void probe_engine_add_bus(probe_engine_obj* engine, probe_bus_obj* bus, probe_transport_t transport);
+
+/**
+ * @brief Adds an initialized probe to a bus, its first poll is due immediately
+ * @note on_update is reset, set it after adding the probe
+ * 
+ * @param node: A pointer to a polled probe object
+ * @param bus: A pointer to a bus object added to the engine
+ * @param probe: A pointer to a photometric probe object
+ * @param period_ms: poll period in milliseconds, greater than 0
+ */
+void probe_engine_add_probe(probe_node_obj* node, probe_bus_obj* bus, photometric_probe_obj* probe, uint32_t period_ms);
+
+/**
+ * @brief Runs poll deadlines, timeouts and retries due up to now
+ * 
+ * @param engine: A pointer to a bus engine object
+ * @param now_ms: current time in milliseconds
+ */
+void probe_engine_process(probe_engine_obj* engine, uint32_t now_ms);
+
+/**
+ * @brief Gives the time at which probe_engine_process must be called next
+ * 
+ * @param engine: A pointer to a bus engine object
+ * @param deadline_ms: next deadline in milliseconds, may be early but never late
+ * @return uint8_t: 1 if a deadline is pending, 0 otherwise
+ */
+uint8_t probe_engine_next_deadline(const probe_engine_obj* engine, uint32_t* deadline_ms);
+
+/**
+ * @brief Marks the transport of a bus as lost, other buses are not affected
+ * @note The transaction in flight is dropped and the polls of the bus are suspended, 
+ * on_update is called with STATUS_ERR for every probe of the bus so their values are known stale
+ * 
+ * @param bus: A pointer to a bus object
+ */
+void probe_engine_bus_down(probe_bus_obj* bus);
+
+/**
+ * @brief Marks the transport of a bus as restored
+ * @note Every probe of the bus is polled immediately to re-validate it, then resumes its poll period
+ * 
+ * @param bus: A pointer to a bus object down
+ */
+void probe_engine_bus_up(probe_bus_obj* bus);
+
+/**
+ * @brief Pushes bytes received on a bus to the engine
+ * @note Received bytes are dated by the active probe get_time_us, 0 without it
+ * 
+ * @param bus: A pointer to a bus object
+ * @param data: received bytes
+ * @param len: number of received bytes
+ */
+void probe_engine_bus_receive(probe_bus_obj* bus, const uint8_t* data, uint16_t len);
+
+/**
+ * @brief Pushes bytes received on a bus to the engine, with the time they arrived
+ * @note Use when the transport gives receive timestamps, or with the time a poll returned them.
+ * The bytes of the chunk are dated back from rx_us by one character time each
+ * 
+ * @param bus: A pointer to a bus object
+ * @param data: received bytes
+ * @param len: number of received bytes
+ * @param rx_us: arrival of the last byte of the chunk, in the time base of the probes get_time_us
+ */
+void probe_engine_bus_receive_at(probe_bus_obj* bus, const uint8_t* data, uint16_t len, uint32_t rx_us);
+
+#endif
@@ -0,0 +1,1008 @@
+/**
+ * @file lpph_linux.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the Linux serial port backend of the probe bus engine
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "lpph_linux.h"
+#include "stddef.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "termios.h"
+#include "time.h"
+#include "sys/epoll.h"
+#include "sys/timerfd.h"
+#include "sys/ioctl.h"
+#include "linux/serial.h"
+#include "string.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "limits.h"
+
+#define US_TO_MS(us)                (((us) + 999) / 1000)
+#define LATENCY_TIMER_MS            1 // lowest latency timer accepted by FTDI adapters
+
+#ifdef PROBE_LINUX_IO_URING
+#include "linux/io_uring.h"
+#include "sys/mman.h"
+#include "poll.h"
+#include "sys/syscall.h"
+
+// completion owner, stored in the low bits of user_data
+#define URING_TAG_READ              0
+#define URING_TAG_WRITE             1
+#define URING_TAG_TIMEOUT           2
+#define URING_TAG_WATCH             3 // fd watch polls, cancels share the tag without an owner and are ignored
+#define URING_TAG_MASK              3
+#endif
+
+// event owner, stored in the low bit of the epoll data, the timer has no owner
+#define EPOLL_TAG_PORT              0
+#define EPOLL_TAG_WATCH             1
+#define EPOLL_TAG_MASK              1
+
+
+/**
+ * @brief Non blocking transport send of a serial port
+ * 
+ * @param ctx: pointer to serial port object
+ * @param buf: frame to send
+ * @param len: frame length
+ * @return int: 0 if the whole frame was queued, -1 otherwise
+ */
+static int port_send(void* ctx, const uint8_t* buf, uint8_t len);
+
+/**
+ * @brief Configures a serial port for raw non blocking access
+ * 
+ * @param fd: serial port file descriptor
+ * @param cfg: probe configuration (baudrate and mode)
+ * @return int: 0 on success, -1 otherwise
+ */
+static int port_configure(int fd, config_t cfg);
+
+/**
+ * @brief Reads all pending bytes of a serial port and pushes them to the engine
+ * 
+ * @param port: pointer to serial port object
+ */
+static void port_drain(probe_linux_port_obj* port);
+
+/**
+ * @brief Opens and configures the device of a serial port, and registers it for reception
+ * 
+ * @param port: pointer to serial port object, path and cfg set
+ * @return int: 0 on success, -1 otherwise
+ */
+static int port_connect(probe_linux_port_obj* port);
+
+/**
+ * @brief Tunes a connected port and starts receiving
+ * 
+ * @param port: pointer to serial port object, added to the engine
+ */
+static void port_start(probe_linux_port_obj* port);
+
+/**
+ * @brief Closes a lost port, marks its bus down and schedules its reopening
+ * 
+ * @param port: pointer to serial port object
+ */
+static void port_disconnect(probe_linux_port_obj* port);
+
+/**
+ * @brief Reopen attempt of a lost port expired, or a send found the port lost and it is to be closed
+ * 
+ * @param arg: pointer to serial port object
+ */
+static void port_reconnect(void* arg);
+
+/**
+ * @brief Checks whether an error means the device is gone
+ * 
+ * @param err: errno value
+ * @return uint8_t: 1 if the port is lost, 0 otherwise
+ */
+static uint8_t port_lost(int err);
+
+/**
+ * @brief Pushes received bytes to the engine, measuring the first byte delay of each response
+ * 
+ * @param port: pointer to serial port object
+ * @param buf: received bytes
+ * @param len: number of received bytes
+ */
+static void port_receive(probe_linux_port_obj* port, const uint8_t* buf, uint16_t len);
+
+/**
+ * @brief Detects USB-serial adapters and lowers their latency timer, extending the bus response timeout when it cannot
+ * 
+ * @param port: pointer to serial port object, added to the engine
+ * @param path: serial device path
+ */
+static void port_tune_latency(probe_linux_port_obj* port, const char* path);
+
+/**
+ * @brief Writes then reads back the latency timer of a USB-serial adapter
+ * 
+ * @param file: sysfs latency_timer attribute
+ * @param value: latency timer to set in milliseconds
+ * @return int: latency timer in effect in milliseconds, -1 if the attribute cannot be read
+ */
+static int latency_timer_set(const char* file, int value);
+
+/**
+ * @brief Reports a port that cannot be tuned for low latency
+ * 
+ * @param port: pointer to serial port object
+ * @param msg: description of the issue
+ */
+static void port_warn(probe_linux_port_obj* port, const char* msg);
+
+/**
+ * @brief Gives the monotonic time in microseconds, for latency measurements
+ * 
+ * @return uint64_t: time in microseconds
+ */
+static uint64_t now_us(void);
+
+/**
+ * @brief Gives the next engine deadline, rounded up to the slack
+ * 
+ * @param lx: pointer to Linux backend object
+ * @param deadline: wakeup time in milliseconds
+ * @return uint8_t: 1 if a deadline is pending, 0 otherwise
+ */
+static uint8_t wake_deadline(probe_linux_obj* lx, uint32_t* deadline);
+
+/**
+ * @brief Arms the timer for the next engine deadline, rounded up to the slack
+ * 
+ * @param lx: pointer to Linux backend object
+ */
+static void timer_update(probe_linux_obj* lx);
+
+#ifdef PROBE_LINUX_IO_URING
+/**
+ * @brief Creates an io_uring instance and maps its rings
+ * 
+ * @param ring: pointer to ring structure
+ * @param entries: submission queue size
+ * @return int: 0 on success, -1 otherwise
+ */
+static int uring_setup(probe_uring_t* ring, uint32_t entries);
+
+/**
+ * @brief Unmaps the rings and closes an io_uring instance
+ * 
+ * @param ring: pointer to ring structure
+ */
+static void uring_teardown(probe_uring_t* ring);
+
+/**
+ * @brief Gets a free submission queue entry, submitting queued entries first if the queue is full
+ * 
+ * @param ring: pointer to ring structure
+ * @return struct io_uring_sqe*: cleared entry, NULL if the queue stays full
+ */
+static struct io_uring_sqe* uring_get_sqe(probe_uring_t* ring);
+
+/**
+ * @brief Submits queued entries and optionally waits for a completion, in a single syscall
+ * 
+ * @param ring: pointer to ring structure
+ * @param wait: 1 to wait for at least one completion
+ * @param timeout_ms: longest wait when waiting, negative to wait without limit
+ * @return int: 0 on success or timeout, -1 otherwise
+ */
+static int uring_enter(probe_uring_t* ring, uint32_t wait, int32_t timeout_ms);
+
+/**
+ * @brief Queues a read of a serial port
+ * 
+ * @param port: pointer to serial port object
+ */
+static void uring_queue_read(probe_linux_port_obj* port);
+
+/**
+ * @brief Queues a cancel of the write of a lost port, its completion tells whether the write can still complete
+ * @note Successful writes never complete when cqe_skip is set, the cancel is how their end is known
+ * 
+ * @param port: pointer to serial port object
+ */
+static void uring_cancel_write(probe_linux_port_obj* port);
+
+/**
+ * @brief Queues a one shot readiness poll of a watched descriptor
+ * 
+ * @param lx: pointer to Linux backend object
+ * @param watch: pointer to watch object
+ */
+static void uring_queue_poll(probe_linux_obj* lx, probe_linux_watch_t* watch);
+
+/**
+ * @brief Submits queued writes, reads and deadline, waits and harvests all completions in one pass
+ * 
+ * @param lx: pointer to Linux backend object
+ * @retval STATUS_OK if completions processed
+ * @retval STATUS_ERR if waiting failed, see errno
+ */
+static probe_status_e uring_run_once(probe_linux_obj* lx);
+#endif
+
+
+
+uint32_t probe_linux_now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+uint32_t probe_linux_now_us(void){
+    return (uint32_t) now_us();
+}
+
+probe_status_e probe_linux_init(probe_linux_obj* lx, probe_engine_obj* engine, uint32_t slack_ms){
+    lx->engine = engine;
+    lx->slack_ms = slack_ms;
+    lx->armed = 0;
+    lx->armed_ms = 0;
+    lx->wakeups = 0;
+    lx->uring = 0;
+    lx->timer_fd = -1;
+    lx->epoll_fd = -1;
+    lx->watches = NULL;
+    lx->on_warning = NULL;
+#ifdef PROBE_LINUX_IO_URING
+    if(uring_setup(&lx->ring, PROBE_LINUX_URING_ENTRIES) == 0){
+        lx->uring = 1;
+        return STATUS_OK;
+    }
+#endif
+    lx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(lx->epoll_fd < 0){
+        return STATUS_ERR;
+    }
+    lx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(lx->timer_fd < 0){
+        close(lx->epoll_fd);
+        return STATUS_ERR;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if(epoll_ctl(lx->epoll_fd, EPOLL_CTL_ADD, lx->timer_fd, &ev) != 0){
+        probe_linux_deinit(lx);
+        return STATUS_ERR;
+    }
+    return STATUS_OK;
+}
+
+probe_status_e probe_linux_open_port(probe_linux_obj* lx, probe_linux_port_obj* port, const char* path, config_t cfg){
+    port->fd = -1;
+    if(strlen(path) >= sizeof(port->path)){
+        errno = ENAMETOOLONG;
+        return STATUS_ERR;
+    }
+    strcpy(port->path, path);
+    port->cfg = cfg;
+    port->lx = lx;
+    port->read_pending = 0;
+    port->write_pending = 0;
+    port->first_byte_max_us = 0;
+    port->reconnect_ms = PROBE_LINUX_RECONNECT_MS;
+    probe_timer_init(&port->reconnect, &port_reconnect, port);
+    if(port_connect(port) != 0){
+        return STATUS_ERR;
+    }
+    probe_transport_t transport = {.send = &port_send, .ctx = port};
+    probe_engine_add_bus(lx->engine, &port->bus, transport);
+    port_start(port);
+    return STATUS_OK;
+}
+
+probe_status_e probe_linux_add_watch(probe_linux_obj* lx, probe_linux_watch_t* watch, int fd, void(*on_ready)(void* ctx), void* ctx){
+    watch->fd = fd;
+    watch->on_ready = on_ready;
+    watch->ctx = ctx;
+    watch->poll_pending = 0;
+#ifdef PROBE_LINUX_IO_URING
+    if(lx->uring){
+        uring_queue_poll(lx, watch);
+    }
+#endif
+    if(!lx->uring){
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = (uint64_t) (uintptr_t) watch | EPOLL_TAG_WATCH};
+        if(epoll_ctl(lx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0){
+            return STATUS_ERR;
+        }
+    }
+    watch->next = lx->watches;
+    lx->watches = watch;
+    return STATUS_OK;
+}
+
+probe_status_e probe_linux_run_once(probe_linux_obj* lx){
+    struct epoll_event events[PROBE_LINUX_MAX_EVENTS];
+#ifdef PROBE_LINUX_IO_URING
+    if(lx->uring){
+        return uring_run_once(lx);
+    }
+#endif
+    timer_update(lx);
+    int n = epoll_wait(lx->epoll_fd, events, PROBE_LINUX_MAX_EVENTS, -1);
+    if(n < 0){
+        return (errno == EINTR) ? STATUS_OK : STATUS_ERR;
+    }
+    lx->wakeups++;
+    // deadlines first, so transactions started by them see the current time
+    probe_engine_process(lx->engine, probe_linux_now_ms());
+    for(int i = 0; i < n; i++){
+        if(events[i].data.ptr == NULL){
+            uint64_t expirations;
+            if(read(lx->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)){
+                lx->armed = 0;
+            }
+            continue;
+        }
+        if((events[i].data.u64 & EPOLL_TAG_MASK) == EPOLL_TAG_WATCH){
+            probe_linux_watch_t* watch = (probe_linux_watch_t*) (uintptr_t) (events[i].data.u64 & ~(uint64_t) EPOLL_TAG_MASK);
+            watch->on_ready(watch->ctx);
+            continue;
+        }
+        probe_linux_port_obj* port = (probe_linux_port_obj*) events[i].data.ptr;
+        if(events[i].events & (EPOLLHUP | EPOLLERR)){
+            port_disconnect(port);
+            continue;
+        }
+        port_drain(port);
+    }
+    return STATUS_OK;
+}
+
+void probe_linux_deinit(probe_linux_obj* lx){
+#ifdef PROBE_LINUX_IO_URING
+    if(lx->uring){
+        uring_teardown(&lx->ring);
+        lx->uring = 0;
+    }
+#endif
+    if(lx->timer_fd >= 0){
+        close(lx->timer_fd);
+    }
+    if(lx->epoll_fd >= 0){
+        close(lx->epoll_fd);
+    }
+    lx->timer_fd = -1;
+    lx->epoll_fd = -1;
+}
+
+
+static int port_send(void* ctx, const uint8_t* buf, uint8_t len){
+    probe_linux_port_obj* port = (probe_linux_port_obj*) ctx;
+#ifdef PROBE_LINUX_IO_URING
+    if(port->lx->uring){
+        // queued only, submitted with the other ports on the next wakeup
+        if(port->write_pending || (len > sizeof(port->tx_buf))){
+            return -1;
+        }
+        struct io_uring_sqe* sqe = uring_get_sqe(&port->lx->ring);
+        if(sqe == NULL){
+            return -1;
+        }
+        memcpy(port->tx_buf, buf, len);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = port->fd;
+        sqe->addr = (uint64_t) (uintptr_t) port->tx_buf;
+        sqe->len = len;
+        sqe->off = (uint64_t) -1;
+        sqe->user_data = (uint64_t) (uintptr_t) port | URING_TAG_WRITE;
+        port->tx_us = now_us();
+        if(port->lx->ring.cqe_skip){
+            // only failed writes complete, saving a wakeup per transaction; the engine sends the next frame 
+            // of a bus after its response or timeout, long after the 8 bytes left tx_buf
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+            return 0;
+        }
+        port->write_pending = 1;
+        return 0;
+    }
+#endif
+    port->tx_us = now_us();
+    ssize_t written = write(port->fd, buf, len);
+    if((written < 0) && port_lost(errno)){
+        // called by the engine in the middle of a transaction, the port is closed from the reconnect timer once it returns
+        probe_wheel_arm(&port->lx->engine->wheel, &port->reconnect, port->lx->engine->now_ms);
+    }
+    return (written == len) ? 0 : -1;
+}
+
+
+static int port_connect(probe_linux_port_obj* port){
+    probe_linux_obj* lx = port->lx;
+    port->fd = open(port->path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(port->fd < 0){
+        return -1;
+    }
+    if(port_configure(port->fd, port->cfg) != 0){
+        close(port->fd);
+        port->fd = -1;
+        return -1;
+    }
+#ifdef PROBE_LINUX_IO_URING
+    if(lx->uring){
+        // io_uring waits on blocking files by itself, a non blocking file would complete reads with -EAGAIN
+        fcntl(port->fd, F_SETFL, fcntl(port->fd, F_GETFL) & ~O_NONBLOCK);
+        return 0;
+    }
+#endif
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = port};
+    if(epoll_ctl(lx->epoll_fd, EPOLL_CTL_ADD, port->fd, &ev) != 0){
+        close(port->fd);
+        port->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+
+static void port_start(probe_linux_port_obj* port){
+    // the adapter may have changed, measure it again
+    port->tx_us = 0;
+    port->first_byte_us = 0;
+    port->latency_warned = 0;
+    port->bus.latency_ms = 0;
+    port_tune_latency(port, port->path);
+#ifdef PROBE_LINUX_IO_URING
+    if(port->lx->uring){
+        uring_queue_read(port);
+    }
+#endif
+}
+
+
+static void port_disconnect(probe_linux_port_obj* port){
+    probe_linux_obj* lx = port->lx;
+    if(port->fd < 0){
+        return;
+    }
+#ifdef PROBE_LINUX_IO_URING
+    if(lx->uring && port->read_pending){
+        // the read holds the device open until it completes
+        struct io_uring_sqe* sqe = uring_get_sqe(&lx->ring);
+        if(sqe != NULL){
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t) (uintptr_t) port | URING_TAG_READ;
+            sqe->user_data = URING_TAG_WATCH;
+        }
+    }
+    if(lx->uring && lx->ring.cqe_skip){
+        // a write may still be in flight without a completion to wait for, pending until a cancel no longer finds it
+        port->write_pending = 1;
+        uring_cancel_write(port);
+    }
+    if(lx->uring){
+        // queued entries name the descriptor, submit them before its number can be reused
+        uring_enter(&lx->ring, 0, -1);
+    }
+#endif
+    if(!lx->uring){
+        epoll_ctl(lx->epoll_fd, EPOLL_CTL_DEL, port->fd, NULL);
+    }
+    close(port->fd);
+    port->fd = -1;
+    port->tx_us = 0;
+    probe_engine_bus_down(&port->bus);
+    port->reconnect_ms = PROBE_LINUX_RECONNECT_MS;
+    probe_wheel_arm(&lx->engine->wheel, &port->reconnect, lx->engine->now_ms + port->reconnect_ms);
+    port_warn(port, "port lost, reopening");
+}
+
+
+static void port_reconnect(void* arg){
+    probe_linux_port_obj* port = (probe_linux_port_obj*) arg;
+    probe_engine_obj* engine = port->lx->engine;
+    if(port->fd >= 0){
+        // a send found the device gone
+        port_disconnect(port);
+        return;
+    }
+#ifdef PROBE_LINUX_IO_URING
+    if(port->lx->uring && port->lx->ring.cqe_skip && port->write_pending){
+        // the last cancel found the write still running, or could not be queued
+        uring_cancel_write(port);
+    }
+#endif
+    // completions of the lost device must drain first, they carry the same port
+    if(!port->read_pending && !port->write_pending && (port_connect(port) == 0)){
+        port_start(port);
+        probe_engine_bus_up(&port->bus);
+        return;
+    }
+    if(!port->read_pending && !port->write_pending){
+        port->reconnect_ms = (port->reconnect_ms < (PROBE_LINUX_RECONNECT_MAX_MS / 2)) ? (port->reconnect_ms * 2) : PROBE_LINUX_RECONNECT_MAX_MS;
+    }
+    probe_wheel_arm(&engine->wheel, &port->reconnect, engine->now_ms + port->reconnect_ms);
+}
+
+
+static uint8_t port_lost(int err){
+    return ((err == EIO) || (err == ENODEV) || (err == ENXIO)) ? 1 : 0;
+}
+
+
+static int port_configure(int fd, config_t cfg){
+    static const speed_t speeds[] = {B9600, B19200, B38400, B57600, B115200};
+    struct termios tty;
+    if(tcgetattr(fd, &tty) != 0){
+        return -1;
+    }
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(PARENB | PARODD | CSTOPB);
+    switch(cfg.mode){
+        case MODE_8N2:
+            tty.c_cflag |= CSTOPB;
+            break;
+        case MODE_8E1:
+            tty.c_cflag |= PARENB;
+            break;
+        case MODE_8E2:
+            tty.c_cflag |= PARENB | CSTOPB;
+            break;
+        case MODE_8O1:
+            tty.c_cflag |= PARENB | PARODD;
+            break;
+        case MODE_802:
+            tty.c_cflag |= PARENB | PARODD | CSTOPB;
+            break;
+        default:
+            break;
+    }
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    speed_t speed = (cfg.baudrate <= BAUDRATE_115200) ? speeds[cfg.baudrate] : B9600;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if(tcsetattr(fd, TCSANOW, &tty) != 0){
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    // let the kernel drive the transceiver where the UART supports it
+    struct serial_rs485 rs485 = {0};
+    rs485.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+    ioctl(fd, TIOCSRS485, &rs485);
+    return 0;
+}
+
+
+static void port_drain(probe_linux_port_obj* port){
+    uint8_t buf[64];
+    ssize_t len;
+    while((len = read(port->fd, buf, sizeof(buf))) > 0){
+        port_receive(port, buf, (uint16_t) len);
+    }
+    if((len < 0) && port_lost(errno)){
+        port_disconnect(port);
+    }
+}
+
+
+static void port_receive(probe_linux_port_obj* port, const uint8_t* buf, uint16_t len){
+    probe_bus_obj* bus = &port->bus;
+    // the bytes were read as soon as the poll returned
+    uint64_t rx_us = now_us();
+    if((port->tx_us != 0) && (bus->state == BUS_BUSY)){
+        uint32_t delay = (uint32_t) (rx_us - port->tx_us);
+        port->tx_us = 0;
+        port->first_byte_us = delay;
+        if(delay > port->first_byte_max_us){
+            port->first_byte_max_us = delay;
+        }
+        // past the request on the wire, a USB adapter holding the response is the usual culprit
+        uint32_t wire_us = PHOTOMETRIC_PROBE_REQUEST_LEN * photometric_probe_char_time_us(bus->active->probe->cfg);
+        if(port->usb && (delay > (wire_us + PROBE_LINUX_LATENCY_WARN_US))){
+            uint32_t latency_ms = US_TO_MS(delay - wire_us);
+            if(latency_ms > bus->latency_ms){
+                bus->latency_ms = latency_ms;
+            }
+            if(!port->latency_warned){
+                port->latency_warned = 1;
+                port_warn(port, "late first response byte, adapter buffering suspected, response timeout extended");
+            }
+        }
+    }
+    probe_engine_bus_receive_at(bus, buf, len, (uint32_t) rx_us);
+}
+
+
+static void port_tune_latency(probe_linux_port_obj* port, const char* path){
+    char dev[PATH_MAX];
+    char sysfs[PATH_MAX];
+    char target[PATH_MAX];
+    port->usb = 0;
+    port->latency_timer_ms = -1;
+    // honoured by some drivers, ignored by others
+    struct serial_struct serial;
+    if(ioctl(port->fd, TIOCGSERIAL, &serial) == 0){
+        serial.flags |= ASYNC_LOW_LATENCY;
+        ioctl(port->fd, TIOCSSERIAL, &serial);
+    }
+    if(realpath(path, dev) == NULL){
+        return;
+    }
+    const char* name = strrchr(dev, '/');
+    name = (name != NULL) ? (name + 1) : dev;
+    snprintf(sysfs, sizeof(sysfs), "/sys/class/tty/%.32s/device", name);
+    if((realpath(sysfs, target) == NULL) || (strstr(target, "/usb") == NULL)){
+        return;
+    }
+    port->usb = 1;
+    snprintf(sysfs, sizeof(sysfs), "/sys/class/tty/%.32s/device/latency_timer", name);
+    int timer = latency_timer_set(sysfs, LATENCY_TIMER_MS);
+    if(timer < 0){
+        // no latency timer exposed, late responses are caught by the first byte measurement
+        return;
+    }
+    port->latency_timer_ms = (int16_t) timer;
+    if(timer > LATENCY_TIMER_MS){
+        port->bus.latency_ms = (uint32_t) timer;
+        port_warn(port, "latency timer cannot be lowered, response timeout extended");
+    }
+}
+
+
+static int latency_timer_set(const char* file, int value){
+    char buf[8];
+    int fd = open(file, O_WRONLY | O_CLOEXEC);
+    if(fd >= 0){
+        int len = snprintf(buf, sizeof(buf), "%d", value);
+        // without write access the current value stays, it is read back below
+        ssize_t written = write(fd, buf, (size_t) len);
+        (void) written;
+        close(fd);
+    }
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(len <= 0){
+        return -1;
+    }
+    buf[len] = 0;
+    return atoi(buf);
+}
+
+
+static void port_warn(probe_linux_port_obj* port, const char* msg){
+    if(port->lx->on_warning != NULL){
+        port->lx->on_warning(port, msg);
+    }
+}
+
+
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + ((uint64_t) ts.tv_nsec / 1000);
+}
+
+
+static uint8_t wake_deadline(probe_linux_obj* lx, uint32_t* deadline){
+    if(!probe_engine_next_deadline(lx->engine, deadline)){
+        return 0;
+    }
+    if(lx->slack_ms > 1){
+        *deadline = ((*deadline + lx->slack_ms - 1) / lx->slack_ms) * lx->slack_ms;
+    }
+    return 1;
+}
+
+
+static void timer_update(probe_linux_obj* lx){
+    uint32_t deadline;
+    if(!wake_deadline(lx, &deadline)){
+        // nothing due any more, a left over expiry would only cause a spurious wakeup
+        if(!lx->armed){
+            return;
+        }
+#ifdef PROBE_LINUX_IO_URING
+        if(lx->uring){
+            struct io_uring_sqe* sqe = uring_get_sqe(&lx->ring);
+            if(sqe == NULL){
+                return;
+            }
+            sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = ((uint64_t) lx->armed_ms << 2) | URING_TAG_TIMEOUT;
+            sqe->user_data = URING_TAG_WATCH;
+            lx->armed = 0;
+            return;
+        }
+#endif
+        const struct itimerspec disarm = {0};
+        timerfd_settime(lx->timer_fd, 0, &disarm, NULL);
+        lx->armed = 0;
+        return;
+    }
+    if(lx->armed && (lx->armed_ms == deadline)){
+        return;
+    }
+    // the engine clock wraps at 32 bits, arm a relative expiry
+    int32_t delta = (int32_t) (deadline - probe_linux_now_ms());
+    struct itimerspec its = {0};
+    if(delta <= 0){
+        // already due, one nanosecond arms an immediate expiry
+        its.it_value.tv_nsec = 1;
+    }
+    else{
+        its.it_value.tv_sec = delta / 1000;
+        its.it_value.tv_nsec = (delta % 1000) * 1000000L;
+    }
+#ifdef PROBE_LINUX_IO_URING
+    if(lx->uring){
+        // a superseded timeout still completes, it only causes an early wakeup
+        struct io_uring_sqe* sqe = uring_get_sqe(&lx->ring);
+        if(sqe == NULL){
+            return;
+        }
+        lx->ring.timeout[0] = its.it_value.tv_sec;
+        lx->ring.timeout[1] = its.it_value.tv_nsec;
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) (uintptr_t) lx->ring.timeout;
+        sqe->len = 1;
+        sqe->user_data = ((uint64_t) deadline << 2) | URING_TAG_TIMEOUT;
+        lx->armed = 1;
+        lx->armed_ms = deadline;
+        return;
+    }
+#endif
+    timerfd_settime(lx->timer_fd, 0, &its, NULL);
+    lx->armed = 1;
+    lx->armed_ms = deadline;
+}
+
+
+#ifdef PROBE_LINUX_IO_URING
+static int uring_setup(probe_uring_t* ring, uint32_t entries){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd < 0){
+        return -1;
+    }
+    ring->sq_ring_len = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    ring->cq_ring_len = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cq_ring_len > ring->sq_ring_len){
+            ring->sq_ring_len = ring->cq_ring_len;
+        }
+        ring->cq_ring_len = 0;
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->sq_ring;
+    if((ring->sq_ring != MAP_FAILED) && ring->cq_ring_len){
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if((ring->sq_ring == MAP_FAILED) || (ring->cq_ring == MAP_FAILED) || (ring->sqes == MAP_FAILED)){
+        uring_teardown(ring);
+        return -1;
+    }
+    uint8_t* sq = (uint8_t*) ring->sq_ring;
+    uint8_t* cq = (uint8_t*) ring->cq_ring;
+    ring->sq_head = (uint32_t*) (sq + params.sq_off.head);
+    ring->sq_tail = (uint32_t*) (sq + params.sq_off.tail);
+    ring->sq_array = (uint32_t*) (sq + params.sq_off.array);
+    ring->sq_mask = *(uint32_t*) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cqe_skip = (params.features & IORING_FEAT_CQE_SKIP) ? 1 : 0;
+    ring->ext_arg = (params.features & IORING_FEAT_EXT_ARG) ? 1 : 0;
+    ring->to_submit = 0;
+    ring->cq_head = (uint32_t*) (cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t*) (cq + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+
+static void uring_teardown(probe_uring_t* ring){
+    if((ring->sqes != NULL) && (ring->sqes != MAP_FAILED)){
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if(ring->cq_ring_len && (ring->cq_ring != NULL) && (ring->cq_ring != MAP_FAILED)){
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+    if((ring->sq_ring != NULL) && (ring->sq_ring != MAP_FAILED)){
+        munmap(ring->sq_ring, ring->sq_ring_len);
+    }
+    ring->sqes = NULL;
+    ring->cq_ring = NULL;
+    ring->sq_ring = NULL;
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+
+static struct io_uring_sqe* uring_get_sqe(probe_uring_t* ring){
+    if((ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->sq_entries){
+        uring_enter(ring, 0, -1);
+        if((ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->sq_entries){
+            return NULL;
+        }
+    }
+    uint32_t idx = ring->sq_local_tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+
+static int uring_enter(probe_uring_t* ring, uint32_t wait, int32_t timeout_ms){
+    uint32_t flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+    void* argp = NULL;
+    size_t argsz = 0;
+    if(wait && (timeout_ms >= 0)){
+        ring->timeout[0] = timeout_ms / 1000;
+        ring->timeout[1] = (timeout_ms % 1000) * 1000000L;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) (uintptr_t) ring->timeout;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    int ret = (int) syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait, flags, argp, argsz);
+    if(ret < 0){
+        if(errno == ETIME){
+            // waiting timed out, entries were still submitted
+            ring->to_submit = 0;
+            return 0;
+        }
+        return -1;
+    }
+    ring->to_submit -= ((uint32_t) ret < ring->to_submit) ? (uint32_t) ret : ring->to_submit;
+    return 0;
+}
+
+
+static void uring_queue_read(probe_linux_port_obj* port){
+    struct io_uring_sqe* sqe = uring_get_sqe(&port->lx->ring);
+    if(sqe == NULL){
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = port->fd;
+    sqe->addr = (uint64_t) (uintptr_t) port->rx_buf;
+    sqe->len = sizeof(port->rx_buf);
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = (uint64_t) (uintptr_t) port | URING_TAG_READ;
+    port->read_pending = 1;
+}
+
+
+static void uring_cancel_write(probe_linux_port_obj* port){
+    struct io_uring_sqe* sqe = uring_get_sqe(&port->lx->ring);
+    if(sqe == NULL){
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) port | URING_TAG_WRITE;
+    sqe->user_data = (uint64_t) (uintptr_t) port | URING_TAG_WRITE;
+}
+
+
+static void uring_queue_poll(probe_linux_obj* lx, probe_linux_watch_t* watch){
+    struct io_uring_sqe* sqe = uring_get_sqe(&lx->ring);
+    if(sqe == NULL){
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = watch->fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t) (uintptr_t) watch | URING_TAG_WATCH;
+    watch->poll_pending = 1;
+}
+
+
+static probe_status_e uring_run_once(probe_linux_obj* lx){
+    probe_uring_t* ring = &lx->ring;
+    // reads left unarmed by a full submission queue
+    for(probe_bus_obj* bus = lx->engine->buses; bus != NULL; bus = bus->next){
+        probe_linux_port_obj* port = (probe_linux_port_obj*) bus->transport.ctx;
+        if(!port->read_pending && (port->fd >= 0)){
+            uring_queue_read(port);
+        }
+    }
+    for(probe_linux_watch_t* watch = lx->watches; watch != NULL; watch = watch->next){
+        if(!watch->poll_pending){
+            uring_queue_poll(lx, watch);
+        }
+    }
+    int32_t timeout_ms = -1;
+    uint32_t deadline;
+    if(!ring->ext_arg){
+        timer_update(lx);
+    }
+    else if(wake_deadline(lx, &deadline)){
+        // the deadline is passed to the wait itself, no timer to arm or cancel
+        timeout_ms = (int32_t) (deadline - probe_linux_now_ms());
+        timeout_ms = (timeout_ms > 0) ? timeout_ms : 0;
+    }
+    if(uring_enter(ring, 1, timeout_ms) != 0){
+        return (errno == EINTR) ? STATUS_OK : STATUS_ERR;
+    }
+    lx->wakeups++;
+    probe_engine_process(lx->engine, probe_linux_now_ms());
+    uint32_t head = *ring->cq_head;
+    uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail){
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        uint64_t tag = cqe->user_data & URING_TAG_MASK;
+        if(tag == URING_TAG_TIMEOUT){
+            if(lx->armed && (lx->armed_ms == (uint32_t) (cqe->user_data >> 2))){
+                lx->armed = 0;
+            }
+        }
+        else if(tag == URING_TAG_WATCH){
+            probe_linux_watch_t* watch = (probe_linux_watch_t*) (uintptr_t) (cqe->user_data & ~(uint64_t) URING_TAG_MASK);
+            if(watch != NULL){
+                // one shot, re-armed on the next wakeup once the owner consumed what was ready
+                watch->poll_pending = 0;
+                watch->on_ready(watch->ctx);
+            }
+        }
+        else{
+            probe_linux_port_obj* port = (probe_linux_port_obj*) (uintptr_t) (cqe->user_data & ~(uint64_t) URING_TAG_MASK);
+            if(tag == URING_TAG_WRITE){
+                // with cqe_skip, only failed writes and the cancels of a lost port complete; a cancel
+                // answers 0 or -EALREADY while it found the write, -ENOENT once the write is over
+                if(!ring->cqe_skip || (cqe->res == -ENOENT)){
+                    port->write_pending = 0;
+                }
+                if((cqe->res < 0) && port_lost(-cqe->res)){
+                    port_disconnect(port);
+                }
+            }
+            else if(port->fd < 0){
+                // read of a lost device, drained before reopening
+                port->read_pending = 0;
+            }
+            else{
+                port->read_pending = 0;
+                if(cqe->res > 0){
+                    port_receive(port, port->rx_buf, (uint16_t) cqe->res);
+                }
+                if((cqe->res > 0) || (cqe->res == -EAGAIN) || (cqe->res == -EINTR)){
+                    uring_queue_read(port);
+                }
+                else if((cqe->res == 0) || port_lost(-cqe->res)){
+                    // blocking reads only return 0 once the device hung up
+                    port_disconnect(port);
+                }
+            }
+        }
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return STATUS_OK;
+}
+#endif
@@ -0,0 +1,208 @@
+/**
+ * @file lpph_linux.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the Linux serial port backend of the probe bus engine
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_LINUX_H
+#define LPPH_LINUX_H
+
+#include "lpph_engine.h"
+#include "stddef.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+#ifndef PROBE_LINUX_MAX_EVENTS
+#define PROBE_LINUX_MAX_EVENTS      32 // events harvested per wakeup
+#endif
+
+#ifndef PROBE_LINUX_URING_ENTRIES
+#define PROBE_LINUX_URING_ENTRIES   256 // io_uring submission queue size, two entries per port plus deadline timeouts
+#endif
+
+#ifndef PROBE_LINUX_LATENCY_WARN_US
+#define PROBE_LINUX_LATENCY_WARN_US 4000 // first byte delay beyond the request wire time above which adapter buffering is suspected
+#endif
+
+#ifndef PROBE_LINUX_RECONNECT_MS
+#define PROBE_LINUX_RECONNECT_MS    100 // delay before the first reopen of a lost port, doubled on every failed attempt
+#endif
+
+#ifndef PROBE_LINUX_RECONNECT_MAX_MS
+#define PROBE_LINUX_RECONNECT_MAX_MS    5000
+#endif
+
+#define PROBE_LINUX_RX_LEN          64
+#define PROBE_LINUX_PATH_LEN        64
+
+typedef struct probe_linux probe_linux_obj;
+
+/**
+ * @brief Structure for a serial port object, one per RS485 line
+ * 
+ */
+typedef struct{
+    int fd; // -1 while disconnected
+    probe_bus_obj bus;
+    probe_linux_obj* lx;
+    char path[PROBE_LINUX_PATH_LEN]; // reopened after a disconnect
+    config_t cfg;
+    probe_timer_t reconnect; // next reopen attempt, in the engine wheel
+    uint32_t reconnect_ms; // current reopen backoff
+    uint8_t rx_buf[PROBE_LINUX_RX_LEN]; // io_uring read in flight
+    uint8_t tx_buf[PHOTOMETRIC_PROBE_REQUEST_LEN]; // io_uring write in flight
+    uint8_t read_pending; // 1 if an io_uring read is queued or in flight
+    uint8_t write_pending; // 1 if an io_uring write is queued or in flight, or may be for a lost port when writes complete silently
+    uint8_t usb; // 1 if the port is a USB-serial adapter
+    int16_t latency_timer_ms; // adapter latency timer after tuning, -1 if the adapter has none
+    uint64_t tx_us; // send time of the request waiting for its first response byte, 0 if none
+    uint32_t first_byte_us; // last delay from request send to first response byte, request wire time included
+    uint32_t first_byte_max_us; // largest delay measured
+    uint8_t latency_warned; // 1 once a slow first byte has been reported
+}probe_linux_port_obj;
+
+/**
+ * @brief Structure for a watched descriptor, lets other event sources (e.g. a network server) share the thread of the ports
+ * 
+ */
+typedef struct probe_linux_watch probe_linux_watch_t;
+struct probe_linux_watch{
+    int fd;
+    void(*on_ready)(void* ctx); // called once fd is readable, must not block
+    void* ctx;
+    uint8_t poll_pending; // 1 if an io_uring poll is queued or in flight
+    probe_linux_watch_t* next;
+};
+
+/**
+ * @brief io_uring rings, mapped from the kernel
+ * 
+ */
+typedef struct{
+    int fd;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t sq_local_tail; // entries queued but not yet visible to the kernel
+    uint32_t to_submit;
+    uint8_t cqe_skip; // 1 if successful writes can complete without a completion entry
+    uint8_t ext_arg; // 1 if waits take the deadline directly, otherwise a timeout entry is queued
+    struct io_uring_sqe* sqes;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring; // mappings, for deinit
+    size_t sq_ring_len;
+    void* cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    int64_t timeout[2]; // deadline timespec, read by the kernel on submission or wait
+}probe_uring_t;
+
+/**
+ * @brief Structure for the Linux backend object, drives all the ports of an engine from a single thread
+ * 
+ */
+struct probe_linux{
+    probe_engine_obj* engine;
+    int epoll_fd;
+    int timer_fd;
+    uint32_t slack_ms; // wakeups are aligned on multiples of slack_ms so deadlines of different buses coalesce
+    uint32_t armed_ms; // deadline the timer is armed for
+    uint8_t armed; // 1 if the timer is armed
+    uint32_t wakeups; // number of wakeups, for idle efficiency monitoring
+    uint8_t uring; // 1 if ports are driven through io_uring
+    probe_uring_t ring;
+    probe_linux_watch_t* watches; // other descriptors waited on with the ports
+    void(*on_warning)(probe_linux_port_obj* port, const char* msg); // optional, called when a port is lost or cannot be tuned for low latency
+};
+
+/**
+ * @brief Gives the monotonic time used by the Linux backend
+ * 
+ * @return uint32_t: time in milliseconds
+ */
+uint32_t probe_linux_now_ms(void);
+
+/**
+ * @brief Gives the monotonic time used by the Linux backend to date received bytes, to be set as the get_time_us of its probes
+ * 
+ * @return uint32_t: time in microseconds
+ */
+uint32_t probe_linux_now_us(void);
+
+/**
+ * @brief Initializes the Linux backend of an engine, the engine must be initialized with probe_linux_now_ms
+ * @note When built with PROBE_LINUX_IO_URING, ports are driven through io_uring: writes, reads and the wait deadline of all ports 
+ * are submitted in one batch and their completions harvested in one pass, a single syscall per wakeup. 
+ * The epoll backend is used when the kernel does not support io_uring.
+ * 
+ * @param lx: A pointer to a Linux backend object
+ * @param engine: A pointer to a bus engine object
+ * @param slack_ms: allowed wakeup delay for coalescing, 0 to wake exactly on deadlines
+ * @retval STATUS_OK if epoll and timerfd created
+ * @retval STATUS_ERR otherwise, see errno
+ * @note on_warning is reset, set it after initialization
+ */
+probe_status_e probe_linux_init(probe_linux_obj* lx, probe_engine_obj* engine, uint32_t slack_ms);
+
+/**
+ * @brief Opens a serial port and adds it to the engine as a bus
+ * @note Kernel RS485 mode is enabled when supported, otherwise the adapter is expected to drive the transceiver direction. 
+ * The latency timer of USB-serial adapters (up to 16 ms on FTDI chips) is lowered to 1 ms through sysfs, which needs write access 
+ * to /sys/class/tty/<port>/device/latency_timer. When it cannot be lowered, or when the first response bytes are measured to 
+ * arrive late, on_warning is called and the bus response timeout is extended by the latency instead. 
+ * A port that hangs up or fails with EIO, ENODEV or ENXIO (USB adapter reset or unplugged) is closed and its bus marked down, 
+ * then reopened with backoff; once reopened, the probes of the bus are re-validated by an immediate poll.
+ * 
+ * @param lx: A pointer to a Linux backend object
+ * @param port: A pointer to a serial port object
+ * @param path: serial device path, e.g. /dev/ttyUSB0, preferably a stable /dev/serial/by-id link that survives re-enumeration
+ * @param cfg: configuration of the probes on this port (baudrate and mode)
+ * @retval STATUS_OK if port opened
+ * @retval STATUS_ERR otherwise, see errno
+ */
+probe_status_e probe_linux_open_port(probe_linux_obj* lx, probe_linux_port_obj* port, const char* path, config_t cfg);
+
+/**
+ * @brief Adds a descriptor to the wait of the backend, its callback runs from probe_linux_run_once once it is readable
+ * @note The descriptor is watched until the backend is closed, level triggered: on_ready may serve part of what is ready 
+ * and is called again on the next wakeup. With io_uring, readiness is polled one shot and re-armed on every wakeup
+ * 
+ * @param lx: A pointer to a Linux backend object
+ * @param watch: A pointer to a watch object
+ * @param fd: descriptor to watch
+ * @param on_ready: called once fd is readable
+ * @param ctx: argument of on_ready
+ * @retval STATUS_OK if fd is watched
+ * @retval STATUS_ERR otherwise, see errno
+ */
+probe_status_e probe_linux_add_watch(probe_linux_obj* lx, probe_linux_watch_t* watch, int fd, void(*on_ready)(void* ctx), void* ctx);
+
+/**
+ * @brief Sleeps until the next engine deadline or received data, then processes them
+ * @note The thread sleeps in a single epoll_wait, or io_uring_enter, whatever the number of ports, so CPU use follows the transaction rate
+ * 
+ * @param lx: A pointer to a Linux backend object
+ * @retval STATUS_OK if events processed
+ * @retval STATUS_ERR if waiting failed, see errno
+ */
+probe_status_e probe_linux_run_once(probe_linux_obj* lx);
+
+/**
+ * @brief Closes the Linux backend, ports must be closed by the application
+ * 
+ * @param lx: A pointer to a Linux backend object
+ */
+void probe_linux_deinit(probe_linux_obj* lx);
+
+#endif
@@ -0,0 +1,435 @@
+/**
+ * @file lpph_mbtcp.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the Modbus TCP gateway
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include "lpph_mbtcp.h"
+#include "errno.h"
+#include "unistd.h"
+#include "string.h"
+#include "math.h"
+#include "sys/epoll.h"
+#include "sys/socket.h"
+#include "netinet/in.h"
+#include "netinet/tcp.h"
+#include "arpa/inet.h"
+
+#define MBAP_LEN                    7 // transaction id, protocol id, length, unit id
+#define MBTCP_READ_INPUT_REGS       0x04
+#define MBTCP_MAX_READ_COUNT        125 // most registers of a read
+#define MBTCP_RSP_MAX_LEN           (MBAP_LEN + 2 + (2 * PROBE_MBTCP_REG_COUNT)) // longest response of the gateway
+
+
+/**
+ * @brief Epoll callback of the Linux backend
+ * 
+ * @param ctx: pointer to gateway object
+ */
+static void gateway_ready(void* ctx);
+
+/**
+ * @brief Accepts pending connections, closing those beyond the client slots
+ * 
+ * @param gw: pointer to gateway object
+ */
+static void gateway_accept(probe_mbtcp_obj* gw);
+
+/**
+ * @brief Reads the requests of a client and answers them
+ * 
+ * @param gw: pointer to gateway object
+ * @param client: pointer to client object
+ * @param events: epoll events of the client
+ */
+static void client_serve(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client, uint32_t events);
+
+/**
+ * @brief Answers the complete requests received, until the socket stops accepting their responses
+ * 
+ * @param gw: pointer to gateway object
+ * @param client: pointer to client object
+ * @return int: 0 on success, -1 if the client broke framing and must be closed
+ */
+static int client_parse(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client);
+
+/**
+ * @brief Sends the queued responses of a client, waiting for the socket to drain when it does not accept them all
+ * 
+ * @param gw: pointer to gateway object
+ * @param client: pointer to client object
+ * @return int: 0 on success, -1 if the connection failed and must be closed
+ */
+static int client_flush(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client);
+
+/**
+ * @brief Closes a client connection and frees its slot
+ * 
+ * @param gw: pointer to gateway object
+ * @param client: pointer to client object
+ */
+static void client_close(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client);
+
+/**
+ * @brief Builds the response PDU of a request PDU
+ * 
+ * @param gw: pointer to gateway object
+ * @param unit: unit id of the request
+ * @param req: request PDU
+ * @param len: request PDU length
+ * @param rsp: response PDU, at least 2 + 2 * PROBE_MBTCP_REG_COUNT bytes
+ * @return uint8_t: response PDU length
+ */
+static uint8_t handle_pdu(probe_mbtcp_obj* gw, uint8_t unit, const uint8_t* req, uint16_t len, uint8_t* rsp);
+
+/**
+ * @brief Checks that a value of a probe is recent enough to be served
+ * 
+ * @param gw: pointer to gateway object
+ * @param node: pointer to polled probe object
+ * @param time: receive time of the response the value was decoded from
+ * @return uint8_t: 1 if the value can be served, 0 otherwise
+ */
+static uint8_t value_fresh(const probe_mbtcp_obj* gw, const probe_node_obj* node, const probe_rx_time_t* time);
+
+/**
+ * @brief Encodes a cached value as its LPPHOT03 input register
+ * 
+ * @param probe: pointer to photometric probe object
+ * @param m: copy of the measurements of the probe
+ * @param reg: register address, below PROBE_MBTCP_REG_COUNT
+ * @return uint16_t
+ */
+static uint16_t reg_encode(const photometric_probe_obj* probe, const probe_measurements_t* m, uint8_t reg);
+
+
+
+probe_status_e probe_mbtcp_init(probe_mbtcp_obj* gw, probe_engine_obj* engine, probe_mbtcp_client_t* clients, uint16_t max_clients, uint32_t max_age_ms){
+    gw->engine = engine;
+    gw->listen_fd = -1;
+    gw->epoll_fd = -1;
+    gw->port = 0;
+    gw->clients = clients;
+    gw->max_clients = max_clients;
+    gw->connected = 0;
+    gw->max_age_ms = max_age_ms;
+    gw->requests = 0;
+    gw->exceptions = 0;
+    gw->stale = 0;
+    gw->rejected = 0;
+    for(uint16_t i = 0; i < max_clients; i++){
+        clients[i].fd = -1;
+    }
+    memset(gw->units, 0, sizeof(gw->units));
+    probe_status_e status = STATUS_OK;
+    for(probe_bus_obj* bus = engine->buses; bus != NULL; bus = bus->next){
+        for(probe_node_obj* node = bus->nodes; node != NULL; node = node->sibling){
+            // addresses are per bus, a unit id shared by two buses cannot tell which probe is meant
+            if(gw->units[node->probe->cfg.address] != NULL){
+                status = STATUS_ERR;
+                continue;
+            }
+            gw->units[node->probe->cfg.address] = node;
+        }
+    }
+    return status;
+}
+
+probe_status_e probe_mbtcp_listen(probe_mbtcp_obj* gw, const char* addr, uint16_t port){
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    if((addr != NULL) && (inet_pton(AF_INET, addr, &sa.sin_addr) != 1)){
+        errno = EINVAL;
+        return STATUS_ERR;
+    }
+    gw->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(gw->epoll_fd < 0){
+        return STATUS_ERR;
+    }
+    gw->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(gw->listen_fd < 0){
+        probe_mbtcp_close(gw);
+        return STATUS_ERR;
+    }
+    int one = 1;
+    setsockopt(gw->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t sa_len = sizeof(sa);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if((bind(gw->listen_fd, (struct sockaddr*) &sa, sizeof(sa)) != 0) || (listen(gw->listen_fd, SOMAXCONN) != 0) ||
+       (getsockname(gw->listen_fd, (struct sockaddr*) &sa, &sa_len) != 0) || (epoll_ctl(gw->epoll_fd, EPOLL_CTL_ADD, gw->listen_fd, &ev) != 0)){
+        int err = errno;
+        probe_mbtcp_close(gw);
+        errno = err;
+        return STATUS_ERR;
+    }
+    gw->port = ntohs(sa.sin_port);
+    return STATUS_OK;
+}
+
+probe_status_e probe_mbtcp_attach(probe_mbtcp_obj* gw, probe_linux_obj* lx){
+    return probe_linux_add_watch(lx, &gw->watch, gw->epoll_fd, &gateway_ready, gw);
+}
+
+void probe_mbtcp_process(probe_mbtcp_obj* gw){
+    struct epoll_event events[PROBE_MBTCP_MAX_EVENTS];
+    int n = epoll_wait(gw->epoll_fd, events, PROBE_MBTCP_MAX_EVENTS, 0);
+    for(int i = 0; i < n; i++){
+        if(events[i].data.ptr == NULL){
+            gateway_accept(gw);
+            continue;
+        }
+        client_serve(gw, (probe_mbtcp_client_t*) events[i].data.ptr, events[i].events);
+    }
+}
+
+void probe_mbtcp_close(probe_mbtcp_obj* gw){
+    for(uint16_t i = 0; i < gw->max_clients; i++){
+        if(gw->clients[i].fd >= 0){
+            client_close(gw, &gw->clients[i]);
+        }
+    }
+    if(gw->listen_fd >= 0){
+        close(gw->listen_fd);
+    }
+    if(gw->epoll_fd >= 0){
+        close(gw->epoll_fd);
+    }
+    gw->listen_fd = -1;
+    gw->epoll_fd = -1;
+}
+
+
+static void gateway_ready(void* ctx){
+    probe_mbtcp_process((probe_mbtcp_obj*) ctx);
+}
+
+
+static void gateway_accept(probe_mbtcp_obj* gw){
+    for(;;){
+        int fd = accept4(gw->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0){
+            // errors of the aborted connection only, anything else (backlog empty, out of descriptors or memory) is retried on the next wakeup
+            if((errno == ECONNABORTED) || (errno == EPROTO) || (errno == EINTR)){
+                continue;
+            }
+            return;
+        }
+        probe_mbtcp_client_t* client = NULL;
+        for(uint16_t i = 0; (i < gw->max_clients) && (client == NULL); i++){
+            if(gw->clients[i].fd < 0){
+                client = &gw->clients[i];
+            }
+        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = client};
+        if((client == NULL) || (epoll_ctl(gw->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)){
+            close(fd);
+            gw->rejected++;
+            continue;
+        }
+        // responses are small and latency bound
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        client->fd = fd;
+        client->rx_len = 0;
+        client->tx_len = 0;
+        client->blocked = 0;
+        gw->connected++;
+    }
+}
+
+
+static void client_serve(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client, uint32_t events){
+    if(events & (EPOLLERR | EPOLLHUP)){
+        client_close(gw, client);
+        return;
+    }
+    if(client->blocked){
+        // the socket accepts data again, answer the requests held back
+        if((client_flush(gw, client) != 0) || (!client->blocked && ((client_parse(gw, client) != 0) || (client_flush(gw, client) != 0)))){
+            client_close(gw, client);
+        }
+        return;
+    }
+    ssize_t got = read(client->fd, &client->rx[client->rx_len], sizeof(client->rx) - client->rx_len);
+    if(got <= 0){
+        if((got == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))){
+            client_close(gw, client);
+        }
+        return;
+    }
+    client->rx_len += (uint16_t) got;
+    if((client_parse(gw, client) != 0) || (client_flush(gw, client) != 0)){
+        client_close(gw, client);
+    }
+}
+
+
+static int client_parse(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client){
+    uint16_t pos = 0;
+    while((client->rx_len - pos) >= MBAP_LEN){
+        const uint8_t* adu = &client->rx[pos];
+        uint16_t protocol = (adu[2] << 8) | adu[3];
+        uint16_t length = (adu[4] << 8) | adu[5];
+        if((protocol != 0) || (length < 2) || (length > (PROBE_MBTCP_ADU_LEN - 6))){
+            return -1;
+        }
+        if((client->rx_len - pos) < (6 + length)){
+            break;
+        }
+        if((sizeof(client->tx) - client->tx_len) < MBTCP_RSP_MAX_LEN){
+            if(client_flush(gw, client) != 0){
+                return -1;
+            }
+            if(client->blocked){
+                // answered once the client reads the responses queued
+                break;
+            }
+        }
+        uint8_t* rsp = &client->tx[client->tx_len];
+        uint8_t pdu_len = handle_pdu(gw, adu[6], &adu[MBAP_LEN], length - 1, &rsp[MBAP_LEN]);
+        rsp[0] = adu[0];
+        rsp[1] = adu[1];
+        rsp[2] = 0;
+        rsp[3] = 0;
+        rsp[4] = 0;
+        rsp[5] = pdu_len + 1;
+        rsp[6] = adu[6];
+        client->tx_len += MBAP_LEN + pdu_len;
+        pos += 6 + length;
+    }
+    memmove(client->rx, &client->rx[pos], client->rx_len - pos);
+    client->rx_len -= pos;
+    return 0;
+}
+
+
+static int client_flush(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client){
+    if(client->tx_len > 0){
+        ssize_t sent = send(client->fd, client->tx, client->tx_len, MSG_NOSIGNAL);
+        if(sent < 0){
+            if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)){
+                return -1;
+            }
+            sent = 0;
+        }
+        memmove(client->tx, &client->tx[sent], client->tx_len - sent);
+        client->tx_len -= (uint16_t) sent;
+    }
+    // a client that does not read its responses stops being read, its requests cannot pile up
+    uint8_t blocked = (client->tx_len > 0) ? 1 : 0;
+    if(blocked != client->blocked){
+        struct epoll_event ev = {.events = (blocked ? EPOLLOUT : EPOLLIN), .data.ptr = client};
+        if(epoll_ctl(gw->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) != 0){
+            return -1;
+        }
+        client->blocked = blocked;
+    }
+    return 0;
+}
+
+
+static void client_close(probe_mbtcp_obj* gw, probe_mbtcp_client_t* client){
+    epoll_ctl(gw->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    gw->connected--;
+}
+
+
+static uint8_t handle_pdu(probe_mbtcp_obj* gw, uint8_t unit, const uint8_t* req, uint16_t len, uint8_t* rsp){
+    probe_node_obj* node = gw->units[unit];
+    uint8_t exception = 0;
+    uint16_t start = 0;
+    uint16_t count = 0;
+    probe_measurements_t m;
+    gw->requests++;
+    if(req[0] != MBTCP_READ_INPUT_REGS){
+        exception = MBTCP_EXC_ILLEGAL_FUNCTION;
+    }
+    else if(len != 5){
+        exception = MBTCP_EXC_ILLEGAL_VALUE;
+    }
+    else{
+        start = (req[1] << 8) | req[2];
+        count = (req[3] << 8) | req[4];
+        if((count == 0) || (count > MBTCP_MAX_READ_COUNT)){
+            exception = MBTCP_EXC_ILLEGAL_VALUE;
+        }
+        else if((start + count) > PROBE_MBTCP_REG_COUNT){
+            exception = MBTCP_EXC_ILLEGAL_ADDRESS;
+        }
+        else if(node == NULL){
+            exception = MBTCP_EXC_PATH_UNAVAILABLE;
+        }
+    }
+    if(exception == 0){
+        // lock-free copy, the bus is never waited for
+        photometric_probe_get_measurements(node->probe, &m);
+        for(uint16_t reg = start; reg < (start + count); reg++){
+            if(!value_fresh(gw, node, &m.time[reg])){
+                exception = MBTCP_EXC_TARGET_FAILED;
+                gw->stale++;
+                break;
+            }
+        }
+    }
+    if(exception != 0){
+        gw->exceptions++;
+        rsp[0] = req[0] | 0x80;
+        rsp[1] = exception;
+        return 2;
+    }
+    rsp[0] = MBTCP_READ_INPUT_REGS;
+    rsp[1] = count * 2;
+    for(uint16_t i = 0; i < count; i++){
+        uint16_t value = reg_encode(node->probe, &m, start + i);
+        rsp[2 + (i * 2)] = value >> 8;
+        rsp[3 + (i * 2)] = value & 0xFF;
+    }
+    return 2 + (count * 2);
+}
+
+
+static uint8_t value_fresh(const probe_mbtcp_obj* gw, const probe_node_obj* node, const probe_rx_time_t* time){
+    const photometric_probe_obj* probe = node->probe;
+    // the engine leaves the values of a failed update or a lost bus in place, only the status of the probe tells
+    if(node->status != STATUS_OK){
+        return 0;
+    }
+    if(probe->get_time_us == NULL){
+        return 1;
+    }
+    // never read
+    if((time->first_us == 0) && (time->last_us == 0)){
+        return 0;
+    }
+    uint32_t age_us = probe->get_time_us() - time->last_us;
+    return ((gw->max_age_ms == 0) || ((age_us / 1000) <= gw->max_age_ms)) ? 1 : 0;
+}
+
+
+static uint16_t reg_encode(const photometric_probe_obj* probe, const probe_measurements_t* m, uint8_t reg){
+    switch(reg){
+        case PROBE_VALUE_CELSIUS:
+            return (uint16_t) (int16_t) lroundf(m->internal_temp_celsius * 10.0f);
+        case PROBE_VALUE_FAHRENHEIT:
+            return (uint16_t) (int16_t) lroundf(m->internal_temp_fahrenheit * 10.0f);
+        case PROBE_VALUE_ILLUMINANCE:{
+            // the probe register counts tens of lux in HIGH_RANGE
+            uint32_t raw = (probe->cfg.range == HIGH_RANGE) ? (m->illuminance / 10) : m->illuminance;
+            return (raw > UINT16_MAX) ? UINT16_MAX : (uint16_t) raw;
+        }
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,130 @@
+/**
+ * @file lpph_mbtcp.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the Modbus TCP gateway serving the cached values of the probes polled by a bus engine
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_MBTCP_H
+#define LPPH_MBTCP_H
+
+#include "lpph_engine.h"
+#include "lpph_linux.h"
+
+#ifndef PROBE_MBTCP_MAX_EVENTS
+#define PROBE_MBTCP_MAX_EVENTS      64 // client events served per wakeup, the rest on the next one
+#endif
+
+#ifndef PROBE_MBTCP_TX_LEN
+#define PROBE_MBTCP_TX_LEN          256 // responses waiting for a slow client, reading its requests stops once full
+#endif
+
+#define PROBE_MBTCP_PORT            502
+#define PROBE_MBTCP_ADU_LEN         260 // longest frame, 7 bytes MBAP header and 253 bytes PDU
+#define PROBE_MBTCP_REG_COUNT       PROBE_VALUE_COUNT // input registers of a unit, LPPHOT03 map
+
+/**
+ * @brief Modbus exception codes answered by the gateway
+ * 
+ */
+typedef enum{
+    MBTCP_EXC_ILLEGAL_FUNCTION = 0x01,
+    MBTCP_EXC_ILLEGAL_ADDRESS = 0x02,
+    MBTCP_EXC_ILLEGAL_VALUE = 0x03,
+    MBTCP_EXC_PATH_UNAVAILABLE = 0x0A, // no probe with this unit id
+    MBTCP_EXC_TARGET_FAILED = 0x0B // values never read or stale
+}probe_mbtcp_exception_e;
+
+/**
+ * @brief Structure for a client connection
+ * 
+ */
+typedef struct{
+    int fd; // -1 if the slot is free
+    uint8_t rx[PROBE_MBTCP_ADU_LEN]; // partial request
+    uint16_t rx_len;
+    uint8_t tx[PROBE_MBTCP_TX_LEN]; // responses not yet accepted by the socket
+    uint16_t tx_len;
+    uint8_t blocked; // 1 while waiting for the socket to accept tx, requests are not read
+}probe_mbtcp_client_t;
+
+/**
+ * @brief Structure for a Modbus TCP gateway object
+ * 
+ */
+typedef struct{
+    probe_engine_obj* engine;
+    int listen_fd; // -1 until listening
+    int epoll_fd; // listening socket and clients, readable when one of them is ready
+    uint16_t port; // bound TCP port
+    probe_mbtcp_client_t* clients;
+    uint16_t max_clients;
+    uint16_t connected; // number of connected clients
+    uint32_t max_age_ms; // oldest value served, older ones are answered with MBTCP_EXC_TARGET_FAILED, 0 for no limit
+    probe_node_obj* units[256]; // polled probe of each unit id, NULL if none
+    probe_linux_watch_t watch; // wait shared with the serial ports
+    uint32_t requests; // number of requests served, exceptions included
+    uint32_t exceptions; // number of exception responses
+    uint32_t stale; // number of requests answered MBTCP_EXC_TARGET_FAILED
+    uint32_t rejected; // number of connections closed because all client slots were taken
+}probe_mbtcp_obj;
+
+/**
+ * @brief Initializes a gateway serving the probes of an engine, every probe is served under its address as unit id
+ * @note Probes must be added to the engine before. Clients never cause a bus transaction: function 0x04 is answered from the
+ * values of the last poll, registers 0 to 2 in the LPPHOT03 map (Celsius and Fahrenheit x10, illuminance) whatever the probe variant,
+ * so the bus load only follows the engine poll periods however many clients connect
+ * 
+ * @param gw: A pointer to a gateway object
+ * @param engine: A pointer to a bus engine object with its probes added
+ * @param clients: client slots, one per connection served at a time
+ * @param max_clients: number of client slots
+ * @param max_age_ms: oldest value served, measured from the response it was decoded from with the probe get_time_us, 0 for no limit.
+ * Without get_time_us, values are served while the last update of the probe succeeded
+ * @retval STATUS_OK if every probe has its own unit id
+ * @retval STATUS_ERR if probes of different buses share an address, only one of them is served under it
+ */
+probe_status_e probe_mbtcp_init(probe_mbtcp_obj* gw, probe_engine_obj* engine, probe_mbtcp_client_t* clients, uint16_t max_clients, uint32_t max_age_ms);
+
+/**
+ * @brief Opens the listening socket of a gateway
+ * 
+ * @param gw: A pointer to a gateway object
+ * @param addr: IPv4 address to bind, NULL for all interfaces
+ * @param port: TCP port, PROBE_MBTCP_PORT for the standard port, 0 for any free port (see gw->port)
+ * @retval STATUS_OK if listening
+ * @retval STATUS_ERR otherwise, see errno
+ */
+probe_status_e probe_mbtcp_listen(probe_mbtcp_obj* gw, const char* addr, uint16_t port);
+
+/**
+ * @brief Serves the gateway from the thread of a Linux backend, client events are handled in probe_linux_run_once
+ * 
+ * @param gw: A pointer to a listening gateway object
+ * @param lx: A pointer to a Linux backend object
+ * @retval STATUS_OK if attached
+ * @retval STATUS_ERR otherwise, see errno
+ */
+probe_status_e probe_mbtcp_attach(probe_mbtcp_obj* gw, probe_linux_obj* lx);
+
+/**
+ * @brief Accepts connections and serves the requests ready, without waiting
+ * @note Called by the Linux backend once attached, or by the application when gw->epoll_fd is readable
+ * 
+ * @param gw: A pointer to a listening gateway object
+ */
+void probe_mbtcp_process(probe_mbtcp_obj* gw);
+
+/**
+ * @brief Closes all client connections and the listening socket
+ * @note Once attached, the gateway is watched until the Linux backend is closed, close the backend first
+ * 
+ * @param gw: A pointer to a gateway object
+ */
+void probe_mbtcp_close(probe_mbtcp_obj* gw);
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * @file lpph_os_pthread.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the POSIX threads implementation of the probe OS hooks
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "lpph_os_pthread.h"
+#include "time.h"
+#include "errno.h"
+#include "sched.h"
+
+
+/**
+ * @brief Takes the bus lock, sleeping until the earlier tasks released it
+ * 
+ * @param mutex: pointer to POSIX OS services object
+ */
+static void mutex_lock(void* mutex);
+
+/**
+ * @brief Releases the bus lock to the next task in line
+ * 
+ * @param mutex: pointer to POSIX OS services object
+ */
+static void mutex_unlock(void* mutex);
+
+/**
+ * @brief Sleeps until the event is signaled or the timeout elapses, consuming the signal
+ * 
+ * @param event: pointer to POSIX OS services object
+ * @param timeout_us: longest wait in microseconds, 0 to poll
+ * @return uint8_t: 1 if signaled, 0 on timeout
+ */
+static uint8_t event_wait(void* event, uint32_t timeout_us);
+
+/**
+ * @brief Signals the event, waking the waiting task
+ * 
+ * @param event: pointer to POSIX OS services object
+ */
+static void event_signal(void* event);
+
+/**
+ * @brief Lets other threads run, for tasks spinning on a probe_bus_lock_t
+ * 
+ */
+static void task_yield(void);
+
+
+
+probe_status_e probe_os_pthread_init(probe_os_pthread_t* os){
+    pthread_condattr_t attr;
+    if(pthread_mutex_init(&os->mutex, NULL) != 0){
+        return STATUS_ERR;
+    }
+    if(pthread_cond_init(&os->turn, NULL) != 0){
+        pthread_mutex_destroy(&os->mutex);
+        return STATUS_ERR;
+    }
+    if(pthread_mutex_init(&os->event_lock, NULL) != 0){
+        pthread_cond_destroy(&os->turn);
+        pthread_mutex_destroy(&os->mutex);
+        return STATUS_ERR;
+    }
+    // timeouts must not jump with the wall clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int ret = pthread_cond_init(&os->event_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if(ret != 0){
+        pthread_mutex_destroy(&os->event_lock);
+        pthread_cond_destroy(&os->turn);
+        pthread_mutex_destroy(&os->mutex);
+        return STATUS_ERR;
+    }
+    os->next = 0;
+    os->serving = 0;
+    os->signaled = 0;
+    os->hooks.mutex = os;
+    os->hooks.mutex_lock = &mutex_lock;
+    os->hooks.mutex_unlock = &mutex_unlock;
+    os->hooks.event = os;
+    os->hooks.event_wait = &event_wait;
+    os->hooks.event_signal_from_isr = &event_signal;
+    os->hooks.yield = &task_yield;
+    return STATUS_OK;
+}
+
+void probe_os_pthread_deinit(probe_os_pthread_t* os){
+    pthread_cond_destroy(&os->event_cond);
+    pthread_mutex_destroy(&os->event_lock);
+    pthread_cond_destroy(&os->turn);
+    pthread_mutex_destroy(&os->mutex);
+}
+
+
+static void mutex_lock(void* mutex){
+    probe_os_pthread_t* os = (probe_os_pthread_t*) mutex;
+    pthread_mutex_lock(&os->mutex);
+    uint32_t ticket = os->next++;
+    while(os->serving != ticket){
+        pthread_cond_wait(&os->turn, &os->mutex);
+    }
+    pthread_mutex_unlock(&os->mutex);
+}
+
+
+static void mutex_unlock(void* mutex){
+    probe_os_pthread_t* os = (probe_os_pthread_t*) mutex;
+    pthread_mutex_lock(&os->mutex);
+    os->serving++;
+    // every waiter checks its ticket, only the next one proceeds
+    pthread_cond_broadcast(&os->turn);
+    pthread_mutex_unlock(&os->mutex);
+}
+
+
+static uint8_t event_wait(void* event, uint32_t timeout_us){
+    probe_os_pthread_t* os = (probe_os_pthread_t*) event;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_us / 1000000;
+    deadline.tv_nsec += (long) (timeout_us % 1000000) * 1000;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&os->event_lock);
+    int ret = 0;
+    while(!os->signaled && (ret != ETIMEDOUT)){
+        ret = pthread_cond_timedwait(&os->event_cond, &os->event_lock, &deadline);
+    }
+    uint8_t signaled = os->signaled;
+    os->signaled = 0;
+    pthread_mutex_unlock(&os->event_lock);
+    return signaled;
+}
+
+
+static void event_signal(void* event){
+    probe_os_pthread_t* os = (probe_os_pthread_t*) event;
+    pthread_mutex_lock(&os->event_lock);
+    os->signaled = 1;
+    pthread_cond_signal(&os->event_cond);
+    pthread_mutex_unlock(&os->event_lock);
+}
+
+
+static void task_yield(void){
+    sched_yield();
+}
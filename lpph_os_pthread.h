@@ -0,0 +1,49 @@
+/**
+ * @file lpph_os_pthread.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the POSIX threads implementation of the probe OS hooks
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_OS_PTHREAD_H
+#define LPPH_OS_PTHREAD_H
+
+#include "lpph.h"
+#include "pthread.h"
+
+/**
+ * @brief OS services of a bus, the receiving thread plays the role of the RX complete ISR
+ * 
+ */
+typedef struct{
+    pthread_mutex_t mutex; // protects the bus tickets
+    pthread_cond_t turn; // signaled when the bus changes owner
+    uint32_t next; // next ticket handed out
+    uint32_t serving; // ticket owning the bus, tasks sleep until their turn so the bus is granted in arrival order
+    pthread_mutex_t event_lock;
+    pthread_cond_t event_cond; // waits on the monotonic clock
+    uint8_t signaled;
+    probe_os_hooks_t hooks; // to be set as the os field of the probes of the bus
+}probe_os_pthread_t;
+
+/**
+ * @brief Creates the mutex and event of a bus and fills its hooks
+ * 
+ * @param os: A pointer to a POSIX OS services object
+ * @retval STATUS_OK if created
+ * @retval STATUS_ERR otherwise
+ */
+probe_status_e probe_os_pthread_init(probe_os_pthread_t* os);
+
+/**
+ * @brief Destroys the mutex and event of a bus, no task may be using them
+ * 
+ * @param os: A pointer to a POSIX OS services object
+ */
+void probe_os_pthread_deinit(probe_os_pthread_t* os);
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ * @file lpph_serialize.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the JSON and CBOR serializers of probe samples
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_serialize.h"
+#include "string.h"
+
+#define CBOR_UINT                   0x00 // major type 0
+#define CBOR_MAP                    0xA0 // major type 5
+#define CBOR_ARRAY_INDEFINITE       0x9F
+#define CBOR_FALSE                  0xF4
+#define CBOR_TRUE                   0xF5
+#define CBOR_FLOAT32                0xFA
+#define CBOR_BREAK                  0xFF
+
+/**
+ * @brief Writes an unsigned integer in decimal
+ * 
+ * @param out: output, at least 10 bytes
+ * @param value: integer
+ * @return uint8_t: number of characters written
+ */
+static uint8_t write_decimal(uint8_t* out, uint32_t value);
+
+/**
+ * @brief Writes a temperature with one decimal, rounded to the nearest 0.1
+ * 
+ * @param out: output, at least 12 bytes
+ * @param celsius: temperature
+ * @return uint8_t: number of characters written
+ */
+static uint8_t write_tenths(uint8_t* out, float celsius);
+
+/**
+ * @brief Writes the head of a CBOR data item with its argument in the shortest form
+ * 
+ * @param out: output, at least 5 bytes
+ * @param major: major type, in the top 3 bits
+ * @param value: argument
+ * @return uint8_t: number of bytes written
+ */
+static uint8_t write_cbor_head(uint8_t* out, uint8_t major, uint32_t value);
+
+/**
+ * @brief Writes a JSON or CBOR literal
+ * 
+ * @param out: output
+ * @param lit: literal
+ * @param len: length of the literal
+ * @return uint8_t: len
+ */
+static uint8_t write_literal(uint8_t* out, const char* lit, uint8_t len);
+
+// pairs of digits, halves the divisions of decimal formatting
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+
+void probe_json_begin(probe_serializer_t* ser, uint8_t* buf, size_t size){
+    ser->buf = buf;
+    ser->size = size;
+    ser->len = 0;
+    ser->count = 0;
+    ser->overflow = 0;
+    if(size < 3){
+        // "[]" and its NUL
+        ser->overflow = 1;
+        return;
+    }
+    buf[ser->len++] = '[';
+}
+
+uint16_t probe_json_add(probe_serializer_t* ser, const probe_sample_t* samples, uint16_t n){
+    uint16_t i;
+    for(i = 0; i < n; i++){
+        // room is checked once per sample, "]" and NUL stay reserved
+        if(ser->overflow || ((ser->size - ser->len) < (PROBE_JSON_SAMPLE_MAX_LEN + 2))){
+            ser->overflow = 1;
+            break;
+        }
+        const probe_sample_t* sample = &samples[i];
+        uint8_t* out = &ser->buf[ser->len];
+        uint8_t* p = out;
+        if(ser->count){
+            *p++ = ',';
+        }
+        p += write_literal(p, "{\"addr\":", 8);
+        p += write_decimal(p, sample->address);
+        p += write_literal(p, ",\"ts\":", 6);
+        p += write_decimal(p, sample->timestamp_us);
+        p += write_literal(p, ",\"lux\":", 7);
+        p += write_decimal(p, sample->illuminance);
+        p += write_literal(p, ",\"temp\":", 8);
+        p += write_tenths(p, sample->internal_temp_celsius);
+        if(sample->status == STATUS_OK){
+            p += write_literal(p, ",\"ok\":true}", 11);
+        }
+        else{
+            p += write_literal(p, ",\"ok\":false}", 12);
+        }
+        ser->len += p - out;
+        ser->count++;
+    }
+    return i;
+}
+
+size_t probe_json_end(probe_serializer_t* ser){
+    if(ser->overflow){
+        return 0;
+    }
+    ser->buf[ser->len++] = ']';
+    ser->buf[ser->len] = '\0';
+    return ser->len;
+}
+
+void probe_cbor_begin(probe_serializer_t* ser, uint8_t* buf, size_t size){
+    ser->buf = buf;
+    ser->size = size;
+    ser->len = 0;
+    ser->count = 0;
+    ser->overflow = 0;
+    if(size < 2){
+        ser->overflow = 1;
+        return;
+    }
+    buf[ser->len++] = CBOR_ARRAY_INDEFINITE;
+}
+
+uint16_t probe_cbor_add(probe_serializer_t* ser, const probe_sample_t* samples, uint16_t n){
+    uint16_t i;
+    for(i = 0; i < n; i++){
+        // the break byte stays reserved
+        if(ser->overflow || ((ser->size - ser->len) < (PROBE_CBOR_SAMPLE_MAX_LEN + 1))){
+            ser->overflow = 1;
+            break;
+        }
+        const probe_sample_t* sample = &samples[i];
+        uint8_t* out = &ser->buf[ser->len];
+        uint8_t* p = out;
+        uint32_t bits;
+        memcpy(&bits, &sample->internal_temp_celsius, sizeof(bits));
+        *p++ = CBOR_MAP | 5;
+        p += write_literal(p, "\x64" "addr", 5);
+        p += write_cbor_head(p, CBOR_UINT, sample->address);
+        p += write_literal(p, "\x62" "ts", 3);
+        p += write_cbor_head(p, CBOR_UINT, sample->timestamp_us);
+        p += write_literal(p, "\x63" "lux", 4);
+        p += write_cbor_head(p, CBOR_UINT, sample->illuminance);
+        p += write_literal(p, "\x64" "temp", 5);
+        // big endian IEEE 754 single
+        *p++ = CBOR_FLOAT32;
+        *p++ = bits >> 24;
+        *p++ = (bits >> 16) & 0xFF;
+        *p++ = (bits >> 8) & 0xFF;
+        *p++ = bits & 0xFF;
+        p += write_literal(p, "\x62" "ok", 3);
+        *p++ = (sample->status == STATUS_OK) ? CBOR_TRUE : CBOR_FALSE;
+        ser->len += p - out;
+        ser->count++;
+    }
+    return i;
+}
+
+size_t probe_cbor_end(probe_serializer_t* ser){
+    if(ser->overflow){
+        return 0;
+    }
+    ser->buf[ser->len++] = CBOR_BREAK;
+    return ser->len;
+}
+
+
+static uint8_t write_decimal(uint8_t* out, uint32_t value){
+    uint8_t tmp[10];
+    uint8_t pos = sizeof(tmp);
+    while(value >= 100){
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        tmp[--pos] = digit_pairs[pair + 1];
+        tmp[--pos] = digit_pairs[pair];
+    }
+    if(value >= 10){
+        tmp[--pos] = digit_pairs[(value * 2) + 1];
+        tmp[--pos] = digit_pairs[value * 2];
+    }
+    else{
+        tmp[--pos] = '0' + value;
+    }
+    uint8_t len = sizeof(tmp) - pos;
+    memcpy(out, &tmp[pos], len);
+    return len;
+}
+
+
+static uint8_t write_tenths(uint8_t* out, float celsius){
+    // fixed point, clamped to the int32 range
+    float scaled = celsius * 10.0f;
+    int32_t tenths;
+    if(scaled >= 2147483520.0f){
+        tenths = INT32_MAX;
+    }
+    else if(scaled <= -2147483520.0f){
+        tenths = -INT32_MAX;
+    }
+    else if(scaled == scaled){
+        tenths = (int32_t) ((scaled >= 0) ? (scaled + 0.5f) : (scaled - 0.5f));
+    }
+    else{
+        // NaN
+        tenths = 0;
+    }
+    uint8_t len = 0;
+    uint32_t magnitude = (uint32_t) tenths;
+    if(tenths < 0){
+        out[len++] = '-';
+        magnitude = (uint32_t) -tenths;
+    }
+    len += write_decimal(&out[len], magnitude / 10);
+    out[len++] = '.';
+    out[len++] = '0' + (magnitude % 10);
+    return len;
+}
+
+
+static uint8_t write_cbor_head(uint8_t* out, uint8_t major, uint32_t value){
+    if(value < 24){
+        out[0] = major | value;
+        return 1;
+    }
+    if(value <= 0xFF){
+        out[0] = major | 24;
+        out[1] = value;
+        return 2;
+    }
+    if(value <= 0xFFFF){
+        out[0] = major | 25;
+        out[1] = value >> 8;
+        out[2] = value & 0xFF;
+        return 3;
+    }
+    out[0] = major | 26;
+    out[1] = value >> 24;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 8) & 0xFF;
+    out[4] = value & 0xFF;
+    return 5;
+}
+
+
+static uint8_t write_literal(uint8_t* out, const char* lit, uint8_t len){
+    memcpy(out, lit, len);
+    return len;
+}
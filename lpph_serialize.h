@@ -0,0 +1,89 @@
+/**
+ * @file lpph_serialize.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the JSON and CBOR serializers of probe samples, for uplinks
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_SERIALIZE_H
+#define LPPH_SERIALIZE_H
+
+#include "lpph.h"
+#include "stddef.h"
+
+#define PROBE_JSON_SAMPLE_MAX_LEN   80 // longest JSON object of a sample, separator included
+#define PROBE_CBOR_SAMPLE_MAX_LEN   42 // longest CBOR map of a sample
+
+/**
+ * @brief Serializer writing a stream of samples into a caller provided buffer, without heap
+ * @note Samples are written as an array of objects {"addr", "ts", "lux", "temp", "ok"}, the temperature with 0.1 C resolution.
+ * Once a sample does not fit, the serializer stops writing and the end call reports the overflow
+ * 
+ */
+typedef struct{
+    uint8_t* buf;
+    size_t size;
+    size_t len; // bytes written
+    uint16_t count; // samples written
+    uint8_t overflow; // 1 once a write did not fit
+}probe_serializer_t;
+
+/**
+ * @brief Starts a JSON array of samples
+ * 
+ * @param ser: A pointer to a serializer object
+ * @param buf: output buffer
+ * @param size: output buffer size
+ */
+void probe_json_begin(probe_serializer_t* ser, uint8_t* buf, size_t size);
+
+/**
+ * @brief Appends a batch of samples to a JSON array
+ * 
+ * @param ser: A pointer to a serializer object
+ * @param samples: An array of n samples
+ * @param n: Number of samples
+ * @return uint16_t: number of samples written, less than n if the buffer is full
+ */
+uint16_t probe_json_add(probe_serializer_t* ser, const probe_sample_t* samples, uint16_t n);
+
+/**
+ * @brief Closes a JSON array of samples, NUL terminated
+ * 
+ * @param ser: A pointer to a serializer object
+ * @return size_t: length of the JSON text, 0 if the buffer overflowed
+ */
+size_t probe_json_end(probe_serializer_t* ser);
+
+/**
+ * @brief Starts a CBOR array of samples, of indefinite length so samples can be streamed
+ * 
+ * @param ser: A pointer to a serializer object
+ * @param buf: output buffer
+ * @param size: output buffer size
+ */
+void probe_cbor_begin(probe_serializer_t* ser, uint8_t* buf, size_t size);
+
+/**
+ * @brief Appends a batch of samples to a CBOR array, temperatures are encoded as single precision floats
+ * 
+ * @param ser: A pointer to a serializer object
+ * @param samples: An array of n samples
+ * @param n: Number of samples
+ * @return uint16_t: number of samples written, less than n if the buffer is full
+ */
+uint16_t probe_cbor_add(probe_serializer_t* ser, const probe_sample_t* samples, uint16_t n);
+
+/**
+ * @brief Closes a CBOR array of samples
+ * 
+ * @param ser: A pointer to a serializer object
+ * @return size_t: length of the CBOR data, 0 if the buffer overflowed
+ */
+size_t probe_cbor_end(probe_serializer_t* ser);
+
+#endif
@@ -0,0 +1,296 @@
+/**
+ * @file lpph_telemetry.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the compact binary batch format of probe samples
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * Frame layout, multi-byte fixed fields little endian:
+ *     version (bits 0-3) | TELEMETRY_FLAG_NULLS
+ *     base_us (4 bytes), interval_us (varint), count (1 byte), lux_step (varint), temp_step (varint)
+ *     bitmap length (1 byte), probe bitmap (bit a for address a)
+ *     per probe: [validity bitmap], illuminance values, temperature values
+ * Values of valid samples only, the first one as is and the next ones as deltas, all zigzag varints.
+ */
+
+#include "lpph_telemetry.h"
+#include "string.h"
+
+#define TELEMETRY_FLAG_NULLS        0x10 // validity bitmaps present
+#define TELEMETRY_BITMAP_MAX        32 // bytes of the probe bitmap, addresses 0 to 255
+
+/**
+ * @brief Bounded byte stream
+ * 
+ */
+typedef struct{
+    uint8_t* buf;
+    size_t size;
+    size_t pos;
+    uint8_t overflow; // 1 once a write or read went past size
+}telemetry_stream_t;
+
+/**
+ * @brief Appends a byte
+ * 
+ * @param s: A pointer to a stream
+ * @param byte: byte
+ */
+static void put_byte(telemetry_stream_t* s, uint8_t byte);
+
+/**
+ * @brief Appends an unsigned LEB128 varint
+ * 
+ * @param s: A pointer to a stream
+ * @param value: value
+ */
+static void put_varint(telemetry_stream_t* s, uint64_t value);
+
+/**
+ * @brief Reads a byte
+ * 
+ * @param s: A pointer to a stream
+ * @return uint8_t: byte, 0 past the end
+ */
+static uint8_t get_byte(telemetry_stream_t* s);
+
+/**
+ * @brief Reads an unsigned LEB128 varint of up to 64 bits
+ * 
+ * @param s: A pointer to a stream
+ * @return uint64_t: value, 0 past the end
+ */
+static uint64_t get_varint(telemetry_stream_t* s);
+
+/**
+ * @brief Quantises a temperature
+ * 
+ * @param celsius: temperature
+ * @param step: quantum in 0.01 C
+ * @return int32_t: temperature in steps, clamped to the int32 range
+ */
+static int32_t quantise_temp(float celsius, uint16_t step);
+
+/**
+ * @brief Maps a signed delta to an unsigned value, small magnitudes giving small values
+ * 
+ * @param value: delta
+ * @return uint64_t
+ */
+static uint64_t zigzag(int64_t value);
+
+/**
+ * @brief Inverse of zigzag
+ * 
+ * @param value: zigzag value
+ * @return int64_t: delta
+ */
+static int64_t unzigzag(uint64_t value);
+
+
+
+probe_status_e probe_telemetry_encode(const probe_telemetry_cfg_t* cfg, const probe_sample_t* samples, uint16_t probes, uint8_t* buf, size_t size, size_t* len){
+    if((cfg->count == 0) || (cfg->lux_step == 0) || (cfg->temp_step == 0)){
+        return STATUS_ERR;
+    }
+    uint8_t bitmap[TELEMETRY_BITMAP_MAX] = {0};
+    uint8_t bitmap_len = 0;
+    uint8_t flags = 0;
+    for(uint16_t p = 0; p < probes; p++){
+        const probe_sample_t* row = &samples[p * cfg->count];
+        if((p > 0) && (row[0].address <= samples[(p - 1) * cfg->count].address)){
+            return STATUS_ERR;
+        }
+        bitmap[row[0].address >> 3] |= 1 << (row[0].address & 7);
+        bitmap_len = (row[0].address >> 3) + 1;
+        for(uint8_t k = 0; k < cfg->count; k++){
+            if(row[k].status != STATUS_OK){
+                flags = TELEMETRY_FLAG_NULLS;
+            }
+        }
+    }
+    telemetry_stream_t s = {buf, size, 0, 0};
+    put_byte(&s, PROBE_TELEMETRY_VERSION | flags);
+    for(uint8_t i = 0; i < 4; i++){
+        put_byte(&s, (cfg->base_us >> (8 * i)) & 0xFF);
+    }
+    put_varint(&s, cfg->interval_us);
+    put_byte(&s, cfg->count);
+    put_varint(&s, cfg->lux_step);
+    put_varint(&s, cfg->temp_step);
+    put_byte(&s, bitmap_len);
+    for(uint8_t i = 0; i < bitmap_len; i++){
+        put_byte(&s, bitmap[i]);
+    }
+    for(uint16_t p = 0; p < probes; p++){
+        const probe_sample_t* row = &samples[p * cfg->count];
+        if(flags){
+            uint8_t valid = 0;
+            for(uint8_t k = 0; k < cfg->count; k++){
+                if(row[k].status == STATUS_OK){
+                    valid |= 1 << (k & 7);
+                }
+                if(((k & 7) == 7) || (k == (cfg->count - 1))){
+                    put_byte(&s, valid);
+                    valid = 0;
+                }
+            }
+        }
+        // deltas between valid samples, the first value against 0
+        int64_t prev = 0;
+        for(uint8_t k = 0; k < cfg->count; k++){
+            if(row[k].status == STATUS_OK){
+                int64_t q = ((uint64_t) row[k].illuminance + (cfg->lux_step / 2)) / cfg->lux_step;
+                put_varint(&s, zigzag(q - prev));
+                prev = q;
+            }
+        }
+        prev = 0;
+        for(uint8_t k = 0; k < cfg->count; k++){
+            if(row[k].status == STATUS_OK){
+                int64_t q = quantise_temp(row[k].internal_temp_celsius, cfg->temp_step);
+                put_varint(&s, zigzag(q - prev));
+                prev = q;
+            }
+        }
+    }
+    if(s.overflow){
+        return STATUS_ERR;
+    }
+    *len = s.pos;
+    return STATUS_OK;
+}
+
+probe_status_e probe_telemetry_decode(const uint8_t* buf, size_t len, probe_telemetry_cfg_t* cfg, probe_sample_t* samples, uint16_t max_samples, uint16_t* n){
+    telemetry_stream_t s = {(uint8_t*) buf, len, 0, 0};
+    uint8_t head = get_byte(&s);
+    if((head & 0x0F) != PROBE_TELEMETRY_VERSION){
+        return STATUS_ERR;
+    }
+    cfg->base_us = 0;
+    for(uint8_t i = 0; i < 4; i++){
+        cfg->base_us |= (uint32_t) get_byte(&s) << (8 * i);
+    }
+    cfg->interval_us = get_varint(&s);
+    cfg->count = get_byte(&s);
+    cfg->lux_step = get_varint(&s);
+    cfg->temp_step = get_varint(&s);
+    uint8_t bitmap_len = get_byte(&s);
+    if(s.overflow || (cfg->count == 0) || (cfg->lux_step == 0) || (cfg->temp_step == 0) || (bitmap_len > TELEMETRY_BITMAP_MAX) || ((s.pos + bitmap_len) > len)){
+        return STATUS_ERR;
+    }
+    const uint8_t* bitmap = &buf[s.pos];
+    s.pos += bitmap_len;
+    uint16_t decoded = 0;
+    for(uint16_t address = 0; address < (bitmap_len * 8); address++){
+        if(!(bitmap[address >> 3] & (1 << (address & 7)))){
+            continue;
+        }
+        if((decoded + cfg->count) > max_samples){
+            return STATUS_ERR;
+        }
+        probe_sample_t* row = &samples[decoded];
+        decoded += cfg->count;
+        uint8_t valid = 0xFF;
+        for(uint8_t k = 0; k < cfg->count; k++){
+            if((head & TELEMETRY_FLAG_NULLS) && ((k & 7) == 0)){
+                valid = get_byte(&s);
+            }
+            row[k].address = address;
+            row[k].status = (valid & (1 << (k & 7))) ? STATUS_OK : STATUS_ERR;
+            row[k].timestamp_us = cfg->base_us + (k * cfg->interval_us);
+            row[k].illuminance = 0;
+            row[k].internal_temp_celsius = 0;
+        }
+        // wrapping sums, malformed frames give wrong values but no overflow
+        uint64_t prev = 0;
+        for(uint8_t k = 0; k < cfg->count; k++){
+            if(row[k].status == STATUS_OK){
+                prev += (uint64_t) unzigzag(get_varint(&s));
+                row[k].illuminance = prev * cfg->lux_step;
+            }
+        }
+        prev = 0;
+        for(uint8_t k = 0; k < cfg->count; k++){
+            if(row[k].status == STATUS_OK){
+                prev += (uint64_t) unzigzag(get_varint(&s));
+                row[k].internal_temp_celsius = ((float) (int64_t) prev * cfg->temp_step) / 100.0f;
+            }
+        }
+    }
+    if(s.overflow || (s.pos != len)){
+        return STATUS_ERR;
+    }
+    *n = decoded;
+    return STATUS_OK;
+}
+
+
+static void put_byte(telemetry_stream_t* s, uint8_t byte){
+    if(s->pos >= s->size){
+        s->overflow = 1;
+        return;
+    }
+    s->buf[s->pos++] = byte;
+}
+
+
+static void put_varint(telemetry_stream_t* s, uint64_t value){
+    while(value >= 0x80){
+        put_byte(s, (value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    put_byte(s, value);
+}
+
+
+static uint8_t get_byte(telemetry_stream_t* s){
+    if(s->pos >= s->size){
+        s->overflow = 1;
+        return 0;
+    }
+    return s->buf[s->pos++];
+}
+
+
+static uint64_t get_varint(telemetry_stream_t* s){
+    uint64_t value = 0;
+    for(uint8_t shift = 0; shift < 64; shift += 7){
+        uint8_t byte = get_byte(s);
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            return value;
+        }
+    }
+    // longer than 64 bits
+    s->overflow = 1;
+    return 0;
+}
+
+
+static int32_t quantise_temp(float celsius, uint16_t step){
+    float q = (celsius * 100.0f) / step;
+    if(q >= 2147483520.0f){
+        return INT32_MAX;
+    }
+    if(q <= -2147483520.0f){
+        return -INT32_MAX;
+    }
+    if(q != q){
+        // NaN
+        return 0;
+    }
+    return (int32_t) ((q >= 0) ? (q + 0.5f) : (q - 0.5f));
+}
+
+
+static uint64_t zigzag(int64_t value){
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+
+static int64_t unzigzag(uint64_t value){
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
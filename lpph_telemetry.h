@@ -0,0 +1,66 @@
+/**
+ * @file lpph_telemetry.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the compact binary batch format of probe samples, for constrained uplinks
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_TELEMETRY_H
+#define LPPH_TELEMETRY_H
+
+#include "lpph.h"
+#include "stddef.h"
+
+#define PROBE_TELEMETRY_VERSION     1
+#define PROBE_TELEMETRY_HEADER_MAX  49 // longest header, probe bitmap included
+
+// longest frame of a batch, every value taking its longest varint
+#define PROBE_TELEMETRY_MAX_LEN(probes, count) (PROBE_TELEMETRY_HEADER_MAX + ((probes) * ((((count) + 7) / 8) + (10 * (count)))))
+
+/**
+ * @brief Layout and quantisation of a batch
+ * @note Sample k of every probe is timestamped base_us + k * interval_us, the sampling grid
+ * 
+ */
+typedef struct{
+    uint32_t base_us; // timestamp of the first sample of each probe
+    uint32_t interval_us; // sample period
+    uint8_t count; // samples per probe, 1 to 255
+    uint16_t lux_step; // illuminance quantum in lux, 1 for lossless
+    uint16_t temp_step; // temperature quantum in 0.01 C, e.g. 10 for 0.1 C
+}probe_telemetry_cfg_t;
+
+/**
+ * @brief Encodes a batch of samples into a frame: a header with the base timestamp and the bitmap of the probes,
+ * then per probe its illuminance and temperature arrays, quantised and delta encoded as zigzag varints
+ * @note Failed samples are flagged in a per probe validity bitmap, present only if a sample of the batch failed.
+ * Runs without heap on a bounded stack
+ * 
+ * @param cfg: A pointer to the batch layout
+ * @param samples: probes rows of cfg->count samples, rows in ascending address order
+ * @param probes: Number of probes
+ * @param buf: output buffer, PROBE_TELEMETRY_MAX_LEN(probes, count) bytes always fit
+ * @param size: output buffer size
+ * @param len: frame length
+ * @return probe_status_e: STATUS_ERR if the frame does not fit, or addresses are not ascending
+ */
+probe_status_e probe_telemetry_encode(const probe_telemetry_cfg_t* cfg, const probe_sample_t* samples, uint16_t probes, uint8_t* buf, size_t size, size_t* len);
+
+/**
+ * @brief Decodes a frame into samples, rows of cfg->count samples per probe in ascending address order
+ * 
+ * @param buf: frame
+ * @param len: frame length
+ * @param cfg: decoded batch layout
+ * @param samples: decoded samples, failed ones with STATUS_ERR
+ * @param max_samples: size of samples
+ * @param n: number of decoded samples
+ * @return probe_status_e: STATUS_ERR if the frame is malformed or holds more than max_samples samples
+ */
+probe_status_e probe_telemetry_decode(const uint8_t* buf, size_t len, probe_telemetry_cfg_t* cfg, probe_sample_t* samples, uint16_t max_samples, uint16_t* n);
+
+#endif
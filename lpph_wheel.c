@@ -0,0 +1,191 @@
+/**
+ * @file lpph_wheel.c
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the implementation of the hashed hierarchical timer wheel used by the probe bus engine
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "lpph_wheel.h"
+#include "stddef.h"
+
+#define SLOT_MASK                   (PROBE_WHEEL_SLOTS - 1)
+#define SLOT_INDEX(tick, level)     (((tick) >> ((level) * PROBE_WHEEL_SLOT_BITS)) & SLOT_MASK)
+
+
+/**
+ * @brief Links a timer in the slot matching its expiry
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param timer: pointer to unlinked timer
+ */
+static void link_timer(probe_wheel_t* wheel, probe_timer_t* timer);
+
+/**
+ * @brief Unlinks a timer from its slot
+ * 
+ * @param timer: pointer to linked timer
+ */
+static void unlink_timer(probe_timer_t* timer);
+
+/**
+ * @brief Re-hashes all timers of a slot into lower levels
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param level: level of the slot
+ * @param idx: index of the slot
+ */
+static void cascade(probe_wheel_t* wheel, uint8_t level, uint32_t idx);
+
+
+
+void probe_wheel_init(probe_wheel_t* wheel, uint32_t now){
+    for(uint8_t l = 0; l < PROBE_WHEEL_LEVELS; l++){
+        for(uint32_t i = 0; i < PROBE_WHEEL_SLOTS; i++){
+            wheel->slots[l][i] = NULL;
+        }
+    }
+    wheel->tick = now;
+    wheel->pending = 0;
+}
+
+void probe_timer_init(probe_timer_t* timer, void(*callback)(void* arg), void* arg){
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+void probe_wheel_arm(probe_wheel_t* wheel, probe_timer_t* timer, uint32_t expires){
+    if(timer->pprev != NULL){
+        unlink_timer(timer);
+        wheel->pending--;
+    }
+    timer->expires = expires;
+    link_timer(wheel, timer);
+    wheel->pending++;
+}
+
+void probe_wheel_cancel(probe_wheel_t* wheel, probe_timer_t* timer){
+    if(timer->pprev == NULL){
+        return;
+    }
+    unlink_timer(timer);
+    wheel->pending--;
+}
+
+uint8_t probe_timer_armed(const probe_timer_t* timer){
+    return timer->pprev != NULL;
+}
+
+void probe_wheel_advance(probe_wheel_t* wheel, uint32_t now){
+    while((int32_t) (now - wheel->tick) >= 0){
+        uint32_t tick = wheel->tick;
+        // entering a new level 0 rotation, bring down the timers of the matching upper level slots
+        for(uint8_t l = 1; (l < PROBE_WHEEL_LEVELS) && (SLOT_INDEX(tick, l - 1) == 0); l++){
+            cascade(wheel, l, SLOT_INDEX(tick, l));
+        }
+        // detach the whole slot, timers armed by callbacks for this tick are picked up by the next advance
+        probe_timer_t* expired = wheel->slots[0][tick & SLOT_MASK];
+        wheel->slots[0][tick & SLOT_MASK] = NULL;
+        if(expired != NULL){
+            expired->pprev = &expired;
+        }
+        wheel->tick++;
+        while(expired != NULL){
+            probe_timer_t* timer = expired;
+            unlink_timer(timer);
+            wheel->pending--;
+            timer->callback(timer->arg);
+        }
+    }
+}
+
+uint8_t probe_wheel_next_expiry(const probe_wheel_t* wheel, uint32_t* expires){
+    if(wheel->pending == 0){
+        return 0;
+    }
+    uint8_t found = 0;
+    uint32_t best = 0;
+    // level 0 slots map to a single tick
+    for(uint32_t k = 0; k < PROBE_WHEEL_SLOTS; k++){
+        uint32_t tick = wheel->tick + k;
+        if(wheel->slots[0][tick & SLOT_MASK] != NULL){
+            best = tick;
+            found = 1;
+            break;
+        }
+    }
+    // upper level slots are cascaded when the tick enters their range, their timers may expire before the level 0 ones
+    for(uint8_t l = 1; l < PROBE_WHEEL_LEVELS; l++){
+        uint8_t shift = l * PROBE_WHEEL_SLOT_BITS;
+        uint32_t block = wheel->tick >> shift;
+        // the current slot is still to be cascaded when the tick sits at its start
+        uint32_t first = ((wheel->tick & ((1UL << shift) - 1)) == 0) ? 0 : 1;
+        for(uint32_t k = first; k < first + PROBE_WHEEL_SLOTS; k++){
+            if(wheel->slots[l][(block + k) & SLOT_MASK] != NULL){
+                uint32_t start = (block + k) << shift;
+                if(!found || ((int32_t) (start - best) < 0)){
+                    best = start;
+                    found = 1;
+                }
+                break;
+            }
+        }
+    }
+    *expires = best;
+    return found;
+}
+
+
+static void link_timer(probe_wheel_t* wheel, probe_timer_t* timer){
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel->tick;
+    if((int32_t) delta < 0){
+        // already late, expires on the next processed tick
+        expires = wheel->tick;
+        delta = 0;
+    }
+    else if(delta > PROBE_WHEEL_MAX_DELTA){
+        expires = wheel->tick + PROBE_WHEEL_MAX_DELTA;
+        delta = PROBE_WHEEL_MAX_DELTA;
+    }
+    uint8_t level = 0;
+    while((level < (PROBE_WHEEL_LEVELS - 1)) && (delta >= (1UL << ((level + 1) * PROBE_WHEEL_SLOT_BITS)))){
+        level++;
+    }
+    probe_timer_t** slot = &wheel->slots[level][SLOT_INDEX(expires, level)];
+    timer->next = *slot;
+    if(timer->next != NULL){
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+
+static void unlink_timer(probe_timer_t* timer){
+    *timer->pprev = timer->next;
+    if(timer->next != NULL){
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+
+static void cascade(probe_wheel_t* wheel, uint8_t level, uint32_t idx){
+    probe_timer_t* timer = wheel->slots[level][idx];
+    wheel->slots[level][idx] = NULL;
+    while(timer != NULL){
+        probe_timer_t* next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        link_timer(wheel, timer);
+        timer = next;
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * @file lpph_wheel.h
+ * @author joubiti (github.com/joubiti)
+ * @brief This file contains the hashed hierarchical timer wheel used by the probe bus engine
+ * @version 0.1
+ * @date 2024-09-06
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef LPPH_WHEEL_H
+#define LPPH_WHEEL_H
+
+#include "stdint.h"
+
+#define PROBE_WHEEL_LEVELS          4
+#define PROBE_WHEEL_SLOT_BITS       6
+#define PROBE_WHEEL_SLOTS           (1 << PROBE_WHEEL_SLOT_BITS) // slots per level, 4 levels cover 2^24 ticks
+#define PROBE_WHEEL_MAX_DELTA       ((1UL << (PROBE_WHEEL_LEVELS * PROBE_WHEEL_SLOT_BITS)) - 1) // longer timers are re-hashed when their slot expires
+
+/**
+ * @brief Timer node, embedded in the object owning the deadline
+ * 
+ */
+typedef struct probe_timer{
+    struct probe_timer* next;
+    struct probe_timer** pprev; // NULL when not armed
+    uint32_t expires; // expiry tick
+    void(*callback)(void* arg); // called once the timer expires
+    void* arg;
+}probe_timer_t;
+
+/**
+ * @brief Hierarchical timer wheel, level 0 slots hold one tick, level n slots hold 64^n ticks
+ * 
+ */
+typedef struct{
+    probe_timer_t* slots[PROBE_WHEEL_LEVELS][PROBE_WHEEL_SLOTS];
+    uint32_t tick; // next tick to be processed
+    uint32_t pending; // number of armed timers
+}probe_wheel_t;
+
+/**
+ * @brief Initializes a timer wheel
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param now: current tick
+ */
+void probe_wheel_init(probe_wheel_t* wheel, uint32_t now);
+
+/**
+ * @brief Initializes a timer node
+ * 
+ * @param timer: pointer to timer
+ * @param callback: called with arg once the timer expires
+ * @param arg: callback argument
+ */
+void probe_timer_init(probe_timer_t* timer, void(*callback)(void* arg), void* arg);
+
+/**
+ * @brief Arms a timer, re-arming it if already armed, in O(1)
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param timer: pointer to timer
+ * @param expires: expiry tick, a tick already processed expires on the next advance
+ */
+void probe_wheel_arm(probe_wheel_t* wheel, probe_timer_t* timer, uint32_t expires);
+
+/**
+ * @brief Cancels a timer in O(1), does nothing if not armed
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param timer: pointer to timer
+ */
+void probe_wheel_cancel(probe_wheel_t* wheel, probe_timer_t* timer);
+
+/**
+ * @brief Checks whether a timer is armed
+ * 
+ * @param timer: pointer to timer
+ * @return uint8_t: 1 if armed, 0 otherwise
+ */
+uint8_t probe_timer_armed(const probe_timer_t* timer);
+
+/**
+ * @brief Processes all ticks up to now, expiring the timers of each tick as one batch
+ * @note Callbacks may arm and cancel any timer, including the expiring one
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param now: current tick
+ */
+void probe_wheel_advance(probe_wheel_t* wheel, uint32_t now);
+
+/**
+ * @brief Gives a lower bound of the next expiry, exact when the next timer sits in level 0
+ * 
+ * @param wheel: pointer to timer wheel
+ * @param expires: tick at which probe_wheel_advance must be called next
+ * @return uint8_t: 1 if a timer is armed, 0 otherwise
+ */
+uint8_t probe_wheel_next_expiry(const probe_wheel_t* wheel, uint32_t* expires);
+
+#endif